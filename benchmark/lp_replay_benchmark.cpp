@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef USE_MODULE
+#include "LinearProgramming/LPFormat.cxx"
+#include "Math/Simplex.cxx"
+#else
+import LPFormat;
+import Simplex;
+#endif
+
+// Replays the LPs written by `turbo-loop<lp-dump=dir>` through `Simplex`:
+//   LPReplayBenchmark [benchmark flags] dir
+// Each `.lp` file is its own benchmark, timing `initiateFeasible` followed by
+// the `rLexMinStop` the file's objective calls for, if any.
+
+namespace {
+
+void solve(benchmark::State &state, const lp::LPFile &lp) {
+  math::PtrMatrix<int64_t> C{lp.C};
+  for (auto _ : state) {
+    std::unique_ptr<math::Simplex> simplex = math::Simplex::create(
+      math::row(ptrdiff_t(C.numRow())), math::col(ptrdiff_t(C.numCol()) - 1));
+    simplex->getConstraints() << C;
+    bool infeasible = simplex->initiateFeasible();
+    if (!infeasible && lp.stop) {
+      auto sol = simplex->rLexMinStop(*lp.stop);
+      benchmark::DoNotOptimize(sol);
+    }
+    benchmark::DoNotOptimize(infeasible);
+  }
+  state.counters["rows"] = double(C.numRow());
+  state.counters["cols"] = double(C.numCol()) - 1;
+}
+
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  benchmark::Initialize(&argc, argv);
+  if (argc != 2) {
+    std::cerr << "usage: " << argv[0] << " [benchmark flags] <lp-dump dir>\n";
+    return 1;
+  }
+  std::vector<std::filesystem::path> files;
+  for (const auto &entry : std::filesystem::directory_iterator(argv[1]))
+    if (entry.path().extension() == ".lp") files.push_back(entry.path());
+  // `directory_iterator` order is unspecified
+  std::ranges::sort(files);
+  // kept alive until the benchmarks have run
+  std::vector<std::unique_ptr<lp::LPFile>> lps;
+  for (const std::filesystem::path &file : files) {
+    std::ifstream is{file};
+    std::optional<lp::LPFile> lp = lp::LPFile::read(is);
+    if (!lp) {
+      std::cerr << "skipping unreadable " << file << "\n";
+      continue;
+    }
+    const lp::LPFile &l = *lps.emplace_back(
+      std::make_unique<lp::LPFile>(std::move(*lp)));
+    benchmark::RegisterBenchmark(file.stem().string(),
+                                 [&l](benchmark::State &s) { solve(s, l); });
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,69 @@
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef USE_MODULE
+#include "Optimize/MemoryCost.cxx"
+#include "Optimize/Unrolls.cxx"
+#else
+import CostModeling;
+#endif
+
+// Costs a batch of unroll candidates of one `Addr`, either batched or one
+// candidate at a time, as `SubCostFn` did before batching.
+//   MemoryCostBenchmark [benchmark flags]
+
+namespace {
+
+using CostModeling::Unrolls, CostModeling::UnrollBatch,
+  CostModeling::Cost::CostBatch, CostModeling::Cost::MemCostSummary;
+
+constexpr ptrdiff_t unroll_batch = 8;
+
+// `for (i = 0:64, j = 0:100, k = 0:37)`, with `j` vectorized; an `Addr`
+// contiguous along `k` and depending on all three loops takes the shuffle
+// branch of `laneCost`, weighing gathers and packing per candidate.
+auto shuffleBatch() -> UnrollBatch<unroll_batch> {
+  Unrolls unrolls{};
+  unrolls.pushUnroll(2, 64, true);
+  unrolls.pushUnroll(3, 100, false);
+  unrolls.setVF(3);
+  unrolls.pushUnroll(1, 37, true);
+  return {unrolls, 1};
+}
+auto summary(double noncon) -> MemCostSummary {
+  return {.loadstowcost_ = {IR::Addr::Costs{.scalar_ = 1.0,
+                                            .contig_ = 2.0,
+                                            .noncon_ = noncon},
+                            IR::Addr::Costs{.scalar_ = 1.5,
+                                            .contig_ = 2.5,
+                                            .noncon_ = 1.5 * noncon}},
+          .orth_ = {.contig_ = 0x4, .conv_axes_ = 0, .dep_ = 0x7}};
+}
+
+void BM_MemoryCostBatch(benchmark::State &state) {
+  UnrollBatch<unroll_batch> batch = shuffleBatch();
+  MemCostSummary mcs = summary(double(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(batch);
+    CostBatch<unroll_batch> costs = CostModeling::Cost::cost(batch, mcs);
+    benchmark::DoNotOptimize(costs);
+  }
+}
+void BM_MemoryCostLanes(benchmark::State &state) {
+  UnrollBatch<unroll_batch> batch = shuffleBatch();
+  MemCostSummary mcs = summary(double(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(batch);
+    CostBatch<unroll_batch> costs{};
+    for (ptrdiff_t w = 0; w < unroll_batch; ++w)
+      costs.set(w, CostModeling::Cost::cost(batch.lane(w), mcs));
+    benchmark::DoNotOptimize(costs);
+  }
+}
+
+} // namespace
+
+// gathers cheaper and costlier than shuffles, respectively
+BENCHMARK(BM_MemoryCostBatch)->Arg(3)->Arg(40);
+BENCHMARK(BM_MemoryCostLanes)->Arg(3)->Arg(40);
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/TargetParser/Host.h>
+#include <llvm/Transforms/Utils/LCSSA.h>
+#include <llvm/Transforms/Utils/LoopSimplify.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef USE_MODULE
+#include "Frontends/Pass.cxx"
+#else
+import TurboLoopPass;
+#endif
+
+// Batch driver: runs `TurboLoop` over every function of many `.ll`/`.bc`
+// files, without going through `opt -load-pass-plugin`.
+// Files are distributed over a pool of worker threads; each worker owns its
+// `LLVMContext` and its `TurboLoopPass`, so no LLVM IR or pass state is shared
+// between threads.
+// Per-file timings are reported in input order, regardless of scheduling.
+
+namespace {
+
+llvm::cl::list<std::string> input_files(llvm::cl::Positional,
+                                        llvm::cl::desc("<input .ll/.bc files>"),
+                                        llvm::cl::OneOrMore);
+llvm::cl::opt<std::string>
+  output_dir("o", llvm::cl::desc("Directory to write optimized modules to"),
+             llvm::cl::value_desc("dir"));
+llvm::cl::opt<unsigned>
+  num_threads("j", llvm::cl::desc("Number of worker threads (default: all)"),
+              llvm::cl::init(0));
+llvm::cl::opt<std::string>
+  timing_file("timing", llvm::cl::desc("Write per-file timing CSV here"),
+              llvm::cl::value_desc("file"), llvm::cl::init("-"));
+llvm::cl::opt<std::string> mcpu("mcpu", llvm::cl::desc("Target CPU"),
+                                llvm::cl::init("native"));
+llvm::cl::opt<bool> metadata_only(
+  "metadata-only",
+  llvm::cl::desc("Attach llvm.loop metadata instead of rewriting loops"));
+llvm::cl::opt<std::string> turbo_loop_options(
+  "turbo-loop-options",
+  llvm::cl::desc("Options of the pass, as in `turbo-loop<...>`, e.g. "
+                 "`cache=path;threads=4`. Each worker has its own thread pool "
+                 "and `lp-dump` subdirectory"),
+  llvm::cl::value_desc("opt1;opt2"));
+
+struct FileResult {
+  double parse_ms_{0}, optimize_ms_{0}, write_ms_{0};
+  ptrdiff_t num_functions_{0};
+  std::string error_;
+};
+
+auto elapsedMs(std::chrono::steady_clock::time_point start) -> double {
+  return std::chrono::duration<double, std::milli>(
+           std::chrono::steady_clock::now() - start)
+    .count();
+}
+
+auto createTargetMachine(const llvm::Module &M, std::string &err)
+  -> std::unique_ptr<llvm::TargetMachine> {
+  std::string triple = M.getTargetTriple();
+  if (triple.empty()) triple = llvm::sys::getDefaultTargetTriple();
+  const llvm::Target *T = llvm::TargetRegistry::lookupTarget(triple, err);
+  if (!T) return nullptr;
+  std::string cpu =
+    mcpu == "native" ? std::string(llvm::sys::getHostCPUName()) : mcpu;
+  return std::unique_ptr<llvm::TargetMachine>(T->createTargetMachine(
+    triple, cpu, "", llvm::TargetOptions{}, std::nullopt));
+}
+
+auto absolutePath(llvm::StringRef input) -> llvm::SmallString<256> {
+  llvm::SmallString<256> path{input};
+  llvm::sys::fs::make_absolute(path);
+  llvm::sys::path::remove_dots(path, /*remove_dot_dot=*/true);
+  return path;
+}
+
+// Longest directory that contains every input; outputs mirror the inputs'
+// paths relative to it, so `a/x.ll` and `b/x.ll` do not collide.
+auto commonRoot() -> llvm::SmallString<256> {
+  llvm::SmallString<256> root =
+    llvm::sys::path::parent_path(absolutePath(input_files[0]));
+  for (const std::string &input : input_files) {
+    llvm::SmallString<256> dir =
+      llvm::sys::path::parent_path(absolutePath(input));
+    auto r = llvm::sys::path::begin(root), re = llvm::sys::path::end(root);
+    auto d = llvm::sys::path::begin(dir), de = llvm::sys::path::end(dir);
+    llvm::SmallString<256> common;
+    for (; r != re && d != de && *r == *d; ++r, ++d)
+      llvm::sys::path::append(common, *r);
+    root = common;
+  }
+  return root;
+}
+
+auto outputPath(llvm::StringRef root, llvm::StringRef input) -> std::string {
+  llvm::SmallString<256> abs = absolutePath(input);
+  llvm::StringRef rel = abs.str().drop_front(root.size());
+  llvm::SmallString<256> path{output_dir};
+  llvm::sys::path::append(path, llvm::sys::path::relative_path(rel));
+  return std::string(path);
+}
+
+void writeModule(const llvm::Module &M, llvm::StringRef input,
+                 llvm::StringRef output, FileResult &res) {
+  std::error_code ec =
+    llvm::sys::fs::create_directories(llvm::sys::path::parent_path(output));
+  if (ec) {
+    res.error_ = ec.message();
+    return;
+  }
+  llvm::raw_fd_ostream os(output, ec);
+  if (ec) {
+    res.error_ = ec.message();
+    return;
+  }
+  if (llvm::sys::path::extension(input) == ".bc")
+    llvm::WriteBitcodeToFile(M, os);
+  else M.print(os, nullptr);
+}
+
+void processFile(llvm::LLVMContext &ctx, llvm::FunctionPassManager &FPM,
+                 llvm::StringRef input, llvm::StringRef output,
+                 FileResult &res) {
+  auto start = std::chrono::steady_clock::now();
+  llvm::SMDiagnostic diag;
+  std::unique_ptr<llvm::Module> M = llvm::parseIRFile(input, diag, ctx);
+  res.parse_ms_ = elapsedMs(start);
+  if (!M) {
+    res.error_ = diag.getMessage().str();
+    return;
+  }
+  std::unique_ptr<llvm::TargetMachine> TM = createTargetMachine(*M, res.error_);
+  if (!TM) return;
+  M->setDataLayout(TM->createDataLayout());
+  start = std::chrono::steady_clock::now();
+  {
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::PassBuilder PB(TM.get());
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    for (llvm::Function &F : *M)
+      if (!F.isDeclaration()) FPM.run(F, FAM);
+  }
+  res.optimize_ms_ = elapsedMs(start);
+  res.num_functions_ = std::ranges::count_if(
+    M->functions(), [](const llvm::Function &F) { return !F.isDeclaration(); });
+  if (output_dir.empty()) return;
+  start = std::chrono::steady_clock::now();
+  writeModule(*M, input, output, res);
+  res.write_ms_ = elapsedMs(start);
+}
+
+void writeTiming(llvm::raw_ostream &os,
+                 const std::vector<FileResult> &results) {
+  os << "file,functions,parse_ms,optimize_ms,write_ms,error\n";
+  double total = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const FileResult &r = results[i];
+    os << input_files[i] << "," << r.num_functions_ << "," << r.parse_ms_
+       << "," << r.optimize_ms_ << "," << r.write_ms_ << "," << r.error_
+       << "\n";
+    total += r.parse_ms_ + r.optimize_ms_ + r.write_ms_;
+  }
+  os << "# total_ms," << total << "\n";
+}
+
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  llvm::InitLLVM init(argc, argv);
+  llvm::InitializeAllTargetInfos();
+  llvm::InitializeAllTargets();
+  llvm::InitializeAllTargetMCs();
+  llvm::cl::ParseCommandLineOptions(argc, argv, "TurboLoop batch driver\n");
+  std::optional<TurboLoopConfig> config =
+    parseTurboLoopOptions(turbo_loop_options);
+  if (!config) {
+    llvm::errs() << "invalid -turbo-loop-options: " << turbo_loop_options
+                 << "\n";
+    return 1;
+  }
+  config->opts_.metadata_only_ |= metadata_only;
+  // workers' profilers merge their events into this thread's on finishing
+  std::optional<TimeTraceFile> trace_file;
+  if (!config->trace_path_.empty()) {
+    trace_file.emplace(std::move(config->trace_path_));
+    config->trace_path_.clear();
+  }
+  bool trace = llvm::timeTraceProfilerEnabled();
+  size_t num_files = input_files.size();
+  std::vector<std::string> outputs(num_files);
+  if (!output_dir.empty()) {
+    // Two workers writing the same output would race, so refuse inputs
+    // that map onto the same path (i.e. the same file listed twice).
+    llvm::SmallString<256> root = commonRoot();
+    llvm::StringSet<> seen;
+    for (size_t i = 0; i < num_files; ++i) {
+      outputs[i] = outputPath(root, input_files[i]);
+      if (seen.insert(outputs[i]).second) continue;
+      llvm::errs() << "duplicate input " << input_files[i]
+                   << " would overwrite " << outputs[i] << "\n";
+      return 1;
+    }
+  }
+  std::vector<FileResult> results(num_files);
+  unsigned nthreads = num_threads
+                        ? unsigned(num_threads)
+                        : std::max(1U, std::thread::hardware_concurrency());
+  nthreads = std::min<unsigned>(nthreads, num_files);
+  // Workers grab the next file index; results are stored by index, so
+  // output order does not depend on scheduling.
+  std::atomic<size_t> next{0};
+  auto worker = [&](unsigned t) {
+    if (trace)
+      llvm::timeTraceProfilerInitialize(time_trace_granularity,
+                                        "turbo-loop-driver");
+    {
+      // LP dumps are numbered per pass, so each worker writes its own
+      TurboLoopConfig worker_config = *config;
+      if (!worker_config.dump_dir_.empty())
+        worker_config.dump_dir_ += "/worker-" + std::to_string(t);
+      // `TurboLoop` expects loops in simplified and LCSSA form, as at the
+      // vectorizer start extension point
+      llvm::FunctionPassManager FPM;
+      FPM.addPass(llvm::LoopSimplifyPass());
+      FPM.addPass(llvm::LCSSAPass());
+      FPM.addPass(TurboLoopPass(worker_config));
+      llvm::LLVMContext ctx;
+      for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) <
+                     num_files;)
+        processFile(ctx, FPM, input_files[i], outputs[i], results[i]);
+    }
+    if (trace) llvm::timeTraceProfilerFinishThread();
+  };
+  std::vector<std::thread> pool;
+  pool.reserve(nthreads);
+  for (unsigned t = 0; t < nthreads; ++t) pool.emplace_back(worker, t);
+  for (std::thread &t : pool) t.join();
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(timing_file, ec);
+  if (ec) {
+    llvm::errs() << "failed to open " << timing_file << ": " << ec.message()
+                 << "\n";
+    return 1;
+  }
+  writeTiming(os, results);
+  bool failed = std::ranges::any_of(
+    results, [](const FileResult &r) { return !r.error_.empty(); });
+  return failed ? 1 : 0;
+}
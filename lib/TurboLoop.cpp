@@ -32,9 +32,10 @@
 #include <llvm/Support/Compiler.h>
 #include <llvm/Support/FormatVariadic.h>
 #include <llvm/Support/raw_ostream.h>
+#include <optional>
 
 import TurboLoop;
-import LLVMFrontend;
+import TurboLoopPass;
 
 // #include <llvm/Passes/OptimizationLevel.h>
 // #include <llvm/Support/Casting.h>
@@ -52,29 +53,20 @@ import LLVMFrontend;
 // directly leads to another, which would be important for whether two loops may
 // be fused.
 
-class TurboLoopPass : public llvm::PassInfoMixin<TurboLoopPass> {
-public:
-  TurboLoopPass() = default;
-  TurboLoopPass(const TurboLoopPass &) = delete;
-  TurboLoopPass(TurboLoopPass &&) = default;
-
-  static auto __attribute__((visibility("default")))
-  run(llvm::Function &F,
-      llvm::FunctionAnalysisManager &FAM) -> llvm::PreservedAnalyses {
-    TurboLoop tl{F, FAM};
-    return tl.run();
-  }
-};
 auto __attribute__((visibility("default")))
 PipelineParsingCB(llvm::StringRef Name, llvm::FunctionPassManager &FPM,
                   llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) -> bool {
-  if (Name == "turbo-loop") {
-    // FPM.addPass(llvm::createFunctionToLoopPassAdaptor(llvm::LoopSimplifyPass()));
-    // FPM.addPass(llvm::createFunctionToLoopPassAdaptor(llvm::IndVarSimplifyPass()));
-    FPM.addPass(TurboLoopPass());
-    return true;
-  }
-  return false;
+  if (!Name.consume_front("turbo-loop")) return false;
+  std::optional<TurboLoopConfig> config = TurboLoopConfig{};
+  if (Name.consume_front("<")) {
+    if (!Name.consume_back(">")) return false;
+    config = parseTurboLoopOptions(Name);
+  } else if (!Name.empty()) return false;
+  if (!config) return false;
+  // FPM.addPass(llvm::createFunctionToLoopPassAdaptor(llvm::LoopSimplifyPass()));
+  // FPM.addPass(llvm::createFunctionToLoopPassAdaptor(llvm::IndVarSimplifyPass()));
+  FPM.addPass(TurboLoopPass(*config));
+  return true;
 }
 
 void __attribute__((visibility("default"))) RegisterCB(llvm::PassBuilder &PB) {
@@ -4,14 +4,42 @@ module;
 #pragma once
 #endif
 
-// #include <llvm/Analysis/ScalarEvolution.h>
-// #include <llvm/Analysis/TargetTransformInfo.h>
-// #include <llvm/IR/IRBuilder.h>
-// #include <llvm/IR/LLVMContext.h>
-// #include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/DependenceAnalysis.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/MemoryBuiltins.h>
+#include <llvm/Analysis/OptimizationRemarkEmitter.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Type.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Transforms/Utils/LoopUtils.h>
+#include <llvm/Transforms/Utils/UnrollLoop.h>
 
-#ifdef USE_MODULE
+#ifndef USE_MODULE
+#include "Dicts/Dict.cxx"
+#include "IR/IR.cxx"
+#include "Math/Array.cxx"
+#include "Optimize/LoopTransform.cxx"
+#else
 export module CodeGen;
+import Array;
+import IR;
+import LoopTransform;
 #endif
 
 #ifdef USE_MODULE
@@ -19,18 +47,286 @@ export namespace codegen {
 #else
 namespace codegen {
 #endif
+using CostModeling::LoopTransform, math::PtrVector;
+
+/// The lowering decision for a single loop.
+/// `IR::Loop` trees and the `LoopTransform`s live in arenas that get reset
+/// between nests, so we record the original `llvm::Loop` directly, and apply
+/// all plans once we are done parsing the function; transforming earlier
+/// would invalidate the `llvm::Loop` sub-loop lists we are still iterating.
+struct LoopPlan {
+  llvm::Loop *loop_;
+  LoopTransform trf_;
+  bool innermost_;
+};
+
+/// Returns the `llvm::Loop` that `L` was parsed from.
+/// `poly::Loop`s keep a pointer to their innermost `llvm::Loop`; outer loops
+/// that were peeled have been removed from the `poly::Loop`, so we walk out
+/// `getNumLoops() - depth1` levels.
+inline auto originalLoop(const IR::Loop *L) -> llvm::Loop * {
+  poly::Loop *AL = L->getAffineLoop();
+  if (!AL) return nullptr;
+  llvm::Loop *LL = AL->getLLVMLoop();
+  for (ptrdiff_t d = AL->getNumLoops(), depth1 = L->getCurrentDepth();
+       LL && d > depth1; --d)
+    LL = LL->getParentLoop();
+  return LL;
+}
+inline auto originalLoop(const IR::Addr *A, ptrdiff_t depth1) -> llvm::Loop * {
+  llvm::Loop *LL = A->getAffLoop()->getLLVMLoop();
+  for (ptrdiff_t d = A->getAffLoop()->getNumLoops(); LL && d > depth1; --d)
+    LL = LL->getParentLoop();
+  return LL;
+}
+
+/// Checks whether the scheduler kept every node in its original loop order:
+/// identity `phi` and no offsets. Only then does the `IR::Loop` tree mirror
+/// the original `llvm::Loop` nest, so that we can lower in place.
+inline auto preservesOriginalOrder(lp::ScheduledNode *nodes) -> bool {
+  for (lp::ScheduledNode *node : nodes->getAllVertices()) {
+    auto phi = node->getPhi();
+    ptrdiff_t nl = node->getNumLoops();
+    for (ptrdiff_t i = 0; i < nl; ++i)
+      for (ptrdiff_t j = 0; j < nl; ++j)
+        if (phi[i, j] != (i == j)) return false;
+    if (const int64_t *offs = node->getOffset())
+      for (ptrdiff_t i = 0; i < nl; ++i)
+        if (offs[i]) return false;
+  }
+  return true;
+}
+
+// NOLINTNEXTLINE(misc-no-recursion)
+inline auto planLoop(IR::Loop *L, PtrVector<LoopTransform> trfs, ptrdiff_t &t,
+                     llvm::SmallPtrSetImpl<llvm::Loop *> &seen,
+                     llvm::SmallVectorImpl<LoopPlan> &plans) -> bool {
+  llvm::Loop *LL = originalLoop(L);
+  if (!LL || !seen.insert(LL).second) return false;
+  ptrdiff_t depth1 = L->getCurrentDepth();
+  for (IR::Node *N = L->getChild(); N; N = N->getNext())
+    if (auto *A = llvm::dyn_cast<IR::Addr>(N))
+      if (originalLoop(A, depth1) != LL) return false;
+  IR::Loop *SL = L->getSubLoop();
+  if (L->getLegality().reorderable_) {
+    if (t >= trfs.size()) return false;
+    plans.push_back({.loop_ = LL, .trf_ = trfs[t++], .innermost_ = !SL});
+  }
+  for (; SL; SL = SL->getNextLoop())
+    if (!planLoop(SL, trfs, t, seen, plans)) return false;
+  return true;
+}
+
+/// Walks the `IR::Loop` tree in depth-first pre-order, the same order used by
+/// `LoopTreeCostFn`, pairing reorderable loops with their `LoopTransform`.
+/// Appends to `plans`, returning `false` and leaving `plans` unchanged if the
+/// tree does not map one-to-one onto the original `llvm::Loop`s, e.g. because
+/// loops were fused.
+inline auto planLowering(IR::Loop *root, PtrVector<LoopTransform> trfs,
+                         llvm::SmallVectorImpl<LoopPlan> &plans) -> bool {
+  size_t init_size = plans.size();
+  ptrdiff_t t = 0;
+  llvm::SmallPtrSet<llvm::Loop *, 16> seen;
+  for (IR::Loop *L = root->getSubLoop(); L; L = L->getNextLoop()) {
+    if (planLoop(L, trfs, t, seen, plans)) continue;
+    plans.truncate(init_size);
+    return false;
+  }
+  return true;
+}
+
+inline auto loopAttr(llvm::LLVMContext &ctx, llvm::StringRef name,
+                     llvm::Type *typ, uint64_t value) -> llvm::MDNode * {
+  return llvm::MDNode::get(
+    ctx, {llvm::MDString::get(ctx, name),
+          llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(typ, value))});
+}
+
+/// Hands `p` to LLVM's own loop transforms instead of rewriting the loop.
+/// Innermost loops get `llvm.loop.vectorize.width` and
+/// `llvm.loop.interleave.count` from the vector width and register unroll.
+/// Like clang's `vectorize(disable) interleave_count(N)`, a width of `1` is
+/// expressed through `llvm.loop.vectorize.width` alone; setting
+/// `llvm.loop.vectorize.enable` to `false` would make `LoopVectorize` skip
+/// interleaving too. As the register unroll already accounts for the chosen
+/// interleaving, we also set `llvm.loop.unroll.count` to `1` so the unroller
+/// does not grow the loop beyond the register footprint the cost model
+/// assumed.
+/// Outer loops get `llvm.loop.unroll_and_jam.count` from `reg_factor()`, the
+/// same count in-place lowering uses, so an outer loop's share of the vector
+/// lanes is unrolled rather than dropped.
+inline void attachMetadata(LoopPlan p) {
+  llvm::Loop *L = p.loop_;
+  llvm::LLVMContext &ctx = L->getHeader()->getContext();
+  llvm::Type *i1 = llvm::Type::getInt1Ty(ctx),
+             *i32 = llvm::Type::getInt32Ty(ctx);
+  uint64_t vw = p.trf_.vector_width(), uf = p.trf_.reg_unroll();
+  llvm::SmallVector<llvm::MDNode *, 4> attrs;
+  if (p.innermost_) {
+    if (vw > 1)
+      attrs.push_back(loopAttr(ctx, "llvm.loop.vectorize.enable", i1, 1));
+    attrs.push_back(loopAttr(ctx, "llvm.loop.vectorize.width", i32, vw));
+    attrs.push_back(loopAttr(ctx, "llvm.loop.interleave.count", i32, uf));
+    attrs.push_back(loopAttr(ctx, "llvm.loop.unroll.count", i32, 1));
+    L->setLoopID(llvm::makePostTransformationMetadata(
+      ctx, L->getLoopID(),
+      {"llvm.loop.vectorize.", "llvm.loop.interleave.",
+       "llvm.loop.unroll.count"},
+      attrs));
+  } else {
+    attrs.push_back(loopAttr(ctx, "llvm.loop.unroll_and_jam.count", i32,
+                             uint64_t(p.trf_.reg_factor())));
+    L->setLoopID(llvm::makePostTransformationMetadata(
+      ctx, L->getLoopID(), {"llvm.loop.unroll_and_jam.count"}, attrs));
+  }
+}
+
+/// Hands all `plans` to LLVM's own loop transforms.
+/// `plans` only cover nests `planLowering` could map onto the original
+/// `llvm::Loop`s, i.e. those whose schedule `preservesOriginalOrder`: the
+/// metadata can ask for vectorizing, interleaving and unrolling, but not for
+/// interchange, skewing or fusion, so a reordering schedule cannot be handed
+/// to LLVM by annotating the loops it reorders.
+/// Returns `true` if any loop's metadata changed.
+inline auto attachMetadata(llvm::ArrayRef<LoopPlan> plans) -> bool {
+  for (LoopPlan p : plans) attachMetadata(p);
+  return !plans.empty();
+}
+
+/// Materializes `LoopPlan`s on the original nest.
+/// Register unrolling of outer loops is applied via unroll-and-jam, by
+/// `reg_factor()`, i.e. vector width times register unroll, leaving an outer
+/// loop's vector lanes for the SLP vectorizer to pack. Innermost loops with a
+/// vector width get it, and their register unroll as interleave count, via
+/// `attachMetadata`, so that `LoopVectorize` emits the width we chose;
+/// scalar innermost loops are unrolled by their register unroll.
+/// Cache tiles are not lowered yet.
+class Lowering {
+  llvm::LoopInfo *li_;
+  llvm::ScalarEvolution *se_;
+  llvm::DominatorTree *dt_;
+  llvm::AssumptionCache *ac_;
+  const llvm::TargetTransformInfo *tti_;
+  llvm::OptimizationRemarkEmitter *ore_;
+  llvm::DependenceInfo *di_;
+  // loops partially unrolled, and by what factor
+  llvm::SmallDenseMap<llvm::Loop *, unsigned> unrolled_{};
+
+  [[nodiscard]] auto canUnroll(llvm::Loop *L) const -> bool {
+    return L->isLoopSimplifyForm() && L->isRecursivelyLCSSAForm(*dt_, *li_) &&
+           (L->getExitingBlock() == L->getLoopLatch());
+  }
+  auto unroll(llvm::Loop *L, unsigned count) -> bool {
+    if (count <= 1 || !L->isInnermost() || !canUnroll(L)) return false;
+    llvm::UnrollLoopOptions ulo{};
+    ulo.Count = count;
+    ulo.Force = true;
+    ulo.Runtime = true;
+    ulo.AllowExpensiveTripCount = false;
+    ulo.UnrollRemainder = false;
+    ulo.ForgetAllSCEV = false;
+    llvm::LoopUnrollResult r =
+      llvm::UnrollLoop(L, ulo, li_, se_, dt_, ac_, tti_, ore_, true);
+    if (r == llvm::LoopUnrollResult::PartiallyUnrolled) unrolled_[L] = count;
+    return r != llvm::LoopUnrollResult::Unmodified;
+  }
+  // `llvm::UnrollAndJamLoop` requires a two-deep nest with a single subloop.
+  // Our `Legality::reorderable_` is about the schedule's dependencies, not
+  // the blocks jamming moves, e.g. code between the outer header and the
+  // subloop, so we let `llvm::isSafeToUnrollAndJam` check both.
+  auto unrollAndJam(llvm::Loop *L, unsigned count) -> bool {
+    if (count <= 1 || L->getSubLoops().size() != 1) return false;
+    llvm::Loop *SL = L->getSubLoops().front();
+    if (!SL->isInnermost() || !canUnroll(L) || !canUnroll(SL)) return false;
+    if (!llvm::isSafeToUnrollAndJam(L, *se_, *dt_, *di_, *li_)) return false;
+    unsigned trip_count = se_->getSmallConstantTripCount(L),
+             trip_multiple = se_->getSmallConstantTripMultiple(L);
+    llvm::LoopUnrollResult r =
+      llvm::UnrollAndJamLoop(L, count, trip_count, trip_multiple, false, li_,
+                             se_, dt_, ac_, tti_, ore_);
+    if (r == llvm::LoopUnrollResult::PartiallyUnrolled) unrolled_[L] = count;
+    return r != llvm::LoopUnrollResult::Unmodified;
+  }
+
+public:
+  Lowering(llvm::LoopInfo *li, llvm::ScalarEvolution *se,
+           llvm::DominatorTree *dt, llvm::AssumptionCache *ac,
+           const llvm::TargetTransformInfo *tti,
+           llvm::OptimizationRemarkEmitter *ore, llvm::DependenceInfo *di)
+    : li_{li}, se_{se}, dt_{dt}, ac_{ac}, tti_{tti}, ore_{ore}, di_{di} {}
 
-// class Builder {
-//   std::unique_ptr<llvm::LLVMContext> ctx;
-//   std::unique_ptr<llvm::Module> mod;
-//   std::unique_ptr<llvm::IRBuilder<>> builder;
-//   // llvm::TargetTransformInfo &TTI;
+  /// Applies `plans`, returning `true` if the IR changed.
+  /// Outer loops are handled first in pre-order, as unroll-and-jam keeps the
+  /// original inner `llvm::Loop`, while unrolling an inner loop would add a
+  /// remainder loop, breaking the single-subloop form of its parent.
+  auto lower(llvm::ArrayRef<LoopPlan> plans) -> bool {
+    bool changed = false;
+    for (LoopPlan p : plans)
+      if (!p.innermost_)
+        changed |= unrollAndJam(p.loop_, unsigned(p.trf_.reg_factor()));
+    for (LoopPlan p : plans) {
+      if (!p.innermost_) continue;
+      if (p.trf_.vector_width() == 1) {
+        changed |= unroll(p.loop_, unsigned(p.trf_.reg_unroll()));
+      } else {
+        attachMetadata(p);
+        changed = true;
+      }
+    }
+    return changed;
+  }
+  /// The factor `lower` partially unrolled `L` by, `1` if it left `L` alone.
+  [[nodiscard]] auto unrollFactor(llvm::Loop *L) const -> unsigned {
+    auto it = unrolled_.find(L);
+    return it == unrolled_.end() ? 1 : it->second;
+  }
 
-//   void init() {
-//     ctx = std::make_unique<llvm::LLVMContext>();
-//     mod = std::make_unique<llvm::Module>("LoopModels", *ctx);
-//     builder = std::make_unique<llvm::IRBuilder<>>(*ctx);
-//   }
-// };
+  /// Erase allocations whose stores were all eliminated as temporaries.
+  /// `IROptimizer::eliminateTemporaries` only proves that the optimized
+  /// schedule does not need them; we erase a candidate only once nothing left
+  /// in the function reads from it, i.e. all remaining users are stores into
+  /// it, address computations, lifetime markers, or the matching `free`.
+  /// Returns the number of erased allocations.
+  static auto eraseDeadAllocations(dict::set<llvm::CallBase *> &candidates,
+                                   const llvm::TargetLibraryInfo *tli)
+    -> ptrdiff_t {
+    ptrdiff_t erased = 0;
+    llvm::SmallVector<llvm::Instruction *> dead;
+    llvm::SmallVector<llvm::Value *> worklist;
+    llvm::SmallPtrSet<llvm::Instruction *, 16> visited;
+    for (llvm::CallBase *call : candidates) {
+      dead.clear();
+      worklist.clear();
+      visited.clear();
+      worklist.push_back(call);
+      bool removable = true;
+      while (removable && !worklist.empty()) {
+        llvm::Value *V = worklist.pop_back_val();
+        for (llvm::User *U : V->users()) {
+          auto *J = llvm::cast<llvm::Instruction>(U);
+          if (!visited.insert(J).second) continue;
+          if (auto *S = llvm::dyn_cast<llvm::StoreInst>(J)) {
+            removable = S->getPointerOperand() == V && !S->isVolatile();
+          } else if (llvm::isa<llvm::GetElementPtrInst, llvm::BitCastInst>(J)) {
+            worklist.push_back(J);
+          } else if (auto *II = llvm::dyn_cast<llvm::IntrinsicInst>(J)) {
+            removable = II->isLifetimeStartOrEnd();
+          } else if (auto *CB = llvm::dyn_cast<llvm::CallBase>(J)) {
+            removable = llvm::getFreedOperand(CB, tli) == V;
+          } else removable = false;
+          if (!removable) break;
+          dead.push_back(J);
+        }
+      }
+      if (!removable) continue;
+      // users were discovered after their operands
+      for (llvm::Instruction *J : llvm::reverse(dead)) J->eraseFromParent();
+      call->eraseFromParent();
+      ++erased;
+    }
+    candidates.clear();
+    return erased;
+  }
+};
 
-} // namespace codegen
\ No newline at end of file
+} // namespace codegen
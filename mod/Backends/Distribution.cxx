@@ -0,0 +1,250 @@
+#ifdef USE_MODULE
+module;
+#else
+#pragma once
+#endif
+
+#include <cstddef>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/DependenceAnalysis.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/MemoryLocation.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <memory>
+
+#ifdef USE_MODULE
+export module Distribution;
+#endif
+
+#ifdef USE_MODULE
+export namespace codegen {
+#else
+namespace codegen {
+#endif
+
+/// Salvages loop nests containing memory accesses we cannot represent, i.e.
+/// calls and other memory instructions that are not plain loads or stores.
+/// `TurboLoop::parseBlocks` rejects such nests as a whole; `distribute`
+/// instead splits a nest into a copy holding the affine statements, which we
+/// may then optimize, followed by the original holding the opaque statements,
+/// kept as they were.
+///
+/// The opaque statements are the opaque instructions and everything using
+/// them within the nest, e.g. the store of a call's result. Each copy keeps
+/// the control flow of the nest, and whatever its statements use, so loads and
+/// arithmetic feeding both parts are duplicated. The split is rejected unless
+/// every dependence between the two parts runs from an affine to an opaque
+/// statement: `llvm::DependenceInfo` direction vectors must show this for
+/// loads and stores, while calls must neither modify nor read what the affine
+/// part accesses or modifies, anywhere, and must return without unwinding.
+class Distribution {
+  llvm::LoopInfo *li_;
+  llvm::DominatorTree *dt_;
+  llvm::ScalarEvolution *se_;
+  llvm::AAResults *aa_;
+  llvm::DependenceInfo *di_;
+
+  using InstSet = llvm::SmallPtrSet<llvm::Instruction *, 32>;
+
+  static auto isOpaque(const llvm::Instruction &J) -> bool {
+    return J.mayReadOrWriteMemory() && !llvm::isa<llvm::LoadInst>(J) &&
+           !llvm::isa<llvm::StoreInst>(J);
+  }
+  static auto isMemory(const llvm::Instruction *J) -> bool {
+    return J->mayReadOrWriteMemory();
+  }
+  /// Adds to `keep` everything within `L` that the instructions in `work`
+  /// use, transitively.
+  static void useClosure(llvm::Loop *L,
+                         llvm::SmallVectorImpl<llvm::Instruction *> &work,
+                         InstSet &keep) {
+    while (!work.empty()) {
+      llvm::Instruction *J = work.pop_back_val();
+      for (llvm::Value *op : J->operand_values())
+        if (auto *I = llvm::dyn_cast<llvm::Instruction>(op))
+          if (L->contains(I) && keep.insert(I).second) work.push_back(I);
+    }
+  }
+  /// Whether the dependencies between the affine access `a` and the opaque
+  /// access `o`, if any, all run from `a` to `o`, so that `o` may be delayed
+  /// until the loop `L` has finished executing `a`.
+  auto ordered(llvm::Loop *L, llvm::Instruction *a, llvm::Instruction *o)
+    -> bool {
+    if (!a->mayWriteToMemory() && !o->mayWriteToMemory()) return true;
+    if (auto *call = llvm::dyn_cast<llvm::CallBase>(o)) {
+      llvm::ModRefInfo mr =
+        aa_->getModRefInfo(call, llvm::MemoryLocation::getBeforeOrAfter(
+                                   llvm::getLoadStorePointerOperand(a)));
+      return a->mayWriteToMemory() ? llvm::isNoModRef(mr)
+                                   : !llvm::isModSet(mr);
+    }
+    bool a_first = dt_->dominates(a, o);
+    std::unique_ptr<llvm::Dependence> dep = di_->depends(a, o, a_first);
+    if (!dep) return true;
+    if (dep->isConfused()) return false;
+    unsigned levels = dep->getLevels();
+    // levels outside `L` are not reordered
+    for (unsigned l = 1; l < unsigned(L->getLoopDepth()); ++l) {
+      if (l > levels) return false;
+      if (!(dep->getDirection(l) & llvm::Dependence::DVEntry::EQ)) return true;
+    }
+    // within `L`, the direction vector must be lexicographically positive
+    for (unsigned l = L->getLoopDepth(); l <= levels; ++l) {
+      unsigned dir = dep->getDirection(l);
+      if (dir & llvm::Dependence::DVEntry::GT) return false;
+      if (!(dir & llvm::Dependence::DVEntry::EQ)) return true;
+    }
+    return a_first;
+  }
+  /// Gives the copy of `L` a loop ID of its own, if `L` has one.
+  static void copyLoopID(llvm::Loop *L, llvm::Loop *copy) {
+    llvm::MDNode *id = L->getLoopID();
+    if (!id) return;
+    llvm::SmallVector<llvm::Metadata *, 4> ops{nullptr};
+    for (unsigned i = 1, n = id->getNumOperands(); i < n; ++i)
+      ops.push_back(id->getOperand(i));
+    llvm::MDNode *cid = llvm::MDNode::getDistinct(id->getContext(), ops);
+    cid->replaceOperandWith(0, cid);
+    copy->setLoopID(cid);
+  }
+  static void eraseUnused(llvm::ArrayRef<llvm::Instruction *> unused) {
+    for (llvm::Instruction *J : llvm::reverse(unused)) {
+      if (!J->use_empty())
+        J->replaceAllUsesWith(llvm::PoisonValue::get(J->getType()));
+      J->eraseFromParent();
+    }
+  }
+
+public:
+  Distribution(llvm::LoopInfo *li, llvm::DominatorTree *dt,
+               llvm::ScalarEvolution *se, llvm::AAResults *aa,
+               llvm::DependenceInfo *di)
+    : li_{li}, dt_{dt}, se_{se}, aa_{aa}, di_{di} {}
+
+  /// Splits `L` as described above; returns the new loop holding the affine
+  /// statements, or `nullptr` if `L` was left unchanged.
+  auto distribute(llvm::Loop *L) -> llvm::Loop * {
+    // the copy's only exiting block dominates the original's preheader
+    llvm::BasicBlock *PH = L->getLoopPreheader(), *exit = L->getExitBlock();
+    if (!PH || !exit || !L->getExitingBlock() || !L->isLoopSimplifyForm() ||
+        !L->isRecursivelyLCSSAForm(*dt_, *li_))
+      return nullptr;
+    // opaque statements: opaque instructions, and their users within `L`
+    llvm::SmallVector<llvm::Instruction *> work;
+    InstSet opaque;
+    for (llvm::BasicBlock *BB : L->getBlocks())
+      for (llvm::Instruction &J : *BB)
+        if (isOpaque(J)) {
+          auto *call = llvm::dyn_cast<llvm::CallBase>(&J);
+          if (!call || !call->willReturn() || !call->doesNotThrow())
+            return nullptr;
+          opaque.insert(&J);
+          work.push_back(&J);
+        }
+    if (opaque.empty()) return nullptr;
+    while (!work.empty())
+      for (llvm::User *U : work.pop_back_val()->users())
+        if (auto *I = llvm::dyn_cast<llvm::Instruction>(U))
+          if (L->contains(I) && opaque.insert(I).second) work.push_back(I);
+    // what each copy keeps: control flow, its statements, and their operands;
+    // values used after `L` are computed by the opaque copy, which stays last
+    InstSet affine_keep, opaque_keep;
+    bool any_store = false;
+    for (llvm::BasicBlock *BB : L->getBlocks()) {
+      affine_keep.insert(BB->getTerminator());
+      opaque_keep.insert(BB->getTerminator());
+      for (llvm::Instruction &J : *BB) {
+        if (opaque.contains(&J)) opaque_keep.insert(&J);
+        else if (isMemory(&J)) {
+          affine_keep.insert(&J);
+          any_store |= llvm::isa<llvm::StoreInst>(J);
+        }
+        if (llvm::any_of(J.users(), [&](llvm::User *U) {
+              auto *I = llvm::dyn_cast<llvm::Instruction>(U);
+              return I && !L->contains(I);
+            }))
+          opaque_keep.insert(&J);
+      }
+    }
+    if (!any_store) return nullptr;
+    work.assign(affine_keep.begin(), affine_keep.end());
+    useClosure(L, work, affine_keep);
+    work.assign(opaque_keep.begin(), opaque_keep.end());
+    useClosure(L, work, opaque_keep);
+    // the affine statements may not depend on opaque ones
+    for (llvm::Instruction *J : opaque)
+      if (affine_keep.contains(J)) return nullptr;
+    for (llvm::Instruction *o : opaque_keep) {
+      if (!isMemory(o)) continue;
+      for (llvm::Instruction *a : affine_keep)
+        if (a != o && isMemory(a) && !ordered(L, a, o)) return nullptr;
+    }
+    // legal; clone `L` in front of itself, mirroring LLVM's LoopDistribute
+    se_->forgetLoop(L);
+    llvm::BasicBlock *pred = PH;
+    PH = llvm::SplitBlock(PH, PH->getTerminator(), dt_, li_);
+    llvm::ValueToValueMapTy vmap;
+    llvm::SmallVector<llvm::BasicBlock *, 8> blocks;
+    llvm::Loop *copy = llvm::cloneLoopWithPreheader(
+      PH, pred, L, vmap, ".affine", li_, dt_, blocks);
+    vmap[exit] = PH;
+    llvm::remapInstructionsInBlocks(blocks, vmap);
+    pred->getTerminator()->replaceUsesOfWith(PH, copy->getLoopPreheader());
+    dt_->changeImmediateDominator(PH, copy->getExitingBlock());
+    copyLoopID(L, copy);
+    llvm::SmallVector<llvm::Instruction *> affine_unused, opaque_unused;
+    for (llvm::BasicBlock *BB : L->getBlocks()) {
+      for (llvm::Instruction &J : *BB) {
+        if (!affine_keep.contains(&J))
+          affine_unused.push_back(llvm::cast<llvm::Instruction>(vmap[&J]));
+        if (!opaque_keep.contains(&J)) opaque_unused.push_back(&J);
+      }
+    }
+    eraseUnused(affine_unused);
+    eraseUnused(opaque_unused);
+    return copy;
+  }
+  /// Distributes the outermost loop around each opaque instruction that we
+  /// may legally split, trying inner loops when outer ones fail. Returns the
+  /// loops holding the opaque statements of each nest split.
+  auto run() -> llvm::SmallVector<llvm::Loop *> {
+    llvm::SmallVector<llvm::Loop *> split;
+    llvm::SmallPtrSet<llvm::Loop *, 8> tried;
+    // `distribute` adds loops, so we collect candidates first
+    llvm::SmallVector<llvm::Loop *> innermost;
+    for (llvm::Loop *L : li_->getLoopsInPreorder())
+      if (L->isInnermost() &&
+          llvm::any_of(L->blocks(), [](llvm::BasicBlock *BB) {
+            return llvm::any_of(*BB, isOpaque);
+          }))
+        innermost.push_back(L);
+    for (llvm::Loop *L : innermost) {
+      llvm::SmallVector<llvm::Loop *, 4> chain;
+      for (llvm::Loop *P = L; P; P = P->getParentLoop()) chain.push_back(P);
+      for (llvm::Loop *P : llvm::reverse(chain)) {
+        if (!tried.insert(P).second) continue;
+        if (distribute(P)) {
+          split.push_back(P);
+          break;
+        }
+      }
+    }
+    return split;
+  }
+};
+
+} // namespace codegen
@@ -0,0 +1,504 @@
+#ifdef USE_MODULE
+module;
+#else
+#pragma once
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/IVDescriptors.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/CodeExtractor.h>
+#include <llvm/Transforms/Utils/LoopUtils.h>
+#include <optional>
+
+#ifndef USE_MODULE
+#include "Backends/CodeGeneration.cxx"
+#include "IR/IR.cxx"
+#include "Optimize/Legality.cxx"
+#include "Utilities/Invariant.cxx"
+#else
+export module Parallelization;
+import CodeGen;
+import Invariant;
+import IR;
+import Legality;
+#endif
+
+#ifdef USE_MODULE
+export namespace codegen {
+#else
+namespace codegen {
+#endif
+
+/// An outermost loop of a nest to run on the `TurboLoopRuntime` thread pool.
+struct ParallelPlan {
+  llvm::Loop *loop_;
+  /// Iterations of the original loop per chunk; `0` leaves the choice to the
+  /// runtime.
+  int64_t chunk_;
+  /// `Legality::parallel_reductions_`: the loop's reductions may be
+  /// privatized per thread.
+  bool reductions_;
+  /// The factor `Lowering` unrolled the loop by, so that each of its
+  /// iterations runs `unroll_` of the original loop.
+  int64_t unroll_{1};
+};
+
+/// Estimated cost, in the units of `LoopTreeCostFn`, below which a nest does
+/// not pay for waking the thread pool.
+inline constexpr double parallel_min_cost = 1e5;
+/// Estimated cost a chunk should at least amount to, so that claiming it is
+/// cheap in comparison.
+inline constexpr double parallel_chunk_cost = 1e4;
+
+/// Appends a `ParallelPlan` for each outermost loop of `root` that carries no
+/// dependence, other than through reductions we may privatize.
+/// `cost` is the nest's estimated cost from the transform search, and the
+/// chunk size spreads it evenly over the trip count of the loop, so that a
+/// chunk costs at least `parallel_chunk_cost`. An unknown, i.e. NaN, `cost`
+/// is treated as too small to parallelize.
+inline void planParallel(IR::Loop *root, double cost,
+                         llvm::SmallVectorImpl<ParallelPlan> &plans) {
+  if (!(cost >= parallel_min_cost)) return;
+  for (IR::Loop *O : root->subLoops()) {
+    CostModeling::Legality legal = O->getLegality();
+    if (!legal.parallel_ && !legal.parallel_reductions_) continue;
+    llvm::Loop *LL = originalLoop(O);
+    if (!LL) continue;
+    double trip = poly::Loop::dyn_loop_est;
+    poly::Loop *AL = O->getAffineLoop();
+    if (ptrdiff_t depth1 = O->getCurrentDepth();
+        AL && depth1 <= AL->getNumLoops())
+      trip = AL->tripCount(depth1).second;
+    double iters = parallel_chunk_cost * std::max(trip, 1.0) / cost;
+    int64_t chunk = std::max<int64_t>(1, int64_t(std::ceil(iters)));
+    plans.push_back({.loop_ = LL,
+                     .chunk_ = chunk,
+                     .reductions_ = bool(legal.parallel_reductions_)});
+  }
+}
+
+/// Outlines parallel loops into worker functions that
+/// `turboloop_parallel_for` runs over chunks of the iteration space.
+///
+/// The runtime counts logical iterations `[0, n)`, i.e. iterations of the
+/// loop as lowered, each running `ParallelPlan::unroll_` original iterations,
+/// so the chunk size is scaled down accordingly. Each chunk `[lo, hi)`
+/// starts every integer induction of the loop at `start + lo * step`, and the
+/// induction controlling the exit stops at `start + hi * step`, or at the
+/// original bound for the last chunk. Reductions start each chunk from the
+/// thread's private copy, and store back into it on exit; the runtime folds
+/// the copies, which we then fold into the reduction's initial value. Values
+/// used after the loop must be inductions or reductions, which we recompute.
+///
+/// The loop, plus a block before and after it, is extracted with
+/// `llvm::CodeExtractor`, and called from a `<fn>.body` wrapper matching
+/// `turboloop_body_t`, which reads the remaining live-ins from a struct the
+/// parent fills in. As the loop moves to another function, this is the last
+/// transform we apply; `LoopInfo` and `ScalarEvolution` are left stale.
+class Parallelization {
+  llvm::LoopInfo *li_;
+  llvm::DominatorTree *dt_;
+  llvm::ScalarEvolution *se_;
+  llvm::AssumptionCache *ac_;
+
+  struct Induction {
+    llvm::PHINode *phi_;
+    llvm::Value *start_;
+    int64_t step_;
+  };
+  struct Reduction {
+    llvm::PHINode *phi_;
+    llvm::RecurrenceDescriptor rd_;
+    llvm::Value *init_;
+  };
+  // the value of induction `index_` after `n - !next_` iterations, or of
+  // reduction `index_` once the loop is done
+  struct LiveOut {
+    llvm::PHINode *phi_;
+    ptrdiff_t index_;
+    bool reduction_;
+    bool next_;
+  };
+
+public:
+  struct Candidate {
+    ParallelPlan plan_;
+    llvm::SmallVector<Induction, 2> inductions_{};
+    llvm::SmallVector<Reduction, 2> reductions_{};
+    llvm::SmallVector<LiveOut, 2> live_outs_{};
+    // the induction whose next value the exit compares against `final_`
+    ptrdiff_t control_{-1};
+    llvm::Value *final_{nullptr};
+    llvm::ICmpInst *cmp_{nullptr};
+    bool signed_{false};
+  };
+
+private:
+  static auto privatizable(const llvm::RecurrenceDescriptor &rd) -> bool {
+    // a reduction stored to an invariant address every iteration is not
+    // private to the loop
+    if (rd.isOrdered() || rd.IntermediateStore) return false;
+    switch (rd.getRecurrenceKind()) {
+    case llvm::RecurKind::Add:
+    case llvm::RecurKind::Mul:
+    case llvm::RecurKind::Or:
+    case llvm::RecurKind::And:
+    case llvm::RecurKind::Xor:
+    case llvm::RecurKind::SMin:
+    case llvm::RecurKind::SMax:
+    case llvm::RecurKind::UMin:
+    case llvm::RecurKind::UMax:
+    case llvm::RecurKind::FAdd:
+    case llvm::RecurKind::FMul:
+    case llvm::RecurKind::FMin:
+    case llvm::RecurKind::FMax: return true;
+    default: return false;
+    }
+  }
+  static auto reduce(llvm::IRBuilderBase &B,
+                     const llvm::RecurrenceDescriptor &rd, llvm::Value *a,
+                     llvm::Value *b) -> llvm::Value * {
+    llvm::RecurKind kind = rd.getRecurrenceKind();
+    if (llvm::RecurrenceDescriptor::isMinMaxRecurrenceKind(kind))
+      return llvm::createMinMaxOp(B, kind, a, b);
+    llvm::Value *r = B.CreateBinOp(
+      llvm::Instruction::BinaryOps(llvm::RecurrenceDescriptor::getOpcode(kind)),
+      a, b);
+    if (auto *I = llvm::dyn_cast<llvm::Instruction>(r);
+        I && llvm::isa<llvm::FPMathOperator>(I))
+      I->setFastMathFlags(rd.getFastMathFlags());
+    return r;
+  }
+  /// Min and max are idempotent, so their initial value serves as identity.
+  static auto identity(const Reduction &r) -> llvm::Value * {
+    llvm::RecurKind kind = r.rd_.getRecurrenceKind();
+    if (llvm::RecurrenceDescriptor::isMinMaxRecurrenceKind(kind))
+      return r.init_;
+    return r.rd_.getRecurrenceIdentity(kind, r.phi_->getType(),
+                                       r.rd_.getFastMathFlags());
+  }
+  static auto placeholder(llvm::Value *V, const char *name,
+                          llvm::Instruction *before) -> llvm::Instruction * {
+    return new llvm::FreezeInst(V, name, before);
+  }
+  /// Copies target features and the like; attributes describing `F`'s
+  /// behavior, e.g. its memory effects, do not carry over.
+  static void copyTargetAttrs(const llvm::Function &F, llvm::Function *fn) {
+    for (llvm::Attribute a : F.getAttributes().getFnAttrs())
+      if (a.isStringAttribute()) fn->addFnAttr(a);
+  }
+  /// Builds `void combine(ptr acc, ptr partial)` for the runtime.
+  static auto buildCombine(llvm::Function &F, llvm::StringRef name,
+                           llvm::StructType *red_ty,
+                           llvm::ArrayRef<Reduction> reductions)
+    -> llvm::Function * {
+    llvm::LLVMContext &ctx = F.getContext();
+    llvm::Type *ptr = llvm::PointerType::getUnqual(ctx);
+    llvm::Function *fn = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), {ptr, ptr}, false),
+      llvm::GlobalValue::InternalLinkage, name, F.getParent());
+    copyTargetAttrs(F, fn);
+    llvm::IRBuilder<> B(llvm::BasicBlock::Create(ctx, "entry", fn));
+    for (auto [k, r] : llvm::enumerate(reductions)) {
+      llvm::Type *T = r.phi_->getType();
+      llvm::Value *acc = B.CreateStructGEP(red_ty, fn->getArg(0), k),
+                  *part = B.CreateStructGEP(red_ty, fn->getArg(1), k);
+      B.CreateStore(
+        reduce(B, r.rd_, B.CreateLoad(T, acc), B.CreateLoad(T, part)), acc);
+    }
+    B.CreateRetVoid();
+    return fn;
+  }
+
+public:
+  Parallelization(llvm::LoopInfo *li, llvm::DominatorTree *dt,
+                  llvm::ScalarEvolution *se, llvm::AssumptionCache *ac)
+    : li_{li}, dt_{dt}, se_{se}, ac_{ac} {}
+
+  /// Checks that `p.loop_` is in a form we can outline: a rotated loop in
+  /// LCSSA form exiting from its latch, whose header phis are all integer
+  /// inductions with constant steps, or privatizable reductions, and whose
+  /// exit compares the next value of an increasing induction against a loop
+  /// invariant bound.
+  auto analyze(ParallelPlan p) -> std::optional<Candidate> {
+    llvm::Loop *L = p.loop_;
+    llvm::BasicBlock *PH = L->getLoopPreheader(), *latch = L->getLoopLatch(),
+                     *exit = L->getExitBlock();
+    if (!PH || !latch || !exit || L->getExitingBlock() != latch ||
+        !L->isLoopSimplifyForm() || !L->isRecursivelyLCSSAForm(*dt_, *li_))
+      return std::nullopt;
+    auto *br = llvm::dyn_cast<llvm::BranchInst>(latch->getTerminator());
+    if (!br || !br->isConditional()) return std::nullopt;
+    auto *cmp = llvm::dyn_cast<llvm::ICmpInst>(br->getCondition());
+    if (!cmp || !cmp->hasOneUse() || !L->contains(cmp)) return std::nullopt;
+    Candidate c{.plan_ = p, .cmp_ = cmp};
+    for (llvm::PHINode &phi : L->getHeader()->phis()) {
+      llvm::InductionDescriptor id;
+      if (llvm::InductionDescriptor::isInductionPHI(&phi, L, se_, id)) {
+        llvm::ConstantInt *step = id.getConstIntStepValue();
+        if (id.getKind() != llvm::InductionDescriptor::IK_IntInduction || !step)
+          return std::nullopt;
+        c.inductions_.push_back(
+          {&phi, id.getStartValue(), step->getSExtValue()});
+        continue;
+      }
+      llvm::RecurrenceDescriptor rd;
+      if (!p.reductions_ ||
+          !llvm::RecurrenceDescriptor::isReductionPHI(&phi, L, rd, nullptr, ac_,
+                                                      dt_, se_) ||
+          !privatizable(rd))
+        return std::nullopt;
+      c.reductions_.push_back({&phi, rd, phi.getIncomingValueForBlock(PH)});
+    }
+    llvm::CmpInst::Predicate pred{};
+    for (auto [k, ind] : llvm::enumerate(c.inductions_)) {
+      llvm::Value *next = ind.phi_->getIncomingValueForBlock(latch);
+      for (unsigned i = 0; i < 2; ++i) {
+        llvm::Value *bound = cmp->getOperand(1 - i);
+        if (cmp->getOperand(i) != next || !L->isLoopInvariant(bound)) continue;
+        c.control_ = ptrdiff_t(k);
+        c.final_ = bound;
+        pred = i ? cmp->getSwappedPredicate() : cmp->getPredicate();
+      }
+    }
+    if (c.control_ < 0 || c.inductions_[c.control_].step_ <= 0)
+      return std::nullopt;
+    // the predicate under which the loop continues
+    if (br->getSuccessor(0) != L->getHeader())
+      pred = llvm::CmpInst::getInversePredicate(pred);
+    if (pred == llvm::CmpInst::ICMP_NE) {
+      auto *next = llvm::dyn_cast<llvm::OverflowingBinaryOperator>(
+        c.inductions_[c.control_].phi_->getIncomingValueForBlock(latch));
+      c.signed_ = next && next->hasNoSignedWrap();
+    } else if (pred == llvm::CmpInst::ICMP_SLT) c.signed_ = true;
+    else if (pred != llvm::CmpInst::ICMP_ULT) return std::nullopt;
+    // dedicated exit, so each phi has the latch as its only predecessor
+    for (llvm::PHINode &P : exit->phis()) {
+      llvm::Value *v = P.getIncomingValue(0);
+      LiveOut out{
+        .phi_ = &P, .index_ = -1, .reduction_ = false, .next_ = false};
+      for (auto [k, ind] : llvm::enumerate(c.inductions_)) {
+        if (v == ind.phi_) out.index_ = ptrdiff_t(k);
+        else if (v == ind.phi_->getIncomingValueForBlock(latch))
+          out = {.phi_ = &P, .index_ = ptrdiff_t(k), .next_ = true};
+      }
+      for (auto [k, r] : llvm::enumerate(c.reductions_))
+        if (v == r.phi_->getIncomingValueForBlock(latch))
+          out = {.phi_ = &P, .index_ = ptrdiff_t(k), .reduction_ = true};
+      if (out.index_ < 0) return std::nullopt;
+      c.live_outs_.push_back(out);
+    }
+    if (!llvm::CodeExtractor{L->getBlocks(), dt_}.isEligible())
+      return std::nullopt;
+    return c;
+  }
+
+  /// Outlines the loop of `c` as described above, replacing it with a call to
+  /// `turboloop_parallel_for`.
+  void outline(const Candidate &c) {
+    llvm::Loop *L = c.plan_.loop_;
+    llvm::BasicBlock *PH = L->getLoopPreheader(), *latch = L->getLoopLatch(),
+                     *exit = L->getExitBlock();
+    llvm::Function &F = *PH->getParent();
+    llvm::LLVMContext &ctx = F.getContext();
+    llvm::Type *i64 = llvm::Type::getInt64Ty(ctx),
+               *ptr = llvm::PointerType::getUnqual(ctx);
+    se_->forgetLoop(L);
+    // Placeholders for the per-chunk values, which the extraction turns into
+    // arguments of the outlined function.
+    llvm::Instruction *term = PH->getTerminator();
+    llvm::SmallVector<llvm::Instruction *, 2> starts;
+    for (const Induction &ind : c.inductions_)
+      starts.push_back(placeholder(ind.start_, "tl.start", term));
+    llvm::Instruction *hi = placeholder(c.final_, "tl.end", term);
+    llvm::Instruction *priv =
+      c.reductions_.empty()
+        ? nullptr
+        : placeholder(llvm::PoisonValue::get(ptr), "tl.priv", term);
+    llvm::BasicBlock *entry =
+      llvm::SplitBlock(PH, term, dt_, li_, nullptr, "tl.chunk");
+    for (auto [ind, start] : llvm::zip(c.inductions_, starts))
+      ind.phi_->setIncomingValueForBlock(entry, start);
+    c.cmp_->replaceUsesOfWith(c.final_, hi);
+    llvm::SmallVector<llvm::Type *, 2> red_types;
+    for (const Reduction &r : c.reductions_)
+      red_types.push_back(r.phi_->getType());
+    llvm::StructType *red_ty = llvm::StructType::get(ctx, red_types);
+    llvm::IRBuilder<> B(entry->getTerminator());
+    for (auto [k, r] : llvm::enumerate(c.reductions_))
+      r.phi_->setIncomingValueForBlock(
+        entry, B.CreateLoad(r.phi_->getType(),
+                            B.CreateStructGEP(red_ty, priv, k)));
+    // values used after the loop are recomputed once it is done
+    llvm::SmallVector<llvm::Instruction *, 2> outs;
+    for (const LiveOut &out : c.live_outs_) {
+      outs.push_back(
+        placeholder(llvm::PoisonValue::get(out.phi_->getType()), "tl.out",
+                    &*exit->getFirstInsertionPt()));
+      out.phi_->replaceAllUsesWith(outs.back());
+      out.phi_->eraseFromParent();
+    }
+    llvm::BasicBlock *after = llvm::SplitBlock(exit, &exit->front(), dt_, li_);
+    B.SetInsertPoint(exit->getTerminator());
+    for (auto [k, r] : llvm::enumerate(c.reductions_))
+      B.CreateStore(r.phi_->getIncomingValueForBlock(latch),
+                    B.CreateStructGEP(red_ty, priv, k));
+    llvm::SmallVector<llvm::BasicBlock *, 16> blocks{entry};
+    blocks.append(L->block_begin(), L->block_end());
+    blocks.push_back(exit);
+    llvm::CodeExtractor extractor{blocks, dt_, false, nullptr, nullptr, ac_};
+    llvm::CodeExtractorAnalysisCache ceac{F};
+    llvm::CodeExtractor::ValueSet inputs, outputs, sinks;
+    extractor.findInputsOutputs(inputs, outputs, sinks);
+    // all uses after the loop went through LCSSA phis, which we replaced
+    utils::invariant(outputs.empty());
+    llvm::Function *fn = extractor.extractCodeRegion(ceac, inputs, outputs);
+    utils::invariant(fn != nullptr);
+    auto *call = llvm::cast<llvm::CallInst>(fn->user_back());
+    utils::invariant(call->getParent()->getSingleSuccessor() == after);
+
+    // `<fn>.body(i64 lo, i64 hi, ptr ctx, ptr priv)` reads `n`, the final
+    // value, the induction starts, and then the other live-ins from `ctx`
+    llvm::SmallVector<llvm::Type *, 8> ctx_types(2 + c.inductions_.size(), i64);
+    llvm::SmallVector<llvm::Value *, 8> captured;
+    for (llvm::Value *in : inputs) {
+      if (in == hi || in == priv || llvm::is_contained(starts, in)) continue;
+      captured.push_back(in);
+      ctx_types.push_back(in->getType());
+    }
+    llvm::StructType *ctx_ty = llvm::StructType::get(ctx, ctx_types);
+    llvm::Function *body = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), {i64, i64, ptr, ptr},
+                              false),
+      llvm::GlobalValue::InternalLinkage, fn->getName() + ".body",
+      F.getParent());
+    copyTargetAttrs(F, body);
+    {
+      llvm::IRBuilder<> W(llvm::BasicBlock::Create(ctx, "entry", body));
+      llvm::Value *lo = body->getArg(0), *chunk_end = body->getArg(1),
+                  *ctx_arg = body->getArg(2);
+      auto field = [&](unsigned i) -> llvm::Value * {
+        return W.CreateLoad(ctx_ty->getElementType(i),
+                            W.CreateStructGEP(ctx_ty, ctx_arg, i));
+      };
+      llvm::Value *n = field(0), *fin = field(1);
+      llvm::DenseMap<llvm::Value *, llvm::Value *> args;
+      for (auto [k, ind] : llvm::enumerate(c.inductions_)) {
+        llvm::Value *start = field(2 + k), *step = W.getInt64(ind.step_);
+        args[starts[k]] = W.CreateTrunc(
+          W.CreateAdd(start, W.CreateMul(lo, step)), ind.phi_->getType());
+        if (ptrdiff_t(k) != c.control_) continue;
+        llvm::Value *stop =
+          W.CreateSelect(W.CreateICmpEQ(chunk_end, n), fin,
+                         W.CreateAdd(start, W.CreateMul(chunk_end, step)));
+        args[hi] = W.CreateTrunc(stop, c.final_->getType());
+      }
+      if (priv) args[priv] = body->getArg(3);
+      for (auto [j, in] : llvm::enumerate(captured))
+        args[in] = field(2 + c.inductions_.size() + j);
+      llvm::SmallVector<llvm::Value *, 8> call_args;
+      for (llvm::Value *in : inputs) call_args.push_back(args[in]);
+      W.CreateCall(fn, call_args);
+      W.CreateRetVoid();
+    }
+
+    // the parent fills in the context and the reduction identities, and
+    // recomputes the live-outs once the runtime returns
+    B.SetInsertPoint(call);
+    B.SetCurrentDebugLocation(call->getDebugLoc());
+    auto ext = [&](llvm::Value *v) -> llvm::Value * {
+      return c.signed_ ? B.CreateSExtOrTrunc(v, i64)
+                       : B.CreateZExtOrTrunc(v, i64);
+    };
+    // a rotated loop runs at least once; `start >= final` is compared in
+    // the loop's signedness, as their difference may not fit in `i64`
+    const Induction &control = c.inductions_[c.control_];
+    llvm::Value *final64 = ext(c.final_), *start64 = ext(control.start_),
+                *dist = B.CreateSub(final64, start64),
+                *n = B.CreateSelect(
+                  c.signed_ ? B.CreateICmpSLE(final64, start64)
+                            : B.CreateICmpULE(final64, start64),
+                  B.getInt64(1),
+                  B.CreateUDiv(
+                    B.CreateAdd(dist, B.getInt64(control.step_ - 1)),
+                    B.getInt64(control.step_)));
+    llvm::IRBuilder<> A(&*F.getEntryBlock().getFirstInsertionPt());
+    llvm::Value *ctx_ptr = A.CreateAlloca(ctx_ty, nullptr, "tl.ctx");
+    llvm::SmallVector<llvm::Value *, 8> fields{n, final64};
+    for (const Induction &ind : c.inductions_)
+      fields.push_back(ext(ind.start_));
+    fields.append(captured.begin(), captured.end());
+    for (auto [i, v] : llvm::enumerate(fields))
+      B.CreateStore(v, B.CreateStructGEP(ctx_ty, ctx_ptr, i));
+    llvm::Value *red = llvm::ConstantPointerNull::get(
+      llvm::PointerType::getUnqual(ctx));
+    llvm::Value *combine = red, *size = B.getIntN(
+      F.getParent()->getDataLayout().getPointerSizeInBits(), 0);
+    if (priv) {
+      red = A.CreateAlloca(red_ty, nullptr, "tl.red");
+      for (auto [k, r] : llvm::enumerate(c.reductions_))
+        B.CreateStore(identity(r), B.CreateStructGEP(red_ty, red, k));
+      combine = buildCombine(F, (fn->getName() + ".combine").str(), red_ty,
+                             c.reductions_);
+      size = llvm::ConstantInt::get(
+        size->getType(),
+        F.getParent()->getDataLayout().getTypeAllocSize(red_ty));
+    }
+    llvm::FunctionCallee rt = F.getParent()->getOrInsertFunction(
+      "turboloop_parallel_for",
+      llvm::FunctionType::get(
+        llvm::Type::getVoidTy(ctx),
+        {i64, i64, i64, ptr, ptr, ptr, size->getType(), ptr}, false));
+    int64_t chunk =
+      (c.plan_.chunk_ + c.plan_.unroll_ - 1) / c.plan_.unroll_; // logical
+    B.CreateCall(rt, {B.getInt64(0), n, B.getInt64(chunk), body, ctx_ptr, red,
+                      size, combine});
+    for (auto [out, value] : llvm::zip(c.live_outs_, outs)) {
+      llvm::Value *v;
+      if (out.reduction_) {
+        const Reduction &r = c.reductions_[out.index_];
+        v = reduce(B, r.rd_, r.init_,
+                   B.CreateLoad(r.phi_->getType(),
+                                B.CreateStructGEP(red_ty, red, out.index_)));
+      } else {
+        const Induction &ind = c.inductions_[out.index_];
+        llvm::Value *iters = out.next_ ? n : B.CreateSub(n, B.getInt64(1));
+        v = B.CreateTrunc(
+          B.CreateAdd(ext(ind.start_),
+                      B.CreateMul(iters, B.getInt64(ind.step_))),
+          value->getType());
+      }
+      value->replaceAllUsesWith(v);
+      value->eraseFromParent();
+    }
+    call->eraseFromParent();
+    for (llvm::Instruction *J : starts) J->eraseFromParent();
+    hi->eraseFromParent();
+    if (priv) priv->eraseFromParent();
+  }
+};
+
+} // namespace codegen
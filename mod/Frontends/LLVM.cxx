@@ -9,10 +9,13 @@ module;
 #include <cstddef>
 #include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/ADT/SmallString.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/AliasAnalysis.h>
 #include <llvm/Analysis/AssumptionCache.h>
 #include <llvm/Analysis/Delinearization.h>
+#include <llvm/Analysis/DependenceAnalysis.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/OptimizationRemarkEmitter.h>
 #include <llvm/Analysis/ScalarEvolution.h>
@@ -39,14 +42,20 @@ module;
 #include <llvm/Support/Debug.h>
 #include <llvm/Support/FormatVariadic.h>
 #include <llvm/Support/KnownBits.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/LoopUtils.h>
 #include <llvm/Transforms/Utils/ScalarEvolutionExpander.h>
+#include <memory>
 #include <optional>
 #include <type_traits>
 #include <vector>
 
 #ifndef USE_MODULE
+#include "Backends/CodeGeneration.cxx"
+#include "Backends/Distribution.cxx"
+#include "Backends/Parallelization.cxx"
 #include "Utilities/Valid.cxx"
 #include "Target/Machine.cxx"
 #include "RemarkAnalysis.cxx"
@@ -55,21 +64,28 @@ module;
 #include "Utilities/Invariant.cxx"
 #include "Target/Host.cxx"
 #include "Optimize/CostModeling.cxx"
+#include "Optimize/TransformCache.cxx"
+#include "LinearProgramming/LPFormat.cxx"
 #include "IR/ControlFlowMerging.cxx"
 #include "Math/Comparisons.cxx"
 #include "Alloc/Arena.cxx"
 #else
 export module LLVMFrontend;
 import Arena;
+import CodeGen;
 import Comparisons;
+import Distribution;
 import ControlFlowMerging;
 import CostModeling;
 import Host;
 import Invariant;
 import IR;
+import LPFormat;
 import ManagedArray;
+import Parallelization;
 import Remark;
 import TargetMachine;
+import TransformCache;
 import Valid;
 #endif
 
@@ -91,6 +107,78 @@ concept LoadOrStoreInst =
   std::same_as<llvm::LoadInst, std::remove_cvref_t<T>> ||
   std::same_as<llvm::StoreInst, std::remove_cvref_t<T>>;
 
+/// Minimum duration, in microseconds, of the `llvm::TimeTraceScope`s recorded
+/// by profilers we start, i.e. for `turbo-loop<time-trace=...>` and on our
+/// worker threads. Per-phase totals include shorter scopes, too.
+inline constexpr unsigned time_trace_granularity = 500;
+
+/// Options for the `turbo-loop` pass, parsed from `turbo-loop<...>`.
+struct TurboLoopOptions {
+  /// Attach `llvm.loop` metadata so that LLVM's vectorizer and unrollers
+  /// apply our `LoopTransform`s, instead of rewriting the nests ourselves.
+  /// As with in-place lowering, this covers nests kept in their original
+  /// loop order; metadata cannot express interchange, skewing, or fusion.
+  bool metadata_only_{false};
+  /// Number of threads searching for the `LoopTransform`s of independent
+  /// loop nests within a function, and scheduling the independent components
+  /// of a nest; `0` uses all hardware threads. Threads left over when there
+  /// are fewer nests search the unrolls of a nest's outer-most loop.
+  unsigned threads_{1};
+  /// The pool of `threads_` threads, unset if `threads_ == 1`. The
+  /// components a nest's schedule splits into, the nests of a function, and
+  /// the candidates of a nest's outer-most loop are searched as tasks of it;
+  /// it outlives the functions optimized with it.
+  llvm::ThreadPool *schedule_pool_{nullptr};
+  /// If set, `LoopTransform`s are looked up here before searching, and new
+  /// results are added to it.
+  CostModeling::TransformCache *cache_{nullptr};
+  /// Compile-time budget, `0` meaning unlimited: dependence pairs checked per
+  /// function, scheduling LP work per nest (see `lp::ScheduleBudget`), and
+  /// cost evaluations per nest during the transform search.
+  /// Nests over the dependence or LP budget keep their original schedule,
+  /// and their unrolls are chosen greedily; over the dependence budget, no
+  /// loop is reordered either. Over the evaluation budget, unrolls are chosen
+  /// greedily.
+  ptrdiff_t max_dep_pairs_{0};
+  ptrdiff_t max_lp_work_{0};
+  ptrdiff_t max_cost_evals_{0};
+  /// Search each subtree of a nest once per distinct state of the loops
+  /// containing it that its costs read, rather than once per combination of
+  /// their unrolls; see `CostModeling::Hard::SubCostFn::Memo`.
+  bool search_memo_{false};
+  /// Also consider vectorizing two loops of a nest at once, the outer taking
+  /// part of the vector lanes and an inner loop the rest.
+  bool vectorize_2d_{false};
+  /// Schedule for locality, keeping loops that access the most bytes with
+  /// stride one innermost, instead of preferring the original loop order.
+  bool locality_objective_{false};
+  /// Schedule like Pluto: prefer outer parallel loops, and skew to form
+  /// tileable bands, which are annotated on the `IR::Loop`s' `Legality`.
+  bool tile_bands_{false};
+  /// Remark the rows and columns of each scheduling LP before and after
+  /// presolving.
+  bool presolve_report_{false};
+  /// Treat dependencies the fusion of an outer loop already orders as
+  /// satisfied there, leaving the inner levels free of them; see
+  /// `lp::Presolve`.
+  bool fused_edges_{false};
+  /// Re-fuse components split while scheduling only where the reuse gained
+  /// outweighs the L1 capacity and register pressure lost, instead of
+  /// whenever legal; see `lp::FusionModel::profitable`.
+  bool fusion_cost_{false};
+  /// Before parsing, split loop nests containing calls we cannot analyze, so
+  /// that their affine statements may still be optimized; see
+  /// `codegen::Distribution`.
+  bool distribute_{false};
+  /// Run the outermost loops of each nest that carry no dependence, other
+  /// than through reassociable reductions, on the `TurboLoopRuntime` thread
+  /// pool; see `codegen::Parallelization`.
+  bool parallel_{false};
+  /// If set, every scheduling LP and Farkas system built is written here, to
+  /// be replayed by the `LPReplayBenchmark`.
+  lp::LPDump *lp_dump_{nullptr};
+};
+
 class TurboLoop {
   const llvm::TargetLibraryInfo *tli_;
   const llvm::TargetTransformInfo *tti_;
@@ -99,13 +187,52 @@ class TurboLoop {
   llvm::OptimizationRemarkEmitter *ore_;
   llvm::AssumptionCache &assumption_cache_;
   llvm::DominatorTree &dom_tree_;
+  // only requested with `opts_.distribute_`
+  llvm::AAResults *aa_{nullptr};
+  // also requested for lowering, unless `opts_.metadata_only_`
+  llvm::DependenceInfo *di_{nullptr};
   alloc::OwningArena<> short_alloc_;
   IR::Dependencies deps_; // needs to be cleared before use w/ loop block
   IR::Cache instructions_;
   dict::set<llvm::BasicBlock *> loop_bbs_;
   dict::set<llvm::CallBase *> erase_candidates_;
+  // A loop nest whose `IR::Loop` tree has been built, but whose
+  // `LoopTransform`s have not been chosen yet. Building the cost function
+  // creates `llvm::Type`s and queries TTI, touching the shared `LLVMContext`,
+  // so `prepareSearch` does it serially; the search only reads the cost
+  // function and allocates from the nest's own arena, so pending nests are
+  // independent and can be searched concurrently.
+  struct PendingNest {
+    IR::Loop *root_;
+    llvm::Loop *loop_;
+    int loop_count_;
+    bool in_place_;
+    // a budget was already cut while scheduling
+    bool greedy_only_{false};
+    // `cost_fn_` allocates from `alloc_`, so it is declared (destroyed) after
+    std::unique_ptr<alloc::OwningArena<>> alloc_{};
+    std::unique_ptr<CostModeling::Hard::LoopTreeCostFn> cost_fn_{};
+    bool planned_{false};
+    bool cached_{false};
+    bool greedy_{false};
+    CostModeling::NestKey key_{};
+    llvm::SmallVector<codegen::LoopPlan, 0> plans_{};
+    llvm::SmallVector<codegen::ParallelPlan, 0> parallel_plans_{};
+    // search results to add to the cache
+    llvm::SmallVector<CostModeling::LoopTransform, 0> trfs_{};
+    // estimated cost of `trfs_`, from the search or the cache
+    double cost_{};
+  };
+  std::vector<PendingNest> pending_;
+  llvm::StringRef fn_name_;
+  // dependence pairs checked so far, for `opts_.max_dep_pairs_`
+  ptrdiff_t dep_pairs_{0};
+  // decisions to materialize once the loop forest has been fully parsed
+  llvm::SmallVector<codegen::LoopPlan> plans_;
+  llvm::SmallVector<codegen::ParallelPlan> parallel_plans_;
   // RegisterFile::CPURegisterFile registers_;
   target::MachineCore::Arch arch_;
+  TurboLoopOptions opts_;
   // this is an allocator that it is safe to reset completely when
   // a subtree fails, so it is not allowed to allocate anything
   // that we want to live longer than that.
@@ -126,6 +253,7 @@ class TurboLoop {
     -> IR::TreeResult {
     // NOTE: LoopInfo stores loops in reverse program order
     if (li_->empty()) return {};
+    llvm::TimeTraceScope timer("initializeLoopForest");
     auto rev_li = llvm::reverse(*li_);
     // should normally be stack allocated; we don't want to monomorphize
     // excessively, so we produce an `ArrayRef<llvm::Loop *>` here
@@ -158,6 +286,7 @@ class TurboLoop {
               dict::map<llvm::Value *, IR::Value *> *llvmToInternalMap,
               MutPtrVector<int> omega, poly::Loop *AL,
               IR::TreeResult tr) -> IR::TreeResult {
+    llvm::TimeTraceScope timer("parseBlocks");
     // TODO: need to be able to connect instructions as we move out
     std::optional<IR::Predicate::Map> pred_map_abridged = instructions_.descend(
       shortAllocator(), H, E, L, {llvmToInternalMap, li_, se_}, tr);
@@ -483,22 +612,213 @@ class TurboLoop {
   /// IP is end of the loop preheader, where we can
   /// insert hoisted expressions.
   /// TODO: do we need this?
+  /// The transform search is deferred to `optimizePending`.
   void optimize(IR::TreeResult tr,
                 dict::map<llvm::Value *, IR::Value *> *llvmToInternalMap) {
+    llvm::Loop *L = tr.getLoop()->getLLVMLoop();
+    llvm::TimeTraceScope timer("TurboLoop::optimize", L->getName());
     // now we build the LinearProgram
     deps_.clear();
     // first, we peel loops for which affine repr failed
     peelLoops(tr, llvmToInternalMap);
-    lp::LoopBlock loop_block{deps_, *shortAllocator()};
+    lp::ScheduleBudget budget{.lpWork = opts_.max_lp_work_};
+    // once exhausted, a negative budget allows checking no pairs at all
+    if (opts_.max_dep_pairs_)
+      budget.depPairs =
+        std::max<ptrdiff_t>(opts_.max_dep_pairs_ - dep_pairs_, -1);
+    lp::FusionModel fusion{};
+    if (opts_.fusion_cost_) {
+      target::Machine<true> target = getTarget();
+      fusion = {.l1Bytes = target.getL1DSize(),
+                .vectorRegisters = target.getNumberOfVectorRegisters()};
+    }
+    lp::LoopBlock loop_block{deps_,
+                             *shortAllocator(),
+                             budget,
+                             opts_.locality_objective_,
+                             opts_.tile_bands_,
+                             opts_.schedule_pool_,
+                             fusion,
+                             {.fusedEdges = opts_.fused_edges_}};
     lp::LoopBlock::OptimizationResult lpor =
       loop_block.optimize(instructions_, tr);
+    if (ore_ && opts_.presolve_report_)
+      for (lp::PresolveReport r : loop_block.getPresolveReports())
+        remark("Presolve", L,
+               llvm::formatv("scheduling LP presolved from {0}x{1} to {2}x{3}",
+                             r.rows, r.cols, r.presolvedRows, r.presolvedCols)
+                 .str());
+    lp::ScheduleBudget::Cut cut = loop_block.budgetCut();
+    if (cut != lp::ScheduleBudget::DepPairs)
+      dep_pairs_ += loop_block.numDepPairs();
     if (!lpor.nodes) return;
+    // Over budget, we keep the original schedule, and choose unrolls
+    // greedily; with unchecked dependencies, no loop may be reordered.
+    if (ore_ && lpor.original)
+      remark("BudgetExceeded", L,
+             cut == lp::ScheduleBudget::DepPairs
+               ? "too many dependence pairs to check; keeping the original "
+                 "schedule and loop order"
+               : "scheduling LP budget exceeded; keeping the original "
+                 "schedule, and choosing unroll factors greedily");
     for (IR::Addr *addr : lpor.addr.getAddr())
       if (llvm::BasicBlock *BB = addr->getBasicBlock()) loop_bbs_.insert(BB);
-    CostModeling::optimize(short_alloc_, loop_block.getDependencies(),
-                           instructions_, loop_bbs_, erase_candidates_, lpor,
-                           getTarget());
+    bool in_place = codegen::preservesOriginalOrder(lpor.nodes);
+    auto [root, loop_count] = CostModeling::buildLoopTree(
+      short_alloc_, loop_block.getDependencies(), instructions_, loop_bbs_,
+      erase_candidates_, lpor);
     loop_bbs_.clear();
+    if (ore_ && opts_.tile_bands_)
+      for (IR::Loop *O : root->subLoops()) remarkBand(O, L);
+    pending_.push_back({.root_ = root,
+                        .loop_ = L,
+                        .loop_count_ = loop_count,
+                        .in_place_ = in_place,
+                        .greedy_only_ = lpor.original});
+  }
+  /// Reports the depth of the tileable band starting at `O`, and whether `O`
+  /// is parallel.
+  void remarkBand(IR::Loop *O, llvm::Loop *L) const {
+    int depth = 1;
+    for (IR::Loop *SL = O->getSubLoop(); SL && SL->getLegality().tileable_;
+         SL = SL->getSubLoop())
+      ++depth;
+    llvm::SmallString<64> str =
+      llvm::formatv("tileable band of depth {0}, outermost loop {1}", depth,
+                    O->getLegality().parallel_ ? "parallel" : "sequential");
+    remark("Band", L, str);
+  }
+  /// The options that change the `LoopTransform`s found for a nest, through
+  /// its schedule or the search itself; they are part of its cache key.
+  [[nodiscard]] auto searchOptions() const -> uint64_t {
+    return uint64_t(opts_.search_memo_) | uint64_t(opts_.vectorize_2d_) << 1 |
+           uint64_t(opts_.locality_objective_) << 2 |
+           uint64_t(opts_.tile_bands_) << 3 | uint64_t(opts_.fusion_cost_) << 4;
+  }
+  /// Looks `nest` up in `opts_.cache_`, and on a miss builds its cost
+  /// function. Both touch state shared across nests (the cache, and the
+  /// `LLVMContext` through `llvm::Type`s and TTI), so calls must be serialized.
+  void prepareSearch(PendingNest &nest) {
+    if (opts_.cache_) {
+      nest.key_ =
+        CostModeling::NestHasher::key(nest.root_, arch_, searchOptions());
+      std::optional<CostModeling::CachedTransforms> cached =
+        opts_.cache_->lookup(nest.key_);
+      nest.cached_ = cached.has_value();
+      if (cached) {
+        nest.trfs_.assign(cached->trfs_.begin(), cached->trfs_.end());
+        nest.cost_ = cached->cost_;
+        return;
+      }
+    }
+    nest.alloc_ = std::make_unique<alloc::OwningArena<>>();
+    nest.cost_fn_ = std::make_unique<CostModeling::Hard::LoopTreeCostFn>(
+      nest.alloc_.get(), nest.root_, getTarget(), nest.loop_count_);
+  }
+  // Runs concurrently across nests; only touches `nest`, and reads the tree.
+  // The nest's outer-most loop is searched on `opts_.schedule_pool_`, if any.
+  void searchTransforms(PendingNest &nest) {
+    llvm::TimeTraceScope timer("searchTransforms", nest.loop_->getName());
+    math::PtrVector<CostModeling::LoopTransform> trfs{
+      nest.trfs_.data(), math::length(ptrdiff_t(nest.trfs_.size()))};
+    if (!nest.cached_) {
+      // a budget of one evaluation settles each loop on its first unroll
+      ptrdiff_t evals = nest.greedy_only_ ? 1 : opts_.max_cost_evals_;
+      auto [opt_cost, found, greedy] = CostModeling::optimizeTransforms(
+        *nest.cost_fn_, evals, opts_.search_memo_, opts_.schedule_pool_,
+        opts_.vectorize_2d_);
+      trfs = found;
+      nest.cost_ = opt_cost;
+      nest.greedy_ = greedy;
+      if (opts_.cache_) nest.trfs_.assign(trfs.begin(), trfs.end());
+    }
+    nest.planned_ =
+      nest.in_place_ && codegen::planLowering(nest.root_, trfs, nest.plans_);
+    if (opts_.parallel_ && nest.planned_)
+      codegen::planParallel(nest.root_, nest.cost_, nest.parallel_plans_);
+  }
+  /// Chooses the `LoopTransform`s of all pending nests, and collects their
+  /// plans in the order the nests were built, independent of scheduling.
+  void optimizePending() {
+    for (PendingNest &nest : pending_) prepareSearch(nest);
+    llvm::ThreadPool *pool = opts_.schedule_pool_;
+    if (!pool || pending_.size() <= 1) {
+      for (PendingNest &nest : pending_) searchTransforms(nest);
+    } else {
+      // Each nest is a task of the pool, with its own arena; the pool's
+      // threads left over search within the nests, as nested tasks.
+      // The time-trace profiler is per thread; finishing a task's merges its
+      // events into this thread's trace.
+      bool trace = llvm::timeTraceProfilerEnabled();
+      llvm::ThreadPoolTaskGroup tasks{*pool};
+      for (PendingNest &nest : pending_) {
+        tasks.async([this, &nest, trace] {
+          // a task run while its thread waits on a nested group shares the
+          // waiting task's profiler
+          bool own = trace && !llvm::getTimeTraceProfilerInstance();
+          if (own)
+            llvm::timeTraceProfilerInitialize(time_trace_granularity,
+                                              "turbo-loop");
+          searchTransforms(nest);
+          if (own) llvm::timeTraceProfilerFinishThread();
+        });
+      }
+      tasks.wait();
+    }
+    for (PendingNest &nest : pending_) {
+      // greedy choices would outlive the budget that forced them
+      if (opts_.cache_ && !nest.cached_ && !nest.greedy_)
+        opts_.cache_->insert(nest.key_, nest.trfs_, nest.cost_);
+      if (nest.greedy_ && !nest.greedy_only_ && ore_)
+        remark("BudgetExceeded", nest.loop_,
+               "cost evaluation budget exceeded; unroll factors were chosen "
+               "greedily");
+      if (nest.planned_) {
+        plans_.append(nest.plans_.begin(), nest.plans_.end());
+        parallel_plans_.append(nest.parallel_plans_.begin(),
+                               nest.parallel_plans_.end());
+      } else if (ore_ && opts_.metadata_only_)
+        remark("NotLowered", nest.loop_,
+               "schedule reorders the original loop nest, which llvm.loop "
+               "metadata cannot express");
+      else if (ore_)
+        remark("NotLowered", nest.loop_,
+               "schedule reorders the original loop nest; lowering it is not "
+               "yet supported");
+    }
+    pending_.clear();
+    if (opts_.cache_) opts_.cache_->save();
+  }
+  /// Outlines `parallel_plans_` onto the `TurboLoopRuntime` thread pool;
+  /// returns `true` if any loop was. Lowering may have fully unrolled a
+  /// planned loop, so we skip loops no longer in `LoopInfo`, which does not
+  /// reuse the memory of erased loops.
+  auto parallelize() -> bool {
+    if (parallel_plans_.empty()) return false;
+    llvm::SmallPtrSet<llvm::Loop *, 16> live;
+    for (llvm::Loop *L : li_->getLoopsInPreorder()) live.insert(L);
+    codegen::Parallelization par{li_, &dom_tree_, se_, &assumption_cache_};
+    bool changed = false;
+    for (codegen::ParallelPlan p : parallel_plans_) {
+      if (!live.contains(p.loop_)) continue;
+      std::optional<codegen::Parallelization::Candidate> c = par.analyze(p);
+      // remark while the loop is still in this function
+      if (ore_ && !c)
+        remark("NotParallelized", p.loop_,
+               "parallel loop is not in a form we can outline");
+      else if (ore_)
+        remark("Parallelized", p.loop_,
+               p.chunk_ ? llvm::formatv("outlined onto the thread pool, in "
+                                        "chunks of {0} iterations",
+                                        p.chunk_)
+                            .str()
+                        : "outlined onto the thread pool");
+      if (!c) continue;
+      par.outline(*c);
+      changed = true;
+    }
+    parallel_plans_.clear();
+    return changed;
   }
   /*
     auto isLoopPreHeader(const llvm::BasicBlock *BB) const -> bool {
@@ -532,7 +852,8 @@ class TurboLoop {
   //   for (auto l : loopForests) l->~LoopTree();
   // }
 public:
-  TurboLoop(llvm::Function &F, llvm::FunctionAnalysisManager &FAM)
+  TurboLoop(llvm::Function &F, llvm::FunctionAnalysisManager &FAM,
+            TurboLoopOptions opts = {})
     : tli_{&FAM.getResult<llvm::TargetLibraryAnalysis>(F)},
       tti_{&FAM.getResult<llvm::TargetIRAnalysis>(F)},
       li_{&FAM.getResult<llvm::LoopAnalysis>(F)},
@@ -540,14 +861,20 @@ public:
       ore_{&FAM.getResult<llvm::OptimizationRemarkEmitterAnalysis>(F)},
       assumption_cache_(FAM.getResult<llvm::AssumptionAnalysis>(F)),
       dom_tree_(FAM.getResult<llvm::DominatorTreeAnalysis>(F)),
-      instructions_(F.getParent()),
-      arch_{target::machine(*tti_, F.getContext()).arch_} {}
+      instructions_(F.getParent()), fn_name_{F.getName()},
+      arch_{target::machine(*tti_, F.getContext()).arch_}, opts_{opts} {
+    deps_.setLPDump(opts_.lp_dump_);
+    if (opts_.distribute_) aa_ = &FAM.getResult<llvm::AAManager>(F);
+    // distribution, and lowering's unroll-and-jam legality check
+    if (opts_.distribute_ || !opts_.metadata_only_)
+      di_ = &FAM.getResult<llvm::DependenceAnalysis>(F);
+  }
   // llvm::LoopNest LA = FAM.getResult<llvm::LoopNestAnalysis>(F);
   // llvm::AssumptionCache &AC = FAM.getResult<llvm::AssumptionAnalysis>(F);
   // llvm::DominatorTree &DT = FAM.getResult<llvm::DominatorTreeAnalysis>(F);
   // TLI = &FAM.getResult<llvm::TargetLibraryAnalysis>(F);
   auto run() -> llvm::PreservedAnalyses {
-
+    llvm::TimeTraceScope timer("TurboLoop", fn_name_);
     if (!ore_->enabled()) ore_ = nullptr; // cheaper check
     if (ore_) {
       // llvm::OptimizationRemarkAnalysis
@@ -562,10 +889,56 @@ public:
                           getTarget().getVectorRegisterBitWidth());
       remark("VectorRegisterCount", *li_->begin(), str);
     }
+    bool distributed = false;
+    if (opts_.distribute_) {
+      codegen::Distribution dist{li_, &dom_tree_, se_, aa_, di_};
+      for (llvm::Loop *L : dist.run()) {
+        distributed = true;
+        if (ore_)
+          remark("Distributed", L,
+                 "moved statements we cannot analyze into a loop nest of "
+                 "their own");
+      }
+    }
     // Builds the loopForest, constructing predicate chains and loop nests
     dict::map<llvm::Value *, IR::Value *> llvm_to_internal_map;
     IR::TreeResult tr = initializeLoopForest(&llvm_to_internal_map);
     if (tr.accept(0)) optimize(tr, &llvm_to_internal_map);
-    return llvm::PreservedAnalyses::none();
+    optimizePending();
+    if (ore_ && !li_->empty()) {
+      const poly::IndependenceTests &it = deps_.independenceTests();
+      llvm::SmallString<128> str = llvm::formatv(
+        "dependence pairs eliminated by offset: {0}, gcd: {1}, banerjee: {2}; "
+        "polyhedral checks: {3}",
+        it.offset(), it.gcd(), it.banerjee(), it.polyhedral());
+      remark("DependencePrefilter", *li_->begin(), str);
+    }
+    if (ore_)
+      for (codegen::LoopPlan p : plans_)
+        if (p.trf_.cache_unroll() > 1)
+          remark("CacheTileNotLowered", p.loop_,
+                 llvm::formatv("chose a cache tile of {0} register tiles, "
+                               "which is not lowered yet",
+                               p.trf_.cache_unroll())
+                   .str());
+    if (opts_.metadata_only_) {
+      bool attached = codegen::attachMetadata(plans_);
+      bool parallelized = parallelize();
+      if (distributed || parallelized) return llvm::PreservedAnalyses::none();
+      if (!attached) return llvm::PreservedAnalyses::all();
+      llvm::PreservedAnalyses pa;
+      pa.preserveSet<llvm::CFGAnalyses>();
+      return pa;
+    }
+    codegen::Lowering lowering{
+      li_, se_, &dom_tree_, &assumption_cache_, tti_, ore_, di_};
+    bool changed = lowering.lower(plans_) || distributed;
+    for (codegen::ParallelPlan &p : parallel_plans_)
+      p.unroll_ = lowering.unrollFactor(p.loop_);
+    changed |=
+      codegen::Lowering::eraseDeadAllocations(erase_candidates_, tli_) > 0;
+    changed |= parallelize();
+    return changed ? llvm::PreservedAnalyses::none()
+                   : llvm::PreservedAnalyses::all();
   }
 };
@@ -0,0 +1,181 @@
+#ifdef USE_MODULE
+module;
+#else
+#pragma once
+#endif
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#ifndef USE_MODULE
+#include "Frontends/LLVM.cxx"
+#include "LinearProgramming/LPFormat.cxx"
+#include "Optimize/TransformCache.cxx"
+#else
+export module TurboLoopPass;
+export import LLVMFrontend;
+import LPFormat;
+import TransformCache;
+#endif
+
+#ifdef USE_MODULE
+export {
+#endif
+
+  /// The options of `turbo-loop<...>`, and the paths some of them name.
+  struct TurboLoopConfig {
+    TurboLoopOptions opts_{};
+    std::string cache_path_{};
+    std::string trace_path_{};
+    std::string dump_dir_{};
+  };
+
+  /// Parses the options of `turbo-loop<opt1;opt2>`, i.e. `opt1;opt2`;
+  /// returns `std::nullopt` on unknown options.
+  /// Supported options:
+  /// - `metadata-only`: attach `llvm.loop` metadata instead of rewriting, to
+  ///   nests whose schedule keeps the original loop order
+  /// - `threads=N`: search independent nests, and schedule the independent
+  ///   components of a nest, on `N` threads (`0`: all); threads left over
+  ///   search the unrolls of a nest's outer-most loop
+  /// - `cache=path`: reuse `LoopTransform`s stored in `path`, adding new ones
+  /// - `time-trace=path`: write per-function and per-nest phase timings to
+  ///   `path`
+  /// - `max-dep-pairs=N`, `max-lp-work=N`, `max-cost-evals=N`: compile-time
+  ///   budget, see `TurboLoopOptions`
+  /// - `locality`: schedule stride-one loops innermost
+  /// - `bands`: prefer outer parallelism and tileable bands, as in Pluto
+  /// - `presolve-report`: remark the size of each scheduling LP before and
+  ///   after presolving
+  /// - `fused-edges`: treat dependencies ordered by an outer loop's fusion as
+  ///   satisfied there, freeing the inner levels
+  /// - `fusion-cost`: re-fuse split loops only where the cost model expects a
+  ///   gain
+  /// - `distribute`: split nests with calls we cannot analyze, optimizing the
+  ///   rest
+  /// - `parallel`: run parallel outermost loops on the `TurboLoopRuntime`
+  ///   thread pool, which the compiled program must link
+  /// - `lp-dump=dir`: write each scheduling LP and Farkas system to `dir`
+  /// - `search-memo`: reuse each subtree's unroll search across the unrolls of
+  ///   the loops containing it
+  /// - `vector-2d`: let two loops of a nest share the vector lanes
+  inline auto parseTurboLoopOptions(llvm::StringRef params)
+    -> std::optional<TurboLoopConfig> {
+    TurboLoopConfig config{};
+    TurboLoopOptions &opts = config.opts_;
+    while (!params.empty()) {
+      llvm::StringRef param;
+      std::tie(param, params) = params.split(';');
+      if (param == "metadata-only") opts.metadata_only_ = true;
+      else if (param == "locality") opts.locality_objective_ = true;
+      else if (param == "bands") opts.tile_bands_ = true;
+      else if (param == "presolve-report") opts.presolve_report_ = true;
+      else if (param == "fused-edges") opts.fused_edges_ = true;
+      else if (param == "fusion-cost") opts.fusion_cost_ = true;
+      else if (param == "distribute") opts.distribute_ = true;
+      else if (param == "parallel") opts.parallel_ = true;
+      else if (param == "search-memo") opts.search_memo_ = true;
+      else if (param == "vector-2d") opts.vectorize_2d_ = true;
+      else if (param.consume_front("threads=")) {
+        if (param.getAsInteger(10, opts.threads_)) return std::nullopt;
+      } else if (param.consume_front("cache="))
+        config.cache_path_ = param.str();
+      else if (param.consume_front("time-trace="))
+        config.trace_path_ = param.str();
+      else if (param.consume_front("lp-dump=")) config.dump_dir_ = param.str();
+      else if (param.consume_front("max-dep-pairs=")) {
+        if (param.getAsInteger(10, opts.max_dep_pairs_)) return std::nullopt;
+      } else if (param.consume_front("max-lp-work=")) {
+        if (param.getAsInteger(10, opts.max_lp_work_)) return std::nullopt;
+      } else if (param.consume_front("max-cost-evals=")) {
+        if (param.getAsInteger(10, opts.max_cost_evals_)) return std::nullopt;
+      } else return std::nullopt;
+    }
+    return config;
+  }
+
+  /// Records `llvm::TimeTraceScope`s while alive, and writes them to `path_`
+  /// as Chrome trace-event JSON, with a "Total" event per phase summarizing
+  /// all functions. If a profiler is already running, e.g. under
+  /// `-time-trace`, we leave it to its owner.
+  class TimeTraceFile {
+    std::string path_;
+    bool owner_;
+
+  public:
+    TimeTraceFile(std::string path)
+      : path_{std::move(path)}, owner_{!llvm::timeTraceProfilerEnabled()} {
+      if (owner_)
+        llvm::timeTraceProfilerInitialize(time_trace_granularity, "turbo-loop");
+    }
+    TimeTraceFile(const TimeTraceFile &) = delete;
+    ~TimeTraceFile() {
+      if (!owner_) return;
+      std::error_code ec;
+      llvm::raw_fd_ostream os(path_, ec, llvm::sys::fs::OF_Text);
+      if (!ec) llvm::timeTraceProfilerWrite(os);
+      else llvm::errs() << "turbo-loop: cannot write " << path_ << "\n";
+      llvm::timeTraceProfilerCleanup();
+    }
+  };
+
+  /// Runs `TurboLoop` on each function, owning the transform cache, trace,
+  /// LP dump and thread pool its options name, so that they are shared by
+  /// every function it optimizes.
+  class TurboLoopPass : public llvm::PassInfoMixin<TurboLoopPass> {
+    TurboLoopOptions opts_;
+    // owns `opts_.cache_`
+    std::unique_ptr<CostModeling::TransformCache> cache_;
+    std::unique_ptr<TimeTraceFile> trace_;
+    // owns `opts_.lp_dump_`
+    std::unique_ptr<lp::LPDump> lp_dump_;
+    // owns `opts_.schedule_pool_`, reused by every function we optimize
+    std::unique_ptr<llvm::ThreadPool> schedule_pool_;
+
+  public:
+    TurboLoopPass() = default;
+    TurboLoopPass(const TurboLoopConfig &config) : opts_{config.opts_} {
+      if (!config.cache_path_.empty()) {
+        cache_ =
+          std::make_unique<CostModeling::TransformCache>(config.cache_path_);
+        opts_.cache_ = cache_.get();
+      }
+      if (!config.trace_path_.empty())
+        trace_ = std::make_unique<TimeTraceFile>(config.trace_path_);
+      if (!config.dump_dir_.empty()) {
+        llvm::sys::fs::create_directories(config.dump_dir_);
+        lp_dump_ = std::make_unique<lp::LPDump>(config.dump_dir_);
+        opts_.lp_dump_ = lp_dump_.get();
+      }
+      if (opts_.threads_ != 1) {
+        schedule_pool_ = std::make_unique<llvm::ThreadPool>(
+          llvm::hardware_concurrency(opts_.threads_));
+        opts_.schedule_pool_ = schedule_pool_.get();
+      }
+    }
+    TurboLoopPass(const TurboLoopPass &) = delete;
+    TurboLoopPass(TurboLoopPass &&) = default;
+
+    auto __attribute__((visibility("default")))
+    run(llvm::Function &F,
+        llvm::FunctionAnalysisManager &FAM) -> llvm::PreservedAnalyses {
+      if (F.isDeclaration()) return llvm::PreservedAnalyses::all();
+      TurboLoop tl{F, FAM, opts_};
+      return tl.run();
+    }
+  };
+
+#ifdef USE_MODULE
+}
+#endif
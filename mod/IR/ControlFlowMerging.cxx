@@ -19,6 +19,7 @@ module;
 #include <llvm/Support/Allocator.h>
 #include <llvm/Support/Casting.h>
 #include <llvm/Support/InstructionCost.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <utility>
 
 #ifndef USE_MODULE
@@ -494,6 +495,7 @@ mergeInstructions(IR::Cache &cache, Predicate::Map &predMap,
                   target::Machine<TTI> target, Arena<> tAlloc,
                   unsigned vectorBits, LLVMIRBuilder LB,
                   TreeResult tr) -> TreeResult {
+  llvm::TimeTraceScope timer("mergeInstructions");
   auto [completed, trret] = cache.completeInstructions(&predMap, LB, tr);
   tr = trret;
   if (!predMap.isDivergent()) return tr;
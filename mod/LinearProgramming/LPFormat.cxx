@@ -0,0 +1,174 @@
+#ifdef USE_MODULE
+module;
+#else
+#pragma once
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#ifndef USE_MODULE
+#include "Math/Array.cxx"
+#include "Math/ManagedArray.cxx"
+#else
+export module LPFormat;
+import Array;
+import ManagedArray;
+#endif
+
+#ifdef USE_MODULE
+export namespace lp {
+#else
+namespace lp {
+#endif
+using math::PtrMatrix, math::DenseMatrix;
+
+/// An LP as solved by `math::Simplex`: `C[_, 0] == C[_, _(1, end)] * x`, with
+/// `x >= 0`, where column `c` holds the coefficients of variable `x<c>`.
+/// If `stop` is set, the objective is that of `rLexMinStop(*stop)`: minimize
+/// the last variable first, then the one before, down to `x<*stop + 1>`.
+/// Otherwise, it is a feasibility problem, like the Farkas systems of
+/// `DepPoly::farkasPair`.
+///
+/// `write` emits CPLEX LP format, with the lexicographic objective as a
+/// multi-objective of decreasing priorities, so other solvers accept the
+/// files too. `read` parses the files `write` emits; it is not a general LP
+/// parser.
+struct LPFile {
+  DenseMatrix<int64_t> C;
+  std::optional<ptrdiff_t> stop;
+
+  static void write(std::ostream &os, PtrMatrix<int64_t> C,
+                    std::optional<ptrdiff_t> stop) {
+    ptrdiff_t R = ptrdiff_t(C.numRow()), N = ptrdiff_t(C.numCol()) - 1;
+    os << "\\ " << R << " constraints, " << N << " variables\n";
+    if (stop) {
+      os << "Minimize multi-objectives\n";
+      for (ptrdiff_t c = N; c > *stop; --c)
+        os << " o" << c << ": Priority=" << c - *stop
+           << " Weight=1 AbsTol=0 RelTol=0\n  x" << c << "\n";
+    } else os << "Minimize\n obj:\n";
+    os << "Subject To\n";
+    for (ptrdiff_t r = 0; r < R; ++r) {
+      os << " c" << r << ":";
+      bool empty = true;
+      for (ptrdiff_t c = 1; c <= N; ++c) {
+        int64_t a = C[r, c];
+        if (!a) continue;
+        os << (a < 0 ? " - " : (empty ? " " : " + "));
+        if (a != 1 && a != -1) os << (a < 0 ? -a : a) << " ";
+        os << "x" << c;
+        empty = false;
+      }
+      if (empty) os << " 0 x1";
+      os << " = " << C[r, 0] << "\n";
+    }
+    os << "End\n";
+  }
+  static auto read(std::istream &is) -> std::optional<LPFile> {
+    std::string line;
+    ptrdiff_t R, N;
+    if (!std::getline(is, line)) return std::nullopt;
+    {
+      std::istringstream hs{line};
+      std::string slash, cons, vars;
+      if (!(hs >> slash >> R >> cons >> N >> vars) || slash != "\\")
+        return std::nullopt;
+    }
+    LPFile lp{DenseMatrix<int64_t>{
+                math::DenseDims<>{math::row(R), math::col(N + 1)}, 0},
+              std::nullopt};
+    ptrdiff_t r = 0;
+    bool constraints = false;
+    while (std::getline(is, line)) {
+      std::string_view l{line};
+      if (l == "Subject To") {
+        constraints = true;
+        continue;
+      }
+      if (l == "End") break;
+      if (!constraints) {
+        // objective variables are indented `  x<c>`
+        if (l.starts_with("  x")) {
+          ptrdiff_t c = number(l.substr(3)).value_or(0);
+          if (c < 1 || c > N) return std::nullopt;
+          lp.stop = std::min(lp.stop.value_or(c), c - 1);
+        }
+        continue;
+      }
+      if (r >= R || !readConstraint(l, lp.C, r++)) return std::nullopt;
+    }
+    if (r != R) return std::nullopt;
+    return lp;
+  }
+
+private:
+  static auto number(std::string_view s) -> std::optional<int64_t> {
+    int64_t x;
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), x);
+    if (ec != std::errc{} || end != s.data() + s.size()) return std::nullopt;
+    return x;
+  }
+  static auto readConstraint(std::string_view l, DenseMatrix<int64_t> &C,
+                             ptrdiff_t r) -> bool {
+    std::istringstream ls{std::string(l)};
+    std::string tok;
+    ls >> tok; // name
+    int64_t sign = 1, coef = 1;
+    while (ls >> tok) {
+      if (tok == "+") continue;
+      if (tok == "-") {
+        sign = -1;
+        continue;
+      }
+      if (tok == "=") {
+        ls >> tok;
+        std::optional<int64_t> rhs = number(tok);
+        if (!rhs) return false;
+        C[r, 0] = *rhs;
+        return true;
+      }
+      if (tok.starts_with("x")) {
+        std::optional<int64_t> c = number(std::string_view{tok}.substr(1));
+        if (!c || *c < 1 || *c >= C.numCol()) return false;
+        C[r, *c] += sign * coef;
+        sign = coef = 1;
+        continue;
+      }
+      std::optional<int64_t> a = number(tok);
+      if (!a) return false;
+      coef = *a;
+    }
+    return false;
+  }
+};
+
+/// Writes each LP passed to `dump` into its own file in `dir`, named
+/// `<kind>-<n>.lp`, with `n` counting the LPs dumped so far. Thread safe.
+class LPDump {
+  std::string dir_;
+  std::atomic<ptrdiff_t> count_{0};
+
+public:
+  LPDump(std::string dir) : dir_{std::move(dir)} {}
+  void dump(std::string_view kind, PtrMatrix<int64_t> C,
+            std::optional<ptrdiff_t> stop) {
+    ptrdiff_t n = count_.fetch_add(1, std::memory_order_relaxed);
+    std::ofstream os{dir_ + "/" + std::string(kind) + "-" + std::to_string(n) +
+                     ".lp"};
+    if (os) LPFile::write(os, C, stop);
+  }
+};
+
+} // namespace lp
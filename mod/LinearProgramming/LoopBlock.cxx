@@ -5,6 +5,7 @@ module;
 #endif
 
 #include <algorithm>
+#include <boost/container_hash/hash.hpp>
 #include <cstddef>
 #include <cstdint>
 #include <limits>
@@ -18,18 +19,23 @@ module;
 #include <llvm/IR/Value.h>
 #include <llvm/Support/Allocator.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <memory>
 #include <ranges>
 
 #ifndef USE_MODULE
 #include "Alloc/Arena.cxx"
 #include "Containers/BitSets.cxx"
 #include "Containers/Pair.cxx"
+#include "Dicts/Dict.cxx"
 #include "Dicts/Trie.cxx"
 #include "Graphs/Graphs.cxx"
 #include "IR/Address.cxx"
 #include "IR/Cache.cxx"
 #include "IR/Instruction.cxx"
 #include "IR/TreeResult.cxx"
+#include "LinearProgramming/LPFormat.cxx"
 #include "LinearProgramming/ScheduledNode.cxx"
 #include "Math/Comparisons.cxx"
 #include "Math/Constructors.cxx"
@@ -54,6 +60,7 @@ import Comparisons;
 import GCD;
 import Invariant;
 import ListRange;
+import LPFormat;
 import ManagedArray;
 import NormalForm;
 import Pair;
@@ -68,6 +75,7 @@ import :AffineLoops;
 import :AffineSchedule;
 import :Cache;
 import :Dependence;
+import :Dict;
 import :Instruction;
 import :ScheduledNode;
 import :TreeResult;
@@ -107,6 +115,82 @@ static_assert((Result::dependent() & Result::independent()) ==
 static_assert((Result::failure() & Result::independent()) == Result::failure());
 static_assert((Result::failure() & Result::dependent()) == Result::failure());
 
+/// Limits on the work `LoopBlock::optimize` may spend on one nest; `0` means
+/// unlimited. `depPairs` bounds the number of `Addr` pairs checked for
+/// dependencies, a negative value allowing none. `lpWork` bounds the summed
+/// size, rows times columns, of the scheduling LPs we instantiate, as a proxy
+/// for the pivots solving them.
+struct ScheduleBudget {
+  ptrdiff_t depPairs{0};
+  ptrdiff_t lpWork{0};
+  enum Cut : uint8_t { None, DepPairs, LPWork };
+};
+
+/// Bytes a loop nest accesses per iteration of the loop fusion is considered
+/// at, estimated from the trip counts of the original inner loops, in total
+/// and per array, and the number of `Addr`s, i.e. streams occupying a register
+/// each.
+struct Footprint {
+  double bytes{0};
+  double streams{0};
+  dict::map<const IR::Value *, double> arrays{};
+};
+
+/// Target parameters of the profitability check `LoopBlock::tryFuse` makes
+/// before fusing components it may legally fuse. With `l1Bytes == 0`, we fuse
+/// whenever legal.
+/// This is a coarse filter, not the `LoopTreeCostFn` model: that one costs an
+/// `IR::Loop` tree, which `CostModeling::buildLoopTree` only builds from the
+/// finished schedule, after fusion has been decided.
+struct FusionModel {
+  int64_t l1Bytes{0};
+  int64_t vectorRegisters{0};
+
+  /// Whether fusing nests with footprints `f0` and `f1` is expected to pay
+  /// off. Fusion streams the arrays both access through the cache once
+  /// instead of twice; that gain must outweigh the losses: the part of the
+  /// fused footprint that no longer fits in L1 when the separate ones did, and
+  /// a store and reload of each stream beyond the vector registers.
+  [[nodiscard]] auto profitable(const Footprint &f0,
+                                const Footprint &f1) const -> bool {
+    if (!l1Bytes) return true;
+    double gain = 0, sharedArrays = 0;
+    for (auto [array, bytes] : f0.arrays) {
+      auto it = f1.arrays.find(array);
+      if (it == f1.arrays.end()) continue;
+      gain += std::min(bytes, it->second);
+      ++sharedArrays;
+    }
+    // how much fusing pushes `x0 + x1` over `cap`, beyond `x0` and `x1` alone
+    auto overflow = [](double x0, double x1, double shared, double cap) {
+      auto over = [=](double x) { return std::max(0.0, x - cap); };
+      return std::max(0.0, over(x0 + x1 - shared) - over(x0) - over(x1));
+    };
+    double fused = f0.bytes + f1.bytes - gain,
+           streams = f0.streams + f1.streams - sharedArrays;
+    double cacheLoss = overflow(f0.bytes, f1.bytes, gain, double(l1Bytes));
+    double spills =
+      overflow(f0.streams, f1.streams, sharedArrays, double(vectorRegisters));
+    return gain >= cacheLoss + 2 * spills * (fused / streams);
+  }
+};
+
+/// Which presolving `LoopBlock::solveGraph` applies to its scheduling LPs.
+/// Reducing the tableau, see `LoopBlock::presolve`, leaves the schedule
+/// unchanged. Marking edges the fusion omegas of an outer level already order
+/// as satisfied drops their constraints on the inner levels, which may change
+/// the schedule, so it is opt-in.
+struct Presolve {
+  bool tableau{true};
+  bool fusedEdges{false};
+};
+
+/// Size of a scheduling LP, excluding the constants column, before and after
+/// `LoopBlock::presolve`.
+struct PresolveReport {
+  ptrdiff_t rows, cols, presolvedRows, presolvedCols;
+};
+
 /// A loop block is a block of the program that may include multiple loops.
 /// These loops are either all executed (note iteration count may be 0, or
 /// loops may be in rotated form and the guard prevents execution; this is okay
@@ -176,6 +260,16 @@ class LoopBlock {
   // llvm::LoopInfo *LI;
   IR::Dependencies &deps;
   alloc::Arena<> &allocator;
+  ScheduleBudget budget;
+  ptrdiff_t depPairs{0};
+  ptrdiff_t lpWork{0};
+  ScheduleBudget::Cut cut{ScheduleBudget::None};
+  llvm::SmallVector<PresolveReport> presolveReports;
+  bool localityObjective;
+  bool tileBands;
+  llvm::ThreadPool *pool;
+  FusionModel fusion;
+  Presolve presolving;
   // we may turn off edges because we've exceeded its loop depth
   // or because the dependence has already been satisfied at an
   // earlier level.
@@ -187,15 +281,35 @@ class LoopBlock {
     int numBounding{0};
     int numConstraints{0};
     int numActiveEdges{0};
+    int numObjective{0}; ///< `1` if the LP includes the locality objective
   };
 
 public:
-  constexpr LoopBlock(IR::Dependencies &deps_, alloc::Arena<> &allocator_)
-    : deps(deps_), allocator(allocator_) {}
+  /// If `localityObjective_`, schedules prefer keeping the loops along which
+  /// the most bytes are accessed contiguously innermost; otherwise, they
+  /// prefer the original loop order.
+  /// If `tileBands_`, scheduling follows Pluto: outer parallel loops are
+  /// preferred over inner ones, and dependencies carried by a loop keep
+  /// constraining the following levels while possible, skewing them into a
+  /// tileable band.
+  /// `breakGraph` solves the components it splits a graph into as tasks of
+  /// `pool_`, if any, and re-fuses them where `fusion_` expects it to pay.
+  LoopBlock(IR::Dependencies &deps_, alloc::Arena<> &allocator_,
+            ScheduleBudget budget_ = {}, bool localityObjective_ = false,
+            bool tileBands_ = false, llvm::ThreadPool *pool_ = nullptr,
+            FusionModel fusion_ = {}, Presolve presolve_ = {})
+    : deps(deps_), allocator(allocator_), budget(budget_),
+      localityObjective(localityObjective_), tileBands(tileBands_),
+      pool(pool_), fusion(fusion_), presolving(presolve_) {}
 
   struct OptimizationResult {
     IR::AddrChain addr;
     ScheduledNode *nodes;
+    /// Set when a budget cut left `nodes` in the original schedule. Without
+    /// `depsChecked`, dependencies are unknown, and the nest must not be
+    /// reordered.
+    bool original{false};
+    bool depsChecked{true};
     [[nodiscard]] constexpr auto getVertices() const {
       return nodes->getVertices();
     }
@@ -205,23 +319,42 @@ public:
     }
   };
 
+  /// Schedules the nest. If a budget is cut, the nodes are returned in their
+  /// original schedule instead, see `OptimizationResult::original`.
   [[nodiscard]] auto optimize(IR::Cache &cache,
                               IR::TreeResult tr) -> OptimizationResult {
+    llvm::TimeTraceScope timer("LoopBlock::optimize");
     // fill the dependence edges between memory accesses
-    for (Addr *stow : tr.getStores()) {
-      Addr *next = llvm::cast_or_null<Addr>(stow->getNextAddr());
-      for (Addr *other = next; other;
-           other = llvm::cast_or_null<Addr>(other->getNextAddr()))
-        deps.check(&allocator, stow, other);
-    }
+    bool checked = checkDependencies(tr);
     // link stores with loads connected through registers
     OptimizationResult opt{tr.addr, nullptr};
     for (Addr *stow : tr.getStores())
       opt = addScheduledNode(cache, stow, opt.addr).setOrigNext(opt.nodes);
-    for (ScheduledNode *node : opt.getVertices()) shiftOmega(node);
-    return optOrth(opt.nodes, tr.getMaxDepth()) ? opt : OptimizationResult{};
+    if (!opt.nodes) return {};
+    if (checked) {
+      for (ScheduledNode *node : opt.getVertices()) shiftOmega(node);
+      if (optOrth(opt.nodes, tr.getMaxDepth())) return opt;
+      if (cut == ScheduleBudget::None) return {};
+    }
+    scheduleOriginal(opt.nodes);
+    opt.original = true;
+    opt.depsChecked = checked;
+    return opt;
   }
   void clear() { allocator.reset(); }
+  /// Which budget made `optimize` give up, if any.
+  [[nodiscard]] constexpr auto budgetCut() const -> ScheduleBudget::Cut {
+    return cut;
+  }
+  /// The sizes of each scheduling LP before and after presolving.
+  [[nodiscard]] auto getPresolveReports() const
+    -> llvm::ArrayRef<PresolveReport> {
+    return presolveReports;
+  }
+  /// Number of `Addr` pairs checked for dependencies.
+  [[nodiscard]] constexpr auto numDepPairs() const -> ptrdiff_t {
+    return depPairs;
+  }
   [[nodiscard]] constexpr auto getAllocator() -> Arena<> * {
     return &allocator;
   }
@@ -233,6 +366,52 @@ public:
   }
 
 private:
+  /// Resets the schedules and sat levels a cut-short `optOrth` left behind to
+  /// those of the original program. `breakGraph` may have split the nodes
+  /// into components, so we follow the original node order.
+  void scheduleOriginal(ScheduledNode *nodes) {
+    for (ScheduledNode *node : nodes->getAllVertices())
+      node->scheduleOriginal();
+    for (ScheduledNode *inNode : nodes->getAllVertices()) {
+      for (Dependence edge : inNode->outputEdges(deps)) {
+        ScheduledNode *outNode = edge.output()->getNode();
+        edge.satisfyOriginalOrder(allocator, inNode->getFusionOmega(),
+                                  outNode->getFusionOmega());
+      }
+    }
+  }
+  /// Groups the addresses of `tr` by base pointer, and pairs each store only
+  /// with the later addresses of its own group, as accesses to different
+  /// arrays are independent. Groups keep program order, so edge direction and
+  /// the order in which `check` is called are the same as when visiting every
+  /// later address of the chain.
+  /// Returns `false`, checking nothing, if that exceeds `budget.depPairs`.
+  auto checkDependencies(IR::TreeResult tr) -> bool {
+    dict::map<Value *, ptrdiff_t> bucket_ids;
+    llvm::SmallVector<llvm::SmallVector<Addr *, 8>, 8> buckets;
+    // (bucket, position) of each store, in program order
+    llvm::SmallVector<containers::Pair<ptrdiff_t, ptrdiff_t>, 16> stores;
+    for (Addr *a : tr.getAddr()) {
+      auto [it, inserted] =
+        bucket_ids.try_emplace(a->getArrayPointer(), buckets.size());
+      if (inserted) buckets.emplace_back();
+      llvm::SmallVector<Addr *, 8> &bucket = buckets[it->second];
+      if (a->isStore())
+        stores.push_back({it->second, ptrdiff_t(bucket.size())});
+      bucket.push_back(a);
+    }
+    for (auto [b, i] : stores) depPairs += ptrdiff_t(buckets[b].size()) - i - 1;
+    if (budget.depPairs && depPairs > std::max<ptrdiff_t>(budget.depPairs, 0)) {
+      cut = ScheduleBudget::DepPairs;
+      return false;
+    }
+    for (auto [b, i] : stores) {
+      llvm::ArrayRef<Addr *> bucket = buckets[b];
+      for (Addr *other : bucket.drop_front(i + 1))
+        deps.check(&allocator, bucket[i], other);
+    }
+    return true;
+  }
   struct LoadSummary {
     Value *store;
     poly::Loop *deepestLoop;
@@ -559,10 +738,14 @@ private:
       }
     }
     if (tryOrth) {
-      if (Result r = optimize(nodes, 0, maxDepth)) return r;
+      if (Result r = schedule(nodes, maxDepth)) return r;
       for (ScheduledNode *n : nodes->getVertices()) n->unschedulePhi();
     }
-    return optimize(nodes, 0, maxDepth);
+    return schedule(nodes, maxDepth);
+  }
+  auto schedule(ScheduledNode *nodes, int maxDepth) -> Result {
+    return tileBands ? optimizeBand(nodes, 0, 0, maxDepth)
+                     : optimize(nodes, 0, maxDepth);
   }
   using BackupSchedule = math::ResizeableView<
     containers::Pair<poly::AffineSchedule, ScheduledNode *>, math::Length<>>;
@@ -614,6 +797,53 @@ private:
     }
     return breakGraph(nodes, d);
   }
+  /// Pluto-style alternative to `optimize`. The scheduling LP already
+  /// minimizes dependence distances first, so outer levels carry no
+  /// dependence when possible; unlike `optimize`, we never trade that for
+  /// inner parallelism via `optimizeSatDep`.
+  /// Levels `[band, d)` form the current band. Level `d` is first solved
+  /// within it, i.e. requiring the dependencies carried by the band to have
+  /// non-negative distance at `d` as well, which skews `d` if needed. If that
+  /// is infeasible, the band ends, and `d` starts a new one.
+  // NOLINTNEXTLINE(misc-no-recursion)
+  [[nodiscard]] auto optimizeBand(ScheduledNode *nodes, int d, int band,
+                                  int maxDepth) -> Result {
+    if (d >= maxDepth) return Result::independent();
+    Result r = solveInBand(nodes, d, band);
+    if (!r) {
+      band = d;
+      r = solveGraph(nodes, d, false);
+    }
+    if (r) {
+      int descend = d + 1;
+      if (descend == maxDepth) return r;
+      if (Result n = optimizeBand(nodes, descend, band, maxDepth))
+        return r & n;
+    }
+    return breakGraph(nodes, d);
+  }
+  /// Solves level `d`, keeping the edges satisfied by levels `[band, d)` of
+  /// the LP active; their sat levels are restored afterwards.
+  /// Fails without solving if there are none, as `solveGraph` then suffices.
+  /// `nodes` has not been split since `band`, so these edges are internal.
+  auto solveInBand(ScheduledNode *nodes, int d, int band) -> Result {
+    llvm::SmallVector<containers::Pair<int32_t, uint8_t>, 16> carried;
+    for (ScheduledNode *node : nodes->getVertices()) {
+      for (int32_t dID : node->outputEdgeIds(deps)) {
+        uint8_t &lvl = deps.get(dID).satLevelPair()[0];
+        int s = Dependence::satLevelMask(lvl);
+        if (!Dependence::preventsReordering(lvl) || (s < 2 * band) ||
+            (s >= 2 * d))
+          continue;
+        carried.emplace_back(dID, lvl);
+        lvl = std::numeric_limits<uint8_t>::max();
+      }
+    }
+    if (carried.empty()) return Result::failure();
+    Result r = solveGraph(nodes, d, false);
+    for (auto [dID, lvl] : carried) deps.get(dID).satLevelPair()[0] = lvl;
+    return r;
+  }
   /// solveGraph(ScheduledNode *nodes, int depth, bool satisfyDeps)
   /// solve the `nodes` graph at depth `d`
   /// if `satisfyDeps` is true, then we are trying to satisfy dependencies at
@@ -621,28 +851,188 @@ private:
   ///
   [[nodiscard]] auto solveGraph(ScheduledNode *nodes, int depth,
                                 bool satisfyDeps) -> Result {
+    if (presolving.fusedEdges) satisfyFusedEdges(nodes, depth);
     CoefCounts counts{calcCoefs(deps, nodes, depth)};
     return solveGraph(nodes, depth, satisfyDeps, counts);
   }
   [[nodiscard]] auto solveGraph(ScheduledNode *nodes, int depth0,
                                 bool satisfyDeps, CoefCounts counts) -> Result {
+    llvm::TimeTraceScope timer("solveGraph");
+    // once over budget, fail every remaining solve, so that we give up
+    if (cut != ScheduleBudget::None) return {};
     if (counts.numLambda == 0) {
       setSchedulesIndependent(nodes, depth0);
       return checkEmptySatEdges(nodes, depth0);
     }
+    counts.numObjective = localityObjective && counts.numPhiCoefs;
+    lpWork += ptrdiff_t(counts.numConstraints + counts.numObjective +
+                        counts.numSlack) *
+              (counts.numBounding + counts.numActiveEdges + counts.numPhiCoefs +
+               counts.numObjective + counts.numOmegaCoefs + counts.numSlack +
+               counts.numLambda);
+    if (budget.lpWork && lpWork > budget.lpWork) {
+      cut = ScheduleBudget::LPWork;
+      return {};
+    }
     // TODO: sat Deps should check which stashed ones to satisfy
     // use `edge->isCondIndep()`/`edge->preventsReodering()` to check
     // which edges should be satisfied on this level if `satisfyDeps`
     auto omniSimplex =
       instantiateOmniSimplex(nodes, depth0, satisfyDeps, counts);
-    if (omniSimplex->initiateFeasible()) return {};
-    auto sol = omniSimplex->rLexMinStop(counts.numLambda + counts.numSlack);
+    if (lp::LPDump *dump = deps.getLPDump())
+      dump->dump("schedule", omniSimplex->getConstraints(),
+                 counts.numLambda + counts.numSlack);
+    auto [presolved, numLambda] = presolve(omniSimplex.get(), counts);
+    // TODO: warm start. Successive depths, and the `tryFuse`/`optimizeSatDep`
+    // attempts, differ by a few rows: satisfied edges deactivated, and one
+    // more linear independence row. `Simplex` cannot yet add or deactivate
+    // rows of a solved tableau, so every LP starts phase one from scratch.
+    Simplex *feasible = presolved ? presolved.get() : omniSimplex.get();
+    if (feasible->initiateFeasible()) return {};
+    auto sol = feasible->rLexMinStop(numLambda + counts.numSlack);
     assert(sol.size() == counts.numBounding + counts.numActiveEdges +
-                           counts.numPhiCoefs + counts.numOmegaCoefs);
+                           counts.numPhiCoefs + counts.numObjective +
+                           counts.numOmegaCoefs);
     updateSchedules(nodes, depth0, counts, sol);
     return deactivateSatisfiedEdges(
       nodes, depth0, counts,
-      sol[_(counts.numPhiCoefs + counts.numOmegaCoefs, end)]);
+      sol[_(counts.numPhiCoefs + counts.numObjective + counts.numOmegaCoefs,
+            end)]);
+  }
+  /// Edges whose endpoints the fusion omegas of an outer level already order
+  /// are satisfied there, so we mark them as such, leaving them out of the LP.
+  /// E.g., `stashFit` reactivates all edges of the nodes it stashes.
+  void satisfyFusedEdges(ScheduledNode *nodes, int depth0) {
+    for (ScheduledNode *inNode : nodes->getVertices()) {
+      for (Dependence edge : inNode->outputEdges(deps, depth0)) {
+        ScheduledNode *outNode = edge.output()->getNode();
+        int depth = std::min({depth0, int(inNode->getNumLoops()) + 1,
+                              int(outNode->getNumLoops()) + 1});
+        for (int i = 0; i < depth; ++i) {
+          int64_t diff = outNode->getFusionOmega(i) - inNode->getFusionOmega(i);
+          if (!diff) continue;
+          if (diff > 0) edge.setSatLevelParallel(i);
+          break;
+        }
+      }
+    }
+  }
+  /// Presolves the tableau built by `instantiateOmniSimplex`, whose rows are
+  /// equalities over non-negative variables:
+  /// 1. A row with a `0` constant whose non-zero coefficients share a sign
+  ///    forces its variables to `0`. If those are all Farkas multipliers, we
+  ///    remove their columns, and the row. Other variables are kept, as the
+  ///    solution is read from their columns.
+  /// 2. A row `a'x + c*l = b` whose multiplier `l` appears in no other row is
+  ///    the inequality `sign(c)*a'x <= sign(c)*b`. If another such row has no
+  ///    smaller coefficients and no larger constant, it implies this one, as
+  ///    all variables are non-negative, so we remove the row, and `l`.
+  ///    Edges between the same nodes often yield such pairs.
+  /// 3. Duplicate rows, up to a scalar factor, are removed. Edges between the
+  ///    same nodes often share them once multipliers are removed.
+  /// Returns the presolved simplex, or `nullptr` if nothing was removed or
+  /// `!presolving.tableau`, along with the number of multipliers kept.
+  auto presolve(Valid<Simplex> simplex, CoefCounts counts)
+    -> containers::Pair<std::unique_ptr<Simplex>, int> {
+    if (!presolving.tableau) return {nullptr, counts.numLambda};
+    PtrMatrix<int64_t> C{simplex->getConstraints()};
+    ptrdiff_t R = ptrdiff_t(C.numRow()), N = ptrdiff_t(C.numCol()),
+              l = 1 + counts.numLambda;
+    llvm::SmallVector<bool> keepRow(R, true), keepCol(N, true);
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (ptrdiff_t r = 0; r < R; ++r) {
+        if (!keepRow[r] || C[r, 0]) continue;
+        int64_t sign = 0;
+        bool forced = true;
+        for (ptrdiff_t c = 1; forced && c < N; ++c) {
+          if (!keepCol[c] || !C[r, c]) continue;
+          int64_t cs = C[r, c] > 0 ? 1 : -1;
+          forced = (c < l) && (!sign || sign == cs);
+          sign = cs;
+        }
+        if (!forced) continue;
+        for (ptrdiff_t c = 1; c < l; ++c)
+          if (C[r, c]) keepCol[c] = false;
+        keepRow[r] = false;
+        changed = true;
+      }
+    }
+    // inequalities, as `sign(c)*[b, a']`, their multiplier's entry zeroed
+    llvm::SmallVector<containers::Pair<ptrdiff_t, ptrdiff_t>> ineqs;
+    for (ptrdiff_t c = 1; c < l; ++c) {
+      if (!keepCol[c]) continue;
+      ptrdiff_t row = -1, uses = 0;
+      for (ptrdiff_t r = 0; r < R; ++r)
+        if (keepRow[r] && C[r, c] && (uses++ == 0)) row = r;
+      if (uses == 1) ineqs.push_back({row, c});
+    }
+    DenseMatrix<int64_t> ineq{
+      math::DenseDims<>{math::row(ptrdiff_t(ineqs.size())), math::col(N)}, 0};
+    for (ptrdiff_t i = 0; i < ptrdiff_t(ineqs.size()); ++i) {
+      auto [r, m] = ineqs[i];
+      int64_t sign = C[r, m] > 0 ? 1 : -1, g = 0;
+      for (ptrdiff_t c = 0; c < N; ++c) {
+        if (!keepCol[c] || c == m) continue;
+        ineq[i, c] = sign * C[r, c];
+        g = math::gcd(g, ineq[i, c]);
+      }
+      if (g > 1)
+        for (int64_t &x : ineq[i, _]) x /= g;
+    }
+    for (ptrdiff_t i = 0; i < ptrdiff_t(ineqs.size()); ++i) {
+      auto [r, m] = ineqs[i];
+      if (!keepRow[r]) continue;
+      for (ptrdiff_t j = 0; j < ptrdiff_t(ineqs.size()); ++j) {
+        if (i == j || !keepRow[ineqs[j].first] || ineq[j, 0] > ineq[i, 0])
+          continue;
+        bool dominates = true;
+        for (ptrdiff_t c = 1; dominates && c < N; ++c)
+          dominates = ineq[j, c] >= ineq[i, c];
+        if (!dominates) continue;
+        keepRow[r] = false;
+        keepCol[m] = false;
+        break;
+      }
+    }
+    // rows are normalized to have a positive first entry, and coprime entries
+    ptrdiff_t numCol = std::ranges::count(keepCol, true);
+    DenseMatrix<int64_t> rows{
+      math::DenseDims<>{math::row(R), math::col(numCol)}, 0};
+    dict::map<size_t, llvm::SmallVector<ptrdiff_t, 1>> seen;
+    for (ptrdiff_t r = 0; r < R; ++r) {
+      if (!keepRow[r]) continue;
+      MutPtrVector<int64_t> row{rows[r, _]};
+      int64_t g = 0;
+      for (ptrdiff_t c = 0, k = 0; c < N; ++c) {
+        if (!keepCol[c]) continue;
+        row[k++] = C[r, c];
+        g = math::gcd(g, C[r, c]);
+      }
+      int64_t lead = 0;
+      for (int64_t x : row)
+        if ((lead = x)) break;
+      if (lead < 0) g = -g;
+      if (g != 1)
+        for (int64_t &x : row) x /= g;
+      llvm::SmallVector<ptrdiff_t, 1> &bucket =
+        seen[boost::hash_range(row.begin(), row.end())];
+      if (std::ranges::any_of(bucket, [&](ptrdiff_t o) -> bool {
+            return rows[o, _] == row;
+          }))
+        keepRow[r] = false;
+      else bucket.push_back(r);
+    }
+    ptrdiff_t numRow = std::ranges::count(keepRow, true);
+    presolveReports.push_back({R, N - 1, numRow, numCol - 1});
+    int numLambda = int(std::count(keepCol.begin() + 1, keepCol.begin() + l,
+                                   true));
+    if (numRow == R && numCol == N) return {nullptr, numLambda};
+    auto presolved = Simplex::create(math::row(numRow), math::col(numCol - 1));
+    MutPtrMatrix<int64_t> P{presolved->getConstraints()};
+    for (ptrdiff_t r = 0, k = 0; r < R; ++r)
+      if (keepRow[r]) P[k++, _] << rows[r, _];
+    return {std::move(presolved), numLambda};
   }
   void setSchedulesIndependent(ScheduledNode *nodes, int depth0) {
     // IntMatrix A, N;
@@ -881,15 +1271,40 @@ private:
     // we don't create long lasting allocations
     auto scope = allocator.scope();
     auto old = stashFit(nodes);
-    if (Result depSat =
-          solveGraph(nodes, depth0, true, calcCoefs(deps, nodes, depth0)))
+    if (Result depSat = solveGraph(nodes, depth0, true))
       if (Result depSatN = optimize(nodes, depth0 + 1, maxDepth))
         return depSat & depSatN;
     popStash(old);
     return Result::dependent();
   }
+  /// The `Footprint` of `nodes` per iteration of loop `d`.
+  static auto footprint(ScheduledNode *nodes, int d) -> Footprint {
+    Footprint f{};
+    for (ScheduledNode *node : nodes->getVertices()) {
+      poly::Loop *L = node->getLoopNest();
+      double iters = 1;
+      for (ptrdiff_t l = d + 2; l <= node->getNumLoops(); ++l)
+        iters *= L->tripCount(l).second;
+      for (const Addr *a : node->localAddr()) {
+        double bytes =
+          iters * std::max<int64_t>(1, a->getType()->getScalarSizeInBits() / 8);
+        f.bytes += bytes;
+        f.arrays[a->getArrayPointer()] += bytes;
+        ++f.streams;
+      }
+    }
+    return f;
+  }
+  /// Whether fusing `n0` and `n1` at depth `d` is expected to pay off; see
+  /// `FusionModel::profitable`.
+  [[nodiscard]] auto profitableFusion(ScheduledNode *n0, ScheduledNode *n1,
+                                      int d) const -> bool {
+    if (!fusion.l1Bytes) return true;
+    return fusion.profitable(footprint(n0, d), footprint(n1, d));
+  }
   // NOLINTNEXTLINE(misc-no-recursion)
   auto tryFuse(ScheduledNode *n0, ScheduledNode *n1, int depth0) -> Result {
+    if (!profitableFusion(n0, n1, depth0)) return Result::failure();
     auto s = allocator.scope();
     auto old0 = stashFit(n0); // FIXME: stash dep sat level
     auto old1 = stashFit(n1); // FIXME: stash dep sat level
@@ -928,7 +1343,7 @@ private:
   }
   auto solveSplitGraph(ScheduledNode *nodes, int depth) -> Result {
     Result sat = satisfySplitEdges(nodes, depth);
-    Result opt = solveGraph(nodes, depth, false, calcCoefs(deps, nodes, depth));
+    Result opt = solveGraph(nodes, depth, false);
     if (!opt) return opt;
     return opt & sat;
   }
@@ -944,10 +1359,8 @@ private:
     // We split all of them, solve independently,
     // and then try to fuse again after if/where optimal schedules
     // allow it.
-    Result res{Result::Independent};
-    for (auto *g : components->getComponents())
-      if (Result sat = solveSplitGraph(g, d)) res &= sat;
-      else return Result::failure();
+    Result res = solveComponents(components, d);
+    if (!res) return res;
     // We find we can successfully solve by splitting all legal splits.
     // Next, we want to try and re-fuse as many as we can.
     // We could try and implement a better algorithm in the future, but for now
@@ -972,6 +1385,78 @@ private:
       v->getFusionOmega(d) = unfusedOffset;
     return res;
   }
+  /// Solves each of the `components` at depth `d`.
+  /// With a `pool`, the edges between components are satisfied first, so
+  /// that they share no active edges, and are solved as concurrent tasks.
+  /// Each task uses a `LoopBlock` with its own arena, no pool, and an equal
+  /// share of the remaining LP budget; their results are merged in component
+  /// order, so they do not depend on scheduling.
+  auto solveComponents(ScheduledNode *components, int d) -> Result {
+    Result res{Result::Independent};
+    if (!pool) {
+      for (auto *g : components->getComponents())
+        if (Result sat = solveSplitGraph(g, d)) res &= sat;
+        else return Result::failure();
+      return res;
+    }
+    // components are topologically sorted, so satisfying all split edges
+    // before solving is equivalent to doing so as we go
+    llvm::SmallVector<ScheduledNode *> comps;
+    for (auto *g : components->getComponents()) {
+      comps.push_back(g);
+      res &= satisfySplitEdges(g, d);
+    }
+    // tasks write the sat levels of their component's edges to the shared
+    // `deps`, so each active edge must lie within a single component
+    dict::map<const ScheduledNode *, size_t> owner;
+    for (size_t i = 0; i < comps.size(); ++i)
+      for (ScheduledNode *node : comps[i]->getVertices())
+        invariant(owner.emplace(node, i).second);
+    for (size_t i = 0; i < comps.size(); ++i) {
+      for (ScheduledNode *node : comps[i]->getVertices()) {
+        for (Dependence edge : node->outputEdges(deps, d)) {
+          auto it = owner.find(edge.output()->getNode());
+          invariant(it != owner.end() && it->second == i);
+        }
+      }
+    }
+    struct Solved {
+      Result result{};
+      ptrdiff_t lpWork{0};
+      ScheduleBudget::Cut cut{ScheduleBudget::None};
+      llvm::SmallVector<PresolveReport> reports;
+    };
+    llvm::SmallVector<Solved> solved(comps.size());
+    // the remaining LP budget is split evenly, so that the tasks together
+    // stay within it, and whether one is cut does not depend on scheduling
+    ScheduleBudget subBudget{};
+    if (budget.lpWork)
+      subBudget.lpWork = std::max<ptrdiff_t>(
+        (budget.lpWork - lpWork) / ptrdiff_t(comps.size()), 1);
+    llvm::ThreadPoolTaskGroup tasks{*pool};
+    for (size_t i = 0; i < comps.size(); ++i) {
+      tasks.async([&, i] {
+        alloc::OwningArena<> arena;
+        LoopBlock sub{deps,      arena,   subBudget, localityObjective,
+                      tileBands, nullptr, fusion,    presolving};
+        Solved &out = solved[i];
+        out.result = sub.solveGraph(comps[i], d, false);
+        out.lpWork = sub.lpWork;
+        out.cut = sub.cut;
+        out.reports = std::move(sub.presolveReports);
+      });
+    }
+    tasks.wait();
+    for (Solved &out : solved) {
+      lpWork += out.lpWork;
+      if (out.cut != ScheduleBudget::None) cut = out.cut;
+      presolveReports.append(out.reports.begin(), out.reports.end());
+      res &= out.result;
+    }
+    if (budget.lpWork && lpWork > budget.lpWork) cut = ScheduleBudget::LPWork;
+    if (cut != ScheduleBudget::None) return Result::failure();
+    return res;
+  }
   /// For now, we instantiate a dense simplex specifying the full problem.
   ///
   /// Eventually, the plan is to generally avoid instantiating the
@@ -991,22 +1476,23 @@ private:
                               bool satisfyDeps,
                               CoefCounts counts) -> std::unique_ptr<Simplex> {
     auto [numOmegaCoefs, numPhiCoefs, numSlack, numLambda, numBounding,
-          numConstraints, numActiveEdges] = counts;
-    auto omniSimplex =
-      Simplex::create(math::row(numConstraints + numSlack),
-                      math::col(numBounding + numActiveEdges + numPhiCoefs +
-                                numOmegaCoefs + numSlack + numLambda));
+          numConstraints, numActiveEdges, numObjective] = counts;
+    auto omniSimplex = Simplex::create(
+      math::row(numConstraints + numObjective + numSlack),
+      math::col(numBounding + numActiveEdges + numPhiCoefs + numObjective +
+                numOmegaCoefs + numSlack + numLambda));
     auto C{omniSimplex->getConstraints()};
     C << 0;
     // layout of omniSimplex:
     // Order: C, then rev-priority to minimize
-    // C, lambdas, slack, omegas, Phis, w, u
+    // C, lambdas, slack, omegas, Phis, z, w, u
     // rows give constraints; each edge gets its own
     // numBounding = num u
     // numActiveEdges = num w
+    // z is the locality objective, if `numObjective`
     ptrdiff_t c = 0;
     ptrdiff_t l = 1, o = 1 + numLambda + numSlack, p = o + numOmegaCoefs,
-              w = p + numPhiCoefs, u = w + numActiveEdges;
+              w = p + numPhiCoefs + numObjective, u = w + numActiveEdges;
     for (ScheduledNode *inNode : nodes->getVertices()) {
       for (Dependence edge : inNode->outputEdges(deps, depth0)) {
         ScheduledNode *outNode = edge.output()->getNode();
@@ -1123,9 +1609,41 @@ private:
     }
     invariant(size_t(l), size_t(1 + numLambda));
     invariant(size_t(c), size_t(numConstraints));
+    if (numObjective) addLocalityObjective(C, nodes, depth0, counts);
     addIndependentSolutionConstraints(omniSimplex.get(), nodes, depth0, counts);
     return omniSimplex;
   }
+  /// Adds the row `z = cost' * phi`, where the cost of a loop of a node is the
+  /// number of bytes its `Addr`s access with stride one along that loop, i.e.
+  /// it indexes their contiguous last dimension with coefficient `1`, and no
+  /// other dimension. Other loops may index the last dimension too.
+  /// `z` is minimized right after the dependence distances, so outer schedule
+  /// rows avoid the stride-one loops, leaving them for inner levels.
+  void addLocalityObjective(MutPtrMatrix<int64_t> C, const ScheduledNode *nodes,
+                            int depth0, CoefCounts counts) {
+    ptrdiff_t r = counts.numConstraints,
+              o = 1 + counts.numSlack + counts.numLambda + counts.numOmegaCoefs;
+    C[r, o + counts.numPhiCoefs] = 1;
+    for (const ScheduledNode *node : nodes->getVertices()) {
+      if (node->phiIsScheduled(depth0) || (!node->hasActiveEdges(deps, depth0)))
+        continue;
+      MutPtrVector<int64_t> cost{C[r, node->getPhiOffsetRange() + o]};
+      for (const Addr *a : node->localAddr()) {
+        DensePtrMatrix<int64_t> inds{a->indexMatrix()};
+        if (!inds.numRow() || !IR::isConstantOneInt(a->getSizes().back()))
+          continue;
+        ptrdiff_t D = ptrdiff_t(inds.numRow()) - 1;
+        int64_t bytes =
+          std::max<int64_t>(1, a->getType()->getScalarSizeInBits() / 8);
+        for (ptrdiff_t j = 0; j < inds.numCol(); ++j) {
+          if (inds[D, j] != 1) continue;
+          bool contig = true;
+          for (ptrdiff_t d = 0; contig && d < D; ++d) contig = !inds[d, j];
+          if (contig) cost[j] -= bytes;
+        }
+      }
+    }
+  }
   static void updateConstraints(MutPtrMatrix<int64_t> C,
                                 const ScheduledNode *node,
                                 PtrMatrix<int64_t> sat, PtrMatrix<int64_t> bnd,
@@ -513,6 +513,20 @@ public:
     rank = r;
   }
   constexpr void unschedulePhi() { rank = 0; }
+  /// Schedules the node as in the original program: identity `phi`, no
+  /// offsets, and the store's fusion omegas for the loops containing it.
+  constexpr void scheduleOriginal() {
+    MutSquarePtrMatrix<int64_t> phi = getPhi();
+    ptrdiff_t nl = getNumLoops();
+    for (ptrdiff_t i = 0; i < nl; ++i)
+      for (ptrdiff_t j = 0; j < nl; ++j) phi[i, j] = (i == j);
+    rank = uint8_t(nl);
+    offsets = nullptr;
+    MutPtrVector<int64_t> fus = getFusionOmega();
+    PtrVector<int64_t> orig = store->getFusionOmega();
+    ptrdiff_t depth = std::min(ptrdiff_t(store->getCurrentDepth()), nl);
+    for (ptrdiff_t i = 0; i <= nl; ++i) fus[i] = i < depth ? orig[i] : 0;
+  }
   [[nodiscard]] constexpr auto getOmegaOffset() const -> ptrdiff_t {
     return omegaOffset;
   }
@@ -113,11 +113,21 @@ inline auto compcosts(Unrolls unrolls,
                       PtrVector<CompCost> compindep) -> double {
   double cc{0.0};
   // FIXME: scale by dependent axes instead
-  // TODO: SIMD ;)
   for (auto [sf, ia] : compindep)
     cc += static_cast<double>(sf) * unrolls.dependentUnrollProduct(ia);
   return cc;
 }
+template <ptrdiff_t W>
+inline auto compcosts(const UnrollBatch<W> &unrolls,
+                      PtrVector<CompCost> compindep) -> std::array<double, W> {
+  std::array<double, W> cc{};
+  for (auto [sf, ia] : compindep) {
+    double f = static_cast<double>(sf);
+    std::array<double, W> p{unrolls.dependentUnrollProduct(ia)};
+    for (ptrdiff_t w = 0; w < W; ++w) cc[w] += f * p[w];
+  }
+  return cc;
+}
 
 // Evaluate the cost for a BB
 struct BBCost {
@@ -184,13 +194,14 @@ struct BBCost {
   // General approach:
   // costs shuold return total cost of a micro-kernel invocation,
   // then we scale by total number of microkenerl calls.
-  [[nodiscard]] auto cost(const Unrolls &unroll, int register_count,
-                          bool can_hoist, ReductionExpansionBounds *reb,
-                          double comp_throughput,
+  //
+  // `tput` is `throughputCost(unroll)`, which may have been evaluated for a
+  // batch of unrolls.
+  [[nodiscard]] auto cost(const Unrolls &unroll, Cost::Cost tput,
+                          int register_count, bool can_hoist,
+                          ReductionExpansionBounds *reb, double comp_throughput,
                           double *phi_cost) const -> Cost::Cost {
-    Cost::Cost c = memcosts(unroll, orth_axes_);
-    c += memcosts(unroll, conv_axes_);
-    c.addCompute(compcosts(unroll, compute_independence_));
+    Cost::Cost c = tput;
     c.setLatency(cost_counts_.latency());
     reb->updateLowerBound(comp_throughput, c.latency_, c.comp_);
     double num_iters = unroll.countIterations();
@@ -247,6 +258,66 @@ struct BBCost {
     }
     return c;
   }
+  /// Memory and compute costs of one micro-kernel invocation.
+  [[nodiscard]] auto throughputCost(const Unrolls &unroll) const
+    -> Cost::Cost {
+    Cost::Cost c = memcosts(unroll, orth_axes_);
+    c += memcosts(unroll, conv_axes_);
+    c.addCompute(compcosts(unroll, compute_independence_));
+    return c;
+  }
+  template <ptrdiff_t W>
+  [[nodiscard]] auto throughputCost(const UnrollBatch<W> &unroll) const
+    -> Cost::CostBatch<W> {
+    Cost::CostBatch<W> c = memcosts(unroll, orth_axes_);
+    c += memcosts(unroll, conv_axes_);
+    c.addCompute(compcosts(unroll, compute_independence_));
+    return c;
+  }
+  /// A lower bound on `cost(...).reduce(corewidth)` across all unroll and
+  /// vectorization choices. `bounds` holds the largest unroll of each loop, so
+  /// that `countIterations() * dependentUnrollProduct(deps)` is the fewest
+  /// times an op depending on `deps` can execute, before dividing by the widest
+  /// vectorization factor `max_vf`. Spills, latency, and reductions cost at
+  /// least `0`, and conv-axis costs may be scaled arbitrarily close to `0`,
+  /// so we leave them out.
+  [[nodiscard]] auto lowerBound(const Unrolls &bounds, double max_vf,
+                                target::CoreWidth corewidth) const -> double {
+    Cost::Cost c{};
+    c.addCompute(compcosts(bounds, compute_independence_));
+    for (auto [mc, orth] : orth_axes_) {
+      double p = bounds.dependentUnrollProduct(orth.dep_);
+      c.addLoad(p * std::min({mc[0].scalar_, mc[0].contig_, mc[0].noncon_}));
+      c.addStow(p * std::min({mc[1].scalar_, mc[1].contig_, mc[1].noncon_}));
+    }
+    c *= bounds.countIterations() / max_vf;
+    return c.reduce(corewidth);
+  }
+  /// Loops whose unroll factors `cost` reads, other than through
+  /// `countIterations` and the product of all unrolls.
+  [[nodiscard]] auto unrollMask() const -> uint32_t {
+    uint32_t m = 0;
+    for (auto mcs : orth_axes_) m |= mcs.orth_.dep_ | mcs.orth_.contig_;
+    for (auto [mcs, inds] : conv_axes_) {
+      m |= mcs.orth_.dep_ | mcs.orth_.contig_;
+      for (ptrdiff_t l = 0; l < ptrdiff_t(inds.numCol()); ++l)
+        for (ptrdiff_t d = 0; d < ptrdiff_t(inds.numRow()); ++d)
+          if (inds[d, l]) m |= uint32_t(1) << l;
+    }
+    for (auto [c, mask] : compute_independence_) m |= mask;
+    for (const auto &r : intrablock_reg_) m |= r.unrollMask();
+    for (auto li : interblock_reg_) m |= li.dep_mask_;
+    return m;
+  }
+  /// How many of the live counts preceding `entry` `cost` reads.
+  [[nodiscard]] auto liveLookback(const u8 *entry) const -> ptrdiff_t {
+    ptrdiff_t lookback = 0;
+    for (auto li : interblock_reg_)
+      for (int j = 0; (j < 2) && ptrdiff_t(li.prev_idxs_[j]); ++j)
+        lookback = std::max(lookback, entry - live_counts_ +
+                                        ptrdiff_t(li.prev_idxs_[j]));
+    return lookback;
+  }
 };
 // Contains loop info and sub-info
 // struct LoopCosts {};
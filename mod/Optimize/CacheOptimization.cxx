@@ -4,6 +4,8 @@ module;
 #pragma once
 #endif
 
+#include <llvm/Support/TimeProfiler.h>
+
 #ifndef USE_MODULE
 #include "Alloc/Arena.cxx"
 #include "Containers/BitSets.cxx"
@@ -2597,6 +2599,7 @@ struct CacheOptimizer {
   auto // NOLINTNEXTLINE(misc-no-recursion)
   cacheOpt(LoopSummary loopinfo, LoopTransform trf, LoopSummaries ls,
            double *phi_costs, DepSummary *ds) -> Pair<Best, DepSummary *> {
+    llvm::TimeTraceScope timer("CacheOptimizer::cacheOpt");
     ds->initRegTileSizes(caches_, loopinfo, trf, ls, cachelinebits_);
     auto opt = cacheOptEntry(loopinfo, trf.reg_factor(), ls, phi_costs, ds, 0);
     Best b = opt.template get<0>();
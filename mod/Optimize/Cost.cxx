@@ -5,7 +5,9 @@ module;
 #endif
 
 #include <algorithm>
+#include <array>
 #include <bit>
+#include <cstddef>
 #include <cstdint>
 
 #ifndef USE_MODULE
@@ -81,6 +83,30 @@ private:
             .latency_ = c.latency_ / d};
   }
 };
+/// The `Cost`s of the `W` candidates of an `UnrollBatch`, as lanes.
+/// Latency is set per candidate, so it is left out.
+template <ptrdiff_t W> struct CostBatch {
+  std::array<double, W> load_{}, stow_{}, comp_{};
+  constexpr auto operator+=(const CostBatch &other) -> CostBatch & {
+    for (ptrdiff_t w = 0; w < W; ++w) {
+      load_[w] += other.load_[w];
+      stow_[w] += other.stow_[w];
+      comp_[w] += other.comp_[w];
+    }
+    return *this;
+  }
+  constexpr void addCompute(const std::array<double, W> &cost) {
+    for (ptrdiff_t w = 0; w < W; ++w) comp_[w] += cost[w];
+  }
+  constexpr void set(ptrdiff_t w, Cost c) {
+    load_[w] = c.load_;
+    stow_[w] = c.stow_;
+    comp_[w] = c.comp_;
+  }
+  constexpr auto operator[](ptrdiff_t w) const -> Cost {
+    return {.load_ = load_[w], .stow_ = stow_[w], .comp_ = comp_[w]};
+  }
+};
 /// Basic idea is that costs are divided by loops they do not depend on
 /// So `indep_axes` is `1` for each axis it does not depend on.
 ///
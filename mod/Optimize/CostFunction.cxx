@@ -8,6 +8,8 @@ module;
 
 #include <llvm/Support/Casting.h>
 #include <llvm/Support/InstructionCost.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/TimeProfiler.h>
 
 #ifndef USE_MODULE
 #include "Alloc/Arena.cxx"
@@ -934,8 +936,23 @@ public:
   struct OptResult {
     double opt_value_;
     PtrVector<LoopTransform> trfs_;
+    /// `true` if `eval_budget` ran out, so some loops were chosen greedily
+    bool greedy_;
+    /// subtree searches reused with `memoize`, see `SubCostFn::Memo`
+    ptrdiff_t memo_hits_{0};
   };
-  auto optimize() -> OptResult {
+  /// `eval_budget` limits the number of basic block cost evaluations; `0`
+  /// means unlimited. `memoize` reuses the search of subtrees across parent
+  /// unrolls, see `SubCostFn::Memo`. Without either, the candidates of the
+  /// outer-most loop are searched as tasks of `pool`, if any, see
+  /// `SubCostFn::optimizeParallel`. `vectorize_2d` lets two loops of a nest
+  /// share the vector lanes. `lower_bounds` prunes with lower bounds on the
+  /// cost of the rest of each subtree; as they are admissible, this only
+  /// saves evaluations.
+  auto optimize(ptrdiff_t eval_budget = 0, bool memoize = false,
+                llvm::ThreadPool *pool = nullptr, bool vectorize_2d = false,
+                bool lower_bounds = true) -> OptResult {
+    llvm::TimeTraceScope timer("LoopTreeCostFn::optimize");
     ptrdiff_t len = size();
     MutPtrVector<LoopTransform> trfs{math::vector<LoopTransform>(alloc_, len)};
     auto s = alloc_->scope();
@@ -947,13 +964,25 @@ public:
                  .cachelinebits_ = cacheline_bits_,
                  .register_count_ = int(register_count_),
                  .l2maxvf_ = std::countr_zero(unsigned(max_vector_width_)),
-                 .max_depth_ = int(max_depth_)};
+                 .vectorize_2d_ = vectorize_2d,
+                 .lower_bounds_ = lower_bounds,
+                 .max_depth_ = int(max_depth_),
+                 .eval_budget_ = eval_budget};
     SubCostFn::OptResult state{
       .loop_summaries_ = {.loop_summaries_ = loop_summaries_, .trfs_ = trfs},
       .bb_costs_ = bbcosts(),
       .best_cost_ = std::numeric_limits<double>::max(),
       .phi_costs_ = alloc_->template allocate<double>(len)};
-    return {.opt_value_ = fn.optimize(state).best_cost_, .trfs_ = trfs};
+    fn.initSubtrees(state);
+    SubCostFn::Memo memo{};
+    if (memoize) fn.memo_ = &memo;
+    double opt_value = (pool && !eval_budget && !memoize)
+                         ? fn.optimizeParallel(state, *pool).best_cost_
+                         : fn.optimize(state).best_cost_;
+    return {.opt_value_ = opt_value,
+            .trfs_ = trfs,
+            .greedy_ = fn.overBudget(),
+            .memo_hits_ = memo.hits_};
   }
   // There is a valid question over costs to apply, and the degree we
   // should be willing to spill registers.
@@ -20,6 +20,7 @@ module;
 #include <llvm/IR/Type.h>
 #include <llvm/Support/Allocator.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/raw_ostream.h>
 
 #ifndef USE_MODULE
@@ -177,28 +178,77 @@ namespace CostModeling {
 // Subsetting the `k` and `l` iteration spaces may be a little annoying,
 // so we may initially want to restrict ourselves to peeling the innermost loop.
 ///
-/// Optimize the schedule
-template <bool TTI>
-inline auto optimize(Arena<> salloc, IR::Dependencies &deps, IR::Cache &instr,
-                     dict::set<llvm::BasicBlock *> &loopBBs,
-                     dict::set<llvm::CallBase *> &eraseCandidates,
-                     lp::LoopBlock::OptimizationResult res,
-                     target::Machine<TTI> target)
-  -> Tuple<IR::Loop *, double, math::PtrVector<LoopTransform>> {
+/// Build the `IR::Loop` tree for the schedule.
+/// This rewrites `instr` and `deps`, so calls must be serialized.
+/// The tree is allocated by `instr`; `salloc` is only used for scratch.
+inline auto buildLoopTree(Arena<> salloc, IR::Dependencies &deps,
+                          IR::Cache &instr,
+                          dict::set<llvm::BasicBlock *> &loopBBs,
+                          dict::set<llvm::CallBase *> &eraseCandidates,
+                          lp::LoopBlock::OptimizationResult res)
+  -> Tuple<IR::Loop *, int> {
   // we must build the IR::Loop
   // Initially, to help, we use a nested vector, so that we can index into it
   // using the fusion omegas. We allocate it with the longer lived `instr`
   // alloc, so we can checkpoint it here, and use alloc for other IR nodes.
   // The `instr` allocator is more generally the longer lived allocator,
   // as it allocates the actual nodes; only here do we use it as short lived.
-
   auto [root, loopDeps, loop_count] =
     IROptimizer::optimize(salloc, deps, instr, loopBBs, eraseCandidates, res);
+  return {root, loop_count};
+}
 
-  Hard::LoopTreeCostFn fn(&salloc, root, target, loop_count);
-
-  auto [opt, trfs] = fn.optimize();
+/// Search for the best `LoopTransform`s with a cost function built from a
+/// tree by `buildLoopTree`.
+/// Constructing `fn` queries the target and creates `llvm::Type`s in the
+/// function's `LLVMContext`, so it must be serialized; the search itself only
+/// reads `fn`, and allocates from `fn`'s arena, so distinct cost functions may
+/// be searched concurrently, given one arena per cost function.
+/// The returned transforms are allocated from that arena.
+/// If more than `eval_budget` cost evaluations are needed (`0` is unlimited),
+/// the search turns greedy, which is reported by the returned `bool`.
+/// `memoize` reuses the search of each subtree across the unrolls of the
+/// loops containing it, where they do not affect it.
+/// Without a budget or `memoize`, the search of the outer-most loop is split
+/// into tasks of `pool`, if any, each with its own arena, with the same
+/// result.
+/// `vectorize_2d` also considers vectorizing two loops of the nest at once.
+inline auto optimizeTransforms(Hard::LoopTreeCostFn &fn,
+                               ptrdiff_t eval_budget = 0, bool memoize = false,
+                               llvm::ThreadPool *pool = nullptr,
+                               bool vectorize_2d = false,
+                               bool lower_bounds = true)
+  -> Tuple<double, math::PtrVector<LoopTransform>, bool> {
+  Hard::LoopTreeCostFn::OptResult res =
+    fn.optimize(eval_budget, memoize, pool, vectorize_2d, lower_bounds);
+  return {res.opt_value_, res.trfs_, res.greedy_};
+}
+template <bool TTI>
+inline auto optimizeTransforms(Arena<> *alloc, IR::Loop *root, int loop_count,
+                               target::Machine<TTI> target,
+                               ptrdiff_t eval_budget = 0, bool memoize = false,
+                               llvm::ThreadPool *pool = nullptr,
+                               bool vectorize_2d = false,
+                               bool lower_bounds = true)
+  -> Tuple<double, math::PtrVector<LoopTransform>, bool> {
+  Hard::LoopTreeCostFn fn(alloc, root, target, loop_count);
+  return optimizeTransforms(fn, eval_budget, memoize, pool, vectorize_2d,
+                            lower_bounds);
+}
 
+///
+/// Optimize the schedule
+template <bool TTI>
+inline auto optimize(Arena<> salloc, IR::Dependencies &deps, IR::Cache &instr,
+                     dict::set<llvm::BasicBlock *> &loopBBs,
+                     dict::set<llvm::CallBase *> &eraseCandidates,
+                     lp::LoopBlock::OptimizationResult res,
+                     target::Machine<TTI> target)
+  -> Tuple<IR::Loop *, double, math::PtrVector<LoopTransform>> {
+  auto [root, loop_count] =
+    buildLoopTree(salloc, deps, instr, loopBBs, eraseCandidates, res);
+  auto [opt, trfs, greedy] =
+    optimizeTransforms(&salloc, root, loop_count, target);
   return {root, opt, trfs};
 }
 
@@ -16,7 +16,9 @@ module;
 #include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <ranges>
+#include <utility>
 
 #ifndef USE_MODULE
 #include "Alloc/Arena.cxx"
@@ -39,6 +41,7 @@ module;
 #include "Optimize/Legality.cxx"
 #include "Polyhedra/Dependence.cxx"
 #include "Polyhedra/Loops.cxx"
+#include "Polyhedra/Schedule.cxx"
 #include "Support/Iterators.cxx"
 #include "Utilities/Invariant.cxx"
 #include "Utilities/Optional.cxx"
@@ -827,10 +830,17 @@ struct LoopDepSatisfaction {
       if (!updateLegality(&l, L, did)) break;
     return l;
   }
-  inline void setLoopLegality(IR::Loop *L) {
+  /// Sets `L`'s legality; outer loops must be set first, as `tileable_`
+  /// depends on the band of the outer loop.
+  inline void setLoopLegality(Arena<> alloc, IR::Loop *L) {
     CostModeling::Legality legal;
     for (int32_t did : dependencyIDs(L))
       if (!updateLegality(&legal, L, did)) break;
+    bool carries = std::ranges::any_of(
+      dependencyIDs(L),
+      [&](int32_t did) -> bool { return deps_[did].preventsReordering(); });
+    legal.parallel_ = !carries;
+    legal.tileable_ = permutableWithOuter(alloc, L);
     // check following BB for Phi
     for (auto *P = llvm::dyn_cast_or_null<IR::Phi>(L->getNext()); P;
          P = llvm::dyn_cast_or_null<IR::Phi>(P->getNext())) {
@@ -840,11 +850,37 @@ struct LoopDepSatisfaction {
         // deps.determinePeelDepth ?
         legal.reorderable_ = false;
       } else ++legal.unordered_reduction_count_;
+      legal.parallel_ = false;
     }
+    legal.parallel_reductions_ = !carries &&
+                                 legal.unordered_reduction_count_ &&
+                                 !legal.ordered_reduction_count_;
     L->setLegality(legal);
   }
 
 private:
+  /// `L` extends the tileable band of its outer loop if it is perfectly nested
+  /// within it, and each dependence carried by a loop of that band has a
+  /// non-negative distance along `L`, as Pluto requires of a band.
+  auto permutableWithOuter(Arena<> alloc, IR::Loop *L) -> bool {
+    IR::Loop *O = L->getOuterLoop();
+    if (!O || !O->getCurrentDepth() || O->getChild() != L || L->getNext())
+      return false;
+    ptrdiff_t d = L->getCurrentDepth() - 1;
+    for (IR::Loop *B = O; B; B = B->getOuterLoop()) {
+      for (int32_t did : dependencyIDs(B)) {
+        Dependence dep{deps_[did]};
+        if (!dep.preventsReordering()) continue;
+        IR::Addr *in = dep.input(), *out = dep.output();
+        if (!dep.isForward()) std::swap(in, out);
+        poly::AffineSchedule sx{in->getNode()->getSchedule()},
+          sy{out->getNode()->getSchedule()};
+        if (!dep.isSatisfied(alloc, &sx, &sy, d)) return false;
+      }
+      if (!B->getLegality().tileable_) break;
+    }
+    return true;
+  }
   auto updateLegality(Legality *l, IR::Loop *L, int32_t did) -> bool {
     // we're assuming we break and stop updating once !reorderable
     utils::invariant(l->reorderable_);
@@ -1159,11 +1195,25 @@ class IROptimizer {
   // NOLINTNEXTLINE(misc-no-recursion)
   auto setLegality_(IR::Loop *L) -> int {
     dropDroppedDependencies(L);
-    getLoopDeps().setLoopLegality(L);
+    getLoopDeps().setLoopLegality(*lalloc_, L);
     int cnt = 1;
     for (IR::Loop *SL : L->subLoops()) cnt += setLegality_(SL);
     return cnt;
   }
+  /// Used when dependencies were never checked: keeps every loop in its
+  /// original order, and serial.
+  // NOLINTNEXTLINE(misc-no-recursion)
+  static void forbidReordering(IR::Loop *L) {
+    for (IR::Loop *SL : L->subLoops()) {
+      Legality legal = SL->getLegality();
+      legal.reorderable_ = false;
+      legal.parallel_ = false;
+      legal.tileable_ = false;
+      legal.parallel_reductions_ = false;
+      SL->setLegality(legal);
+      forbidReordering(SL);
+    }
+  }
   auto setLegality(IR::Loop *root) -> int {
     int cnt = 0;
     for (IR::Loop *L : root->subLoops()) cnt += setLegality_(L);
@@ -1185,9 +1235,11 @@ class IROptimizer {
       erase_candidates_{erase_candidates}, root_{root}, loop_deps_{loopDeps_},
       lalloc_{lalloc} {
     res.addr = pruneAddr(res.addr);
-    eliminateTemporaries(res.addr); // returns numAddr
+    // without dependencies, we cannot tell which stores are read again
+    if (res.depsChecked) eliminateTemporaries(res.addr); // returns numAddr
     setTopIdx(root_, {0, 0});
     loop_count_ = setLegality(root);
+    if (!res.depsChecked) forbidReordering(root);
     /// TODO: legality check
     // plan now is to have a `BitArray` big enough to hold `numLoops` entries
     // and `numAddr` rows; final axis is contiguous vs non-contiguous
@@ -1202,6 +1254,7 @@ public:
                        dict::set<llvm::CallBase *> &eraseCandidates,
                        lp::LoopBlock::OptimizationResult res)
     -> containers::Tuple<IR::Loop *, LoopDepSatisfaction, int> {
+    llvm::TimeTraceScope timer("IROptimizer::optimize");
     auto [root, loopDeps] = LoopTree::buildGraph(salloc, inst, deps, res.nodes);
     IROptimizer opt(deps, inst, loopBBs, eraseCandidates, root, loopDeps,
                     &salloc, res);
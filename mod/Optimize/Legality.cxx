@@ -119,6 +119,15 @@ struct Legality {
   uint32_t ordered_reduction_count_ : 16 {0};
   uint32_t unordered_reduction_count_ : 16 {0};
   uint32_t reorderable_ : 1 {true};
+  /// The loop carries no dependence, so its iterations may run in parallel.
+  uint32_t parallel_ : 1 {false};
+  /// The loop is perfectly nested in its outer loop, and fully permutable with
+  /// it, i.e. the two belong to the same tileable band.
+  uint32_t tileable_ : 1 {false};
+  /// The loop carries no dependence other than through its reductions, all of
+  /// which are reassociable; its iterations may run in parallel if each thread
+  /// reduces into a private copy.
+  uint32_t parallel_reductions_ : 1 {false};
   // uint8_t illegalFlag{0};
 
   // [[nodiscard]] constexpr auto minDistance() const -> uint16_t {
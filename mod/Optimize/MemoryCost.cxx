@@ -73,15 +73,69 @@ struct MemCostSummary {
   //   }
 };
 
-// costs is an array of length two.
-// memory costs, unnormalized by `prod(unrolls)`
-// `invunrolls` is a matrix, row-0 are the inverse unrolls, row-1 unrolls.
+/// Cost of `mcs`, `c` times per micro-kernel, when two loops share the
+/// vector lanes, and it depends on at least one of them. A vector holds `vo`
+/// groups of `vi` lanes, for the outer and inner loop respectively. Per
+/// vector, if it depends on
+/// - both, and is contiguous along the inner, we load or store `vo` vectors
+///   of `vi` lanes, which `vo - 1` shuffles join or split;
+/// - both, and is contiguous along the outer, we transpose `vi` vectors of
+///   `vo` lanes, taking `vi * log2(vi)` shuffles;
+/// - one of them, along which it is contiguous, we load its lanes, and a
+///   shuffle replicates them across the other's.
+/// As for one vectorized loop, shuffles cost as much as contiguous loads or
+/// stores, and we use a gather or scatter instead where that is cheaper, or
+/// where there is no such contiguous axis. Packing is not considered.
+constexpr auto cost2D(double c, MemCostSummary mcs,
+                      VectorizationFactor vf) -> Cost {
+  auto [mc, orth] = mcs;
+  uint32_t outer = vf.outerMask(), inner = vf.innerMask(),
+           l2vi = vf.l2factor_ - vf.l2outer_;
+  double lc = mc[0].contig_, sc = mc[1].contig_, ld = mc[0].noncon_,
+         sd = mc[1].noncon_,
+         vo = static_cast<double>(uint32_t(1) << vf.l2outer_),
+         vi = static_cast<double>(uint32_t(1) << l2vi), parts{1.0},
+         shuf_count{1.0};
+  if ((orth.dep_ & outer) && (orth.dep_ & inner)) {
+    if (orth.contig_ & inner) {
+      parts = vo;
+      shuf_count = vo - 1.0;
+    } else if (orth.contig_ & outer) {
+      parts = vi;
+      shuf_count = vi * l2vi;
+    } else return {.load_ = ld * c, .stow_ = sd * c};
+  } else if (!(orth.contig_ & orth.dep_ & vf.index_mask_))
+    return {.load_ = ld * c, .stow_ = sd * c};
+  double lcf = lc * (parts + shuf_count), scf = sc * (parts + shuf_count);
+  bool prefer_shuf_over_gather = lcf < ld, prefer_shuf_over_scatter = scf < sd;
+  double comp_cost = 0.0;
+  if (prefer_shuf_over_gather) comp_cost += shuf_count * lc;
+  if (prefer_shuf_over_scatter) comp_cost += shuf_count * sc;
+  return {.load_ = (prefer_shuf_over_gather ? lc * parts : ld) * c,
+          .stow_ = (prefer_shuf_over_scatter ? sc * parts : sd) * c,
+          .comp_ = comp_cost * c};
+}
+
+/// Whether `cost` weighs shuffles, gathers and packing for `mcs`, i.e. it
+/// depends on the one vectorized loop, but is contiguous along another.
+constexpr auto shuffles(MemCostSummary mcs, VectorizationFactor vf) -> bool {
+  IR::OrthogonalAxes orth = mcs.orth_;
+  return !vf.twoDimensional() && (orth.dep_ & vf.index_mask_) &&
+         !(orth.contig_ & vf.index_mask_) && orth.contig_;
+}
+
+/// Cost of `mcs` for one unroll candidate, `c` times per micro-kernel.
+/// `umi` and `indep_iters` are only used if `shuffles(mcs, vf)`: `umi` is the
+/// unroll of the first contiguous loop, and `indep_iters` the iterations of
+/// the loops `mcs` does not depend on, or `0.0` if it depends on all of them,
+/// so that packing is not considered.
 // TODO: add alignment to `MemCostSummary`
-constexpr auto cost(Unrolls unrolls, MemCostSummary mcs) -> Cost {
+constexpr auto laneCost(MemCostSummary mcs, VectorizationFactor vf, double c,
+                        Unrolls::T umi, double indep_iters) -> Cost {
   auto [mc, orth] = mcs;
-  double c{unrolls.dependentUnrollProduct(orth.dep_)};
   double l{1.0}, s{1.0};
-  VectorizationFactor vf = unrolls.vf_;
+  if (vf.twoDimensional() && (orth.dep_ & vf.index_mask_))
+    return cost2D(c, mcs, vf);
   if (orth.dep_ & vf.index_mask_) {
     // depends on vectorized index
     if (vf.index_mask_ & orth.contig_) {
@@ -158,13 +212,11 @@ constexpr auto cost(Unrolls unrolls, MemCostSummary mcs) -> Cost {
       // We have
       // max(u, v) memory ops
       // u*log2(v) shuffle ops
-      ptrdiff_t first_contig = std::countr_zero(orth.contig_);
-      auto umi{unrolls.unrolls()[first_contig]};
       double u{umi};
       // Currently using contig for load/store costs...
       // Without the need for shuffles, this should be >= discontig
       // TODO: double check for for `u` not being a power of 2
-      double ufactor = std::max(u, static_cast<double>(unrolls.vf_));
+      double ufactor = std::max(u, static_cast<double>(vf));
       double lc = mc[0].contig_, sc = mc[1].contig_, ld = mc[0].noncon_,
              sd = mc[1].noncon_, lcf = lc * ufactor, scf = sc * ufactor,
              shuf_count = u * vf.l2factor_, shuf_ratio = c / umi;
@@ -181,13 +233,12 @@ constexpr auto cost(Unrolls unrolls, MemCostSummary mcs) -> Cost {
                 .comp_ = comp_cost * shuf_ratio};
       // Whether we shuffle load/store or use gather/scatter are still relevant
       // for packing/unpacking
-      if (std::popcount(orth.dep_) < unrolls.getDepth1()) {
+      if (indep_iters != 0.0) {
         // for load cost, we need to do shuf or gather loads
         // and contiguous stores, ignoring any independent loops
         // We can ignore the independent loops being vectorized,
         // because we do know a dependent loop is vectorized (given that we are
         // here, which required `orth.dep_ & vf.index_mask_`).
-        double indep_iters = unrolls.independentLoopIters(orth.dep_);
         // `sgsc` is loading from/storing to original array when transfering
         // between orig & pack. We add storing to/loading from packed array when
         // transfering between orig & pack.
@@ -220,6 +271,22 @@ constexpr auto cost(Unrolls unrolls, MemCostSummary mcs) -> Cost {
   return {.load_ = lc, .stow_ = sc};
 }
 
+// costs is an array of length two.
+// memory costs, unnormalized by `prod(unrolls)`
+// `invunrolls` is a matrix, row-0 are the inverse unrolls, row-1 unrolls.
+constexpr auto cost(Unrolls unrolls, MemCostSummary mcs) -> Cost {
+  IR::OrthogonalAxes orth = mcs.orth_;
+  Unrolls::T umi{1.0};
+  double indep_iters{0.0};
+  if (shuffles(mcs, unrolls.vf_)) {
+    umi = unrolls.unrolls()[std::countr_zero(orth.contig_)];
+    if (std::popcount(orth.dep_) < unrolls.getDepth1())
+      indep_iters = unrolls.independentLoopIters(orth.dep_);
+  }
+  return laneCost(mcs, unrolls.vf_, unrolls.dependentUnrollProduct(orth.dep_),
+                  umi, indep_iters);
+}
+
 /// General fallback method for those without easy to represent structure
 /// inds is an `IR::Address->indexMatrix()`, thus it is `arrayDim() x
 /// getNumLoops()`
@@ -239,7 +306,7 @@ constexpr auto cost(Unrolls unrolls, MemCostSummary orth,
     containers::BitSet64 bs;
     double uprod;
     for (ptrdiff_t l = 0; l < numLoops; ++l) {
-      if ((uint32_t(1) << l) == unrolls.vf_.index_mask_) continue;
+      if ((uint32_t(1) << l) & unrolls.vf_.index_mask_) continue;
       int64_t a = inds[d, l];
       if (!a) continue;
       bool docontinue{false};
@@ -276,6 +343,127 @@ constexpr auto cost(Unrolls unrolls, MemCostSummary orth,
   return c * cost(unrolls, orth);
 }
 
+/// `cost(unrolls.lane(w), mcs)` for each candidate `w` of `unrolls`.
+/// The lanes share `vf` and `mcs`, so they take the same branch of `laneCost`.
+/// Outside of the shuffle branch it is linear in `c`, so we scale one result.
+/// Within it, the choices between shuffles and gathers, and of packing, are
+/// made per lane: we compute both alternatives for every lane and select, so
+/// that the loops over the lanes have no branches.
+template <ptrdiff_t W>
+constexpr auto cost(const UnrollBatch<W> &unrolls,
+                    MemCostSummary mcs) -> CostBatch<W> {
+  IR::OrthogonalAxes orth = mcs.orth_;
+  VectorizationFactor vf = unrolls.vf();
+  std::array<double, W> c{unrolls.dependentUnrollProduct(orth.dep_)},
+    indep_iters{UnrollBatch<W>::broadcast(0.0)};
+  std::array<Unrolls::T, W> umi;
+  umi.fill(Unrolls::T{1.0});
+  if (shuffles(mcs, vf)) {
+    ptrdiff_t first_contig = std::countr_zero(orth.contig_);
+    if (first_contig == unrolls.getDepth0()) umi = unrolls.current_;
+    else umi.fill(unrolls.unrolls_.unrolls()[first_contig]);
+    if (std::popcount(orth.dep_) < unrolls.getDepth1())
+      indep_iters = unrolls.independentLoopIters(orth.dep_);
+  }
+  CostBatch<W> costs{};
+  if (!shuffles(mcs, vf)) {
+    Cost unit = laneCost(mcs, vf, 1.0, Unrolls::T{1.0}, 0.0);
+    for (ptrdiff_t w = 0; w < W; ++w) {
+      costs.load_[w] = unit.load_ * c[w];
+      costs.stow_[w] = unit.stow_ * c[w];
+      costs.comp_[w] = unit.comp_ * c[w];
+    }
+    return costs;
+  }
+  // The shuffle branch of `laneCost`; see there for the reasoning.
+  const std::array<IR::Addr::Costs, 2> &mc = mcs.loadstowcost_;
+  double lc = mc[0].contig_, sc = mc[1].contig_, ld = mc[0].noncon_,
+         sd = mc[1].noncon_, v = static_cast<double>(vf),
+         l2v = static_cast<double>(vf.l2factor_);
+  for (ptrdiff_t w = 0; w < W; ++w) {
+    double u{umi[w]}, ufactor = std::max(u, v), lcf = lc * ufactor,
+                      scf = sc * ufactor, shuf_count = u * l2v,
+                      shuf_ratio = c[w] / umi[w];
+    bool shuf_load = (lcf + shuf_count * lc) < ld * u,
+         shuf_stow = (scf + shuf_count * sc) < sd * u;
+    double load = shuf_load ? lcf * shuf_ratio : ld * c[w],
+           stow = shuf_stow ? scf * shuf_ratio : sd * c[w],
+           comp = ((shuf_load ? shuf_count * lc : 0.0) +
+                   (shuf_stow ? shuf_count * sc : 0.0)) *
+                  shuf_ratio;
+    // packing, where `indep_iters[w] != 0.0`
+    double l = lc * c[w], s = sc * c[w], ii = indep_iters[w],
+           div = ii != 0.0 ? ii : 1.0, pack_load = (load + s) / div + l,
+           pack_stow = (stow + l) / div + s, pack_comp = comp / div;
+    bool pack = (ii != 0.0) &&
+                (pack_load + pack_stow + pack_comp < load + stow + comp);
+    costs.load_[w] = pack ? pack_load : load;
+    costs.stow_[w] = pack ? pack_stow : stow;
+    costs.comp_[w] = pack ? pack_comp : comp;
+  }
+  return costs;
+}
+
+/// `cost(unrolls.lane(w), orth, inds)` for each candidate `w` of `unrolls`.
+/// The loops counted for each array dimension do not depend on the unrolls,
+/// only their products do.
+template <ptrdiff_t W>
+constexpr auto cost(const UnrollBatch<W> &unrolls, MemCostSummary orth,
+                    DensePtrMatrix<int64_t> inds) -> CostBatch<W> {
+  std::array<double, W> c{UnrollBatch<W>::broadcast(1.0)};
+  auto [arrayDim, numLoops] = shape(inds);
+  utils::invariant(numLoops > 0);
+  utils::invariant(arrayDim > 0);
+  utils::invariant(arrayDim <= 64);
+  utils::invariant(unrolls.getDepth1() == ptrdiff_t(inds.numCol()));
+  uint32_t vmask = unrolls.vf().index_mask_;
+  for (ptrdiff_t d = 0; d < arrayDim; ++d) {
+    int64_t g = 0;
+    containers::BitSet64 bs;
+    for (ptrdiff_t l = 0; l < numLoops; ++l) {
+      if ((uint32_t(1) << l) & vmask) continue;
+      int64_t a = inds[d, l];
+      if (!a) continue;
+      bool docontinue{false};
+      for (ptrdiff_t k = 0; k < arrayDim; ++k) {
+        if ((k == d) || (!inds[k, l])) continue;
+        docontinue = (inds[d, _] != inds[k, _]) || (d > k);
+        if (docontinue) break;
+      }
+      if (docontinue) continue;
+      g = bs.empty() ? a : math::gcd(g, a);
+      bs.insert(l);
+    }
+    if (bs.size() < 2) continue;
+    // the current loop is inner-most, so multiplying by it last matches the
+    // scalar `uprod`
+    std::array<double, W> uprod{UnrollBatch<W>::broadcast(1.0)};
+    for (ptrdiff_t l : bs) {
+      std::array<double, W> u{unrolls.unroll(l)};
+      for (ptrdiff_t w = 0; w < W; ++w) uprod[w] *= u[w];
+    }
+    std::array<double, W> prod{UnrollBatch<W>::broadcast(1.0)};
+    double dg = static_cast<double>(g);
+    bs &= containers::BitSet64::fromMask(~static_cast<uint64_t>(vmask));
+    for (ptrdiff_t l : bs) {
+      if (int64_t a = inds[d, l]) {
+        double f = static_cast<double>(a) / dg;
+        std::array<double, W> u{unrolls.unroll(l)};
+        for (ptrdiff_t w = 0; w < W; ++w)
+          prod[w] *= (1.0 - f * (u[w] / uprod[w]));
+      }
+    }
+    for (ptrdiff_t w = 0; w < W; ++w) c[w] *= (1.0 - prod[w]);
+  }
+  CostBatch<W> costs{cost(unrolls, orth)};
+  for (ptrdiff_t w = 0; w < W; ++w) {
+    costs.load_[w] *= c[w];
+    costs.stow_[w] *= c[w];
+    costs.comp_[w] *= c[w];
+  }
+  return costs;
+}
+
 inline auto memcosts(Unrolls invunrolls, PtrVector<MemCostSummary> orth_axes)
   -> Cost {
   Cost costs{};
@@ -290,5 +478,21 @@ memcosts(Unrolls unrolls,
   for (auto [mcs, inds] : orth_axes) costs += cost(unrolls, mcs, inds);
   return costs;
 }
+template <ptrdiff_t W>
+inline auto memcosts(const UnrollBatch<W> &unrolls,
+                     PtrVector<MemCostSummary> orth_axes) -> CostBatch<W> {
+  CostBatch<W> costs{};
+  for (auto mcs : orth_axes) costs += cost(unrolls, mcs);
+  return costs;
+}
+template <ptrdiff_t W>
+inline auto
+memcosts(const UnrollBatch<W> &unrolls,
+         PtrVector<Pair<MemCostSummary, DensePtrMatrix<int64_t>>> orth_axes)
+  -> CostBatch<W> {
+  CostBatch<W> costs{};
+  for (auto [mcs, inds] : orth_axes) costs += cost(unrolls, mcs, inds);
+  return costs;
+}
 
 } // namespace CostModeling::Cost
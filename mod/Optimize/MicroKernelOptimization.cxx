@@ -4,8 +4,12 @@ module;
 #pragma once
 #endif
 
+#include <boost/container_hash/hash.hpp>
+#include <llvm/Support/ThreadPool.h>
+
 #ifndef USE_MODULE
 #include "Alloc/Arena.cxx"
+#include "Dicts/Dict.cxx"
 #include "Math/Constructors.cxx"
 #include "Math/ManagedArray.cxx"
 #include "Numbers/Int8.cxx"
@@ -17,10 +21,13 @@ module;
 #include "Optimize/Unrolls.cxx"
 #include "Target/Machine.cxx"
 #include "Utilities/Invariant.cxx"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstddef>
 #include <cstring>
 #include <limits>
+#include <mutex>
 #include <utility>
 #else
 export module CostModeling:MicroKernel;
@@ -41,7 +48,8 @@ import :Cost;
 import :Unroll;
 #endif
 
-using math::Vector, math::MutPtrVector, math::DensePtrMatrix;
+using math::Vector, math::MutPtrVector, math::DensePtrMatrix, math::_,
+  math::end;
 using numbers::u8;
 using utils::invariant;
 #ifdef USE_MODULE
@@ -54,6 +62,10 @@ namespace CostModeling::Hard {
 // not tiling them!), and all loops that don't have any arrays not-dependent
 // upon them (no reuse).
 struct SubCostFn {
+  static constexpr int max_unroll = 16;
+  /// Unrolls of a loop whose throughput costs are evaluated together.
+  static constexpr int unroll_batch = 8;
+  static_assert(max_unroll % unroll_batch == 0);
 
   alloc::Arena<> *alloc_;
   // BBCosts state_;
@@ -65,8 +77,51 @@ struct SubCostFn {
   int cachelinebits_;
   int register_count_;
   int l2maxvf_;
+  /// Lets an inner loop take the lanes an outer loop leaves unused, i.e.
+  /// vectorize two loops at once.
+  bool vectorize_2d_{false};
+  /// Prunes candidates using `BBCost::lowerBound`s on the cost of the rest of
+  /// their subtree. Without, `remaining_lb_` is all zeros, so candidates are
+  /// only pruned once their cost so far reaches the bound.
+  bool lower_bounds_{true};
   int max_depth_{};
   int len_{};
+  /// Once `evals_` reaches `eval_budget_` (if nonzero), each loop settles for
+  /// the first unroll it completes, i.e. we fall back to a greedy search.
+  ptrdiff_t eval_budget_{0};
+  ptrdiff_t evals_{0};
+  /// `remaining_lb_[n]` is a lower bound on the cost of the last `n` BBs.
+  double *remaining_lb_{nullptr};
+  /// The log2 vector widths tried for a loop, widest first, ending in `0`.
+  struct VFOptions {
+    int hi_, n_;
+    constexpr auto operator[](int v) const -> int {
+      return v + 1 == n_ ? 0 : hi_ - v;
+    }
+  };
+  /// A loop not nested in a vectorized one may take any width, though without
+  /// `vectorize_2d_` only the widest is tried. One nested in a loop that left
+  /// lanes unused may take them.
+  [[nodiscard]] constexpr auto vfOptions(LoopSummary loopinfo) const
+    -> VFOptions {
+    if (!loopinfo.reorderable()) return {.hi_ = 0, .n_ = 1};
+    VectorizationFactor vf = unroll_.vf_;
+    if (!vf.index_mask_)
+      return {.hi_ = l2maxvf_,
+              .n_ = !l2maxvf_ ? 1 : (vectorize_2d_ ? l2maxvf_ + 1 : 2)};
+    int rest = l2maxvf_ - int(vf.l2factor_);
+    if (vectorize_2d_ && !vf.twoDimensional() && rest > 0)
+      return {.hi_ = rest, .n_ = 2};
+    return {.hi_ = 0, .n_ = 1};
+  }
+  [[nodiscard]] constexpr auto overBudget() const -> bool {
+    return eval_budget_ && evals_ >= eval_budget_;
+  }
+  /// Lower bound on the cost of the BBs from `from` until `exit_bbs` are left.
+  [[nodiscard]] constexpr auto lowerBound(const BBCosts &from,
+                                          ptrdiff_t exit_bbs) const -> double {
+    return remaining_lb_[from.cost_counts_.size()] - remaining_lb_[exit_bbs];
+  }
 
   // auto operator()(PtrVector<LoopTransform> trfs) -> double { return 0.0; }
   // // implementing recursively, we want to maintain a stack
@@ -78,19 +133,334 @@ struct SubCostFn {
     double best_cost_;
     double *phi_costs_;
   };
+  /// What `optimize` needs to know about a loop's subtree up front.
+  struct Subtree {
+    /// State following the subtree, as `optimize` returns it, except for
+    /// `trfs_` and `phi_costs_`, which depend on the state it is entered with;
+    /// the latter is `phi_offset_` past the entry's.
+    OptResult exit_;
+    ptrdiff_t phi_offset_;
+    /// Outer loops whose unroll factors the subtree's costs read, other than
+    /// through the number of outer iterations.
+    uint32_t unroll_mask_;
+    /// Number of live register counts preceding the subtree's own it reads.
+    ptrdiff_t live_lookback_;
+    [[nodiscard]] constexpr auto exitBBs() const -> ptrdiff_t {
+      return exit_.bb_costs_.cost_counts_.size();
+    }
+  };
+  /// `subtrees_[n]` describes the loop with `n` loops left, counting itself.
+  Subtree *subtrees_{nullptr};
+  /// Memo of subtree searches, enabled by setting `memo_`.
+  /// Given the unrolls and vectorization of the outer loops, a subtree's costs
+  /// are, up to the spill and packing terms, the number of outer iterations
+  /// times a function of the outer unrolls it reads, the outer vectorization,
+  /// and the live register counts preceding it. Keyed on those, a subtree is
+  /// searched once, and its best cost per outer iteration and transforms are
+  /// reused for every other parent unroll and vector width.
+  struct MemoKey {
+    /// `4` bits per outer loop read, holding its unroll factor minus one
+    uint64_t unrolls_;
+    uint64_t live_counts_;
+    uint32_t vf_;
+    uint32_t loop_;
+    constexpr auto operator==(const MemoKey &) const -> bool = default;
+
+  private:
+    [[nodiscard]] friend auto hash_value(const MemoKey &k) noexcept -> size_t {
+      size_t seed = k.unrolls_;
+      boost::hash_combine(seed, k.live_counts_);
+      boost::hash_combine(seed, k.vf_);
+      boost::hash_combine(seed, k.loop_);
+      return seed;
+    }
+  };
+  struct MemoEntry {
+    /// Cost per outer iteration; if not `exact_`, a lower bound, as nothing
+    /// beat the bound the search was given, and the rest are null.
+    double cost_;
+    bool exact_;
+    LoopTransform *trfs_;
+    double *phi_costs_;
+    u8 *live_counts_;
+  };
+  struct Memo {
+    dict::map<MemoKey, MemoEntry> table_{};
+    alloc::OwningArena<> alloc_{};
+    /// number of subtree searches answered from `table_`
+    ptrdiff_t hits_{0};
+  };
+  Memo *memo_{nullptr};
+  /// Held while cache tiling, if set, as it writes to `leafdepsummary_`.
+  std::mutex *cache_mutex_{nullptr};
+  /// Fills `remaining_lb_` and `subtrees_`; must be called before `optimize`.
+  void initSubtrees(OptResult state) {
+    ptrdiff_t nbb = state.bb_costs_.cost_counts_.size(),
+              nloops = state.loop_summaries_.loop_summaries_.size();
+    remaining_lb_ = alloc_->template allocate<double>(nbb + 1);
+    subtrees_ = alloc_->template allocate<Subtree>(nloops + 1);
+    std::fill_n(remaining_lb_, nbb + 1, 0.0);
+    Unrolls bounds{};
+    summarize(state, bounds, 1.0);
+    for (ptrdiff_t n = 1; n <= nbb; ++n)
+      remaining_lb_[n] += remaining_lb_[n - 1];
+  }
+  // Walks the tree in the same order as `optimize`, bounding each BB's cost
+  // and summarizing each subtree.
+  // NOLINTNEXTLINE(misc-no-recursion)
+  auto summarize(OptResult state, Unrolls &bounds, double max_vf)
+    -> OptResult {
+    ptrdiff_t idx = state.loop_summaries_.loop_summaries_.size();
+    OptResult entry = state;
+    auto [loopinfo, loop_summaries] = state.loop_summaries_.popFront();
+    state.loop_summaries_ = loop_summaries;
+    state.phi_costs_ = entry.phi_costs_ + 1;
+    if (loopinfo.reorderable()) max_vf = double(1 << l2maxvf_);
+    bounds.pushUnroll(loopinfo.reorderable() ? max_unroll : 1,
+                      loopinfo.estimatedTripCount(), false);
+    uint32_t mask = 0;
+    ptrdiff_t lookback = 0;
+    u8 *live = entry.bb_costs_.live_counts_;
+    for (ptrdiff_t i = 0, num_sub_loops = loopinfo.numSubLoops();; ++i) {
+      auto [cur_state, next_state] = state.bb_costs_.popFront();
+      remaining_lb_[state.bb_costs_.cost_counts_.size()] =
+        lower_bounds_ ? cur_state.lowerBound(bounds, max_vf, corewidth_) : 0.0;
+      mask |= cur_state.unrollMask();
+      lookback = std::max(lookback, cur_state.liveLookback(live));
+      state.bb_costs_ = next_state;
+      if (i == num_sub_loops) break;
+      const Subtree &sub =
+        subtrees_[state.loop_summaries_.loop_summaries_.size()];
+      u8 *sub_live = state.bb_costs_.live_counts_;
+      state = summarize(state, bounds, max_vf);
+      mask |= sub.unroll_mask_;
+      lookback = std::max(lookback, sub.live_lookback_ - (sub_live - live));
+    }
+    if (ptrdiff_t nreduct = loopinfo.numReductions())
+      for (auto [c, m] : state.bb_costs_.reductions(nreduct)) mask |= m;
+    bounds.popUnroll();
+    subtrees_[idx] = {.exit_ = state,
+                      .phi_offset_ = state.phi_costs_ - entry.phi_costs_,
+                      .unroll_mask_ = mask,
+                      .live_lookback_ = lookback};
+    return state;
+  }
+  [[nodiscard]] auto memoKey(const Subtree &sub, const u8 *live,
+                             ptrdiff_t idx) const -> MemoKey {
+    MemoKey key{.unrolls_ = 0,
+                .live_counts_ = 0,
+                .vf_ = (unroll_.vf_.l2outer_ << 24) |
+                       (unroll_.vf_.l2factor_ << 16) | unroll_.vf_.index_mask_,
+                .loop_ = uint32_t(idx)};
+    for (ptrdiff_t d = 0; d < unroll_.size(); ++d)
+      if (sub.unroll_mask_ & (uint32_t(1) << d))
+        key.unrolls_ |= uint64_t(double(unroll_.unrolls()[d]) - 1) << (4 * d);
+    std::memcpy(&key.live_counts_, live - sub.live_lookback_,
+                sub.live_lookback_);
+    return key;
+  }
+  /// Restores the search of a subtree from `e`, returning `cost`.
+  static auto recall(OptResult entry_state, const Subtree &sub, MemoEntry e,
+                     double cost) -> OptResult {
+    const LoopSummary &ls = entry_state.loop_summaries_.loop_summaries_.front();
+    ptrdiff_t ntrfs = ls.reorderableTreeSize(),
+              nphi = ls.reorderableSubTreeSize() + 1,
+              nlive = sub.exit_.bb_costs_.live_counts_ -
+                      entry_state.bb_costs_.live_counts_;
+    if (e.exact_) {
+      if (ntrfs)
+        std::memcpy(entry_state.loop_summaries_.trfs_.data(), e.trfs_,
+                    ntrfs * sizeof(LoopTransform));
+      std::memcpy(entry_state.phi_costs_, e.phi_costs_, nphi * sizeof(double));
+      if (nlive)
+        std::memcpy(entry_state.bb_costs_.live_counts_, e.live_counts_, nlive);
+    }
+    OptResult ret = sub.exit_;
+    ret.loop_summaries_.trfs_ =
+      entry_state.loop_summaries_.trfs_[_(ntrfs, end)];
+    ret.phi_costs_ = entry_state.phi_costs_ + sub.phi_offset_;
+    ret.best_cost_ = cost;
+    return ret;
+  }
+  void remember(MemoKey key, OptResult entry_state, const Subtree &sub,
+                double cost, bool exact) {
+    MemoEntry &e = memo_->table_[key];
+    e = {.cost_ = cost,
+         .exact_ = exact,
+         .trfs_ = nullptr,
+         .phi_costs_ = nullptr,
+         .live_counts_ = nullptr};
+    if (!exact) return;
+    const LoopSummary &ls = entry_state.loop_summaries_.loop_summaries_.front();
+    ptrdiff_t ntrfs = ls.reorderableTreeSize(),
+              nphi = ls.reorderableSubTreeSize() + 1,
+              nlive = sub.exit_.bb_costs_.live_counts_ -
+                      entry_state.bb_costs_.live_counts_;
+    alloc::Arena<> *alloc = &memo_->alloc_;
+    e.trfs_ = alloc->template allocate<LoopTransform>(ntrfs);
+    e.phi_costs_ = alloc->template allocate<double>(nphi);
+    e.live_counts_ = alloc->template allocate<u8>(nlive);
+    if (ntrfs)
+      std::memcpy(e.trfs_, entry_state.loop_summaries_.trfs_.data(),
+                  ntrfs * sizeof(LoopTransform));
+    std::memcpy(e.phi_costs_, entry_state.phi_costs_, nphi * sizeof(double));
+    if (nlive)
+      std::memcpy(e.live_counts_, entry_state.bb_costs_.live_counts_, nlive);
+  }
+  /// Fills `tput[w * nbb + i]` with the `throughputCost` of the `i`th of the
+  /// `nbb` BBs of the loop entered at `bbs`, under unroll `first + w` and the
+  /// vectorization in `unroll_`, to which the loop must have been pushed.
+  /// Its sub-loops are skipped using `subtrees_`, starting at `sub_idx`.
+  void batchThroughput(Cost::Cost *tput, BBCosts bbs, ptrdiff_t sub_idx,
+                       ptrdiff_t nbb, int first) const {
+    UnrollBatch<unroll_batch> batch{unroll_, first};
+    for (ptrdiff_t i = 0;; ++i) {
+      Cost::CostBatch<unroll_batch> c =
+        bbs.popFront().first.throughputCost(batch);
+      for (ptrdiff_t w = 0; w < unroll_batch; ++w) tput[w * nbb + i] = c[w];
+      if (i + 1 == nbb) return;
+      const Subtree &sub = subtrees_[sub_idx];
+      bbs = sub.exit_.bb_costs_;
+      sub_idx = sub.exit_.loop_summaries_.loop_summaries_.size();
+    }
+  }
+  /// Cost of the subtree of `loopinfo` under the unrolls and vectorization in
+  /// `unroll_`, advancing `state` past it. Unless `complete`, gives up once
+  /// the cost can no longer fall below `bound`, returning infinity.
+  /// If non-null, `tput[i]` is the `throughputCost` of the loop's `i`th BB.
+  // NOLINTNEXTLINE(misc-no-recursion)
+  auto candidateCost(LoopSummary loopinfo, OptResult &state, double *phic,
+                     ptrdiff_t exit_bbs, double bound, bool complete,
+                     const Cost::Cost *tput = nullptr) -> double {
+    // we set at the top of iteration, so that they're incremented by end.
+    // Similarly, `depth1_` field of `Unroll_` object gets incremented and
+    // decremented in `u` loop
+    // `optimize` has the original array-starts as local variables
+    // Lets evaluate by BB, even the costs, instead of aggregating, as
+    // otherwise the register spill costs can't be combined with the
+    // `reduce` as well.
+    double cur_c{0.0};
+    BBCost::ReductionExpansionBounds reduction_expansion{
+      .upper_bound_ = double(unroll_.getUnroll())};
+    for (ptrdiff_t i = 0, num_sub_loops = loopinfo.numSubLoops();; ++i) {
+      // bb cost
+      auto [cur_state, next_state] = state.bb_costs_.popFront();
+      state.bb_costs_ = next_state;
+      ++evals_;
+      Cost::Cost c = cur_state.cost(
+        unroll_, tput ? tput[i] : cur_state.throughputCost(unroll_),
+        register_count_, i == 0, &reduction_expansion,
+        double(corewidth_.comp_), phic);
+      // clang-format off
+      // to break here, use a command like:
+      // br MicroKernelOptimization.cxx:150 if (((int)unroll_.unrolls_.len_)==3) && (unroll_.unrolls_[0].unroll_.divisor_ == 9) && (unroll_.unrolls_[1].unroll_.divisor_ == 3) && (unroll_.unrolls_[2].unroll_.divisor_ == 1) && (unroll_.vf_.index_mask_ == 2)
+      // clang-format on
+      if (i == num_sub_loops) {
+        if (ptrdiff_t nreduct = loopinfo.numReductions()) {
+          // this modifies `bb_costs_`, popping off `nreduct`
+          auto reducts = state.bb_costs_.reductions(nreduct);
+          auto [rex, uf] =
+            reduction_expansion.choose(double(unroll_.getUnroll()));
+          // `unroll_.getUnroll() / rex` and `rex` are integers
+          c.latency_ *= uf;
+          if (rex > 1.0) {
+            auto L = unroll_.popUnrollVal();
+            // we have to decide whether we want to replicate this
+            // variable across unrolls, in which case we are forced to
+            // reduce in the end.
+            c.addCompute(compcosts(unroll_, reducts) * (rex - 1.0));
+            unroll_.push_back(L);
+          }
+        }
+        return cur_c + c.reduce(corewidth_);
+      }
+      cur_c += c.reduce(corewidth_);
+      if (complete) state.best_cost_ = std::numeric_limits<double>::infinity();
+      else {
+        if (cur_c + lowerBound(state.bb_costs_, exit_bbs) >= bound)
+          return std::numeric_limits<double>::infinity();
+        ptrdiff_t sub_exit =
+          subtrees_[state.loop_summaries_.loop_summaries_.size()].exitBBs();
+        double after_lb = remaining_lb_[sub_exit] - remaining_lb_[exit_bbs];
+        state.best_cost_ = bound - cur_c - after_lb;
+      }
+      // eval subloop
+      state = optimize(state);
+      cur_c += state.best_cost_;
+      if (!complete && cur_c + lowerBound(state.bb_costs_, exit_bbs) >= bound)
+        return std::numeric_limits<double>::infinity();
+    }
+  }
+  /// Cache tiling of the outer-most loop `loopinfo`, given its unroll `u` and
+  /// vectorization `l2v`, and the transforms of its subtree in
+  /// `loop_summaries`.
+  auto cacheOpt(LoopSummary loopinfo, LoopSummaries loop_summaries, int u,
+                int l2v, double *phic) -> Cache::CacheOptimizer::Best {
+    // TODO: redefine `last_iter_best` if cache opt makes no-longer best
+    // What we need:
+    // 1. phi-spill-costs - needs to be calculated up-front, conditional
+    //    on u-params
+    // 2. fill `DepSummary *leafdepsummary_`- calculated up front,
+    //    independently of model parameters. There is one dep-summary
+    //    per leaf.
+    //
+    // `cacheOpt` uses the `DepSummary`s as scratch space
+    std::unique_lock<std::mutex> lock{};
+    if (cache_mutex_) lock = std::unique_lock{*cache_mutex_};
+    CostModeling::Cache::CacheOptimizer co{.unrolls_ = {},
+                                           .caches_ = caches_,
+                                           .cachelinebits_ = cachelinebits_,
+                                           .alloc_ = *alloc_};
+    // FIXME: incongruity between entry_state.loop_summaries_, as
+    // `cacheOptEntry` wants this outer-most loop, and the fact that we
+    // should be passing in `trfs`, in `state` construction.
+    LoopTransform trf{.l2vector_width_ = static_cast<uint32_t>(l2v),
+                      .register_unroll_factor_ = static_cast<uint32_t>(u - 1),
+                      .cache_unroll_factor_ = 0,
+                      .cache_permutation_ = 0};
+    auto [best, dsnext] =
+      co.cacheOpt(loopinfo, trf, loop_summaries, phic, leafdepsummary_);
+    return best;
+  }
   // `best_cost` is the best total cost achieved; any search path that exceeds
-  // it can stop early
+  // it can stop early. Once a candidate's cost so far plus the lower bound on
+  // the rest of the subtree reaches the incumbent, we abandon it. This is
+  // checked before descending into each sub-loop, so unrolls whose register
+  // costs alone exceed the incumbent are never expanded.
   //
   // We have loop-specific infomation and state in `LoopTransform`s and
   // `LoopSummary`. We have BB-specific information and states in `BBCost`.
   // TODO: how to handle best_trfs?
   // NOLINTNEXTLINE(misc-no-recursion)
   auto optimize(OptResult entry_state) -> OptResult {
+    ptrdiff_t idx = entry_state.loop_summaries_.loop_summaries_.size();
+    const Subtree &sub = subtrees_[idx];
+    ptrdiff_t exit_bbs = sub.exitBBs();
+    double best_c_external = entry_state.best_cost_,
+           subtree_lb = lowerBound(entry_state.bb_costs_, exit_bbs),
+           outer_iters = unroll_.countIterations();
+    bool memoize = memo_ && unroll_.size() && outer_iters > 0.0 &&
+                   sub.live_lookback_ <= ptrdiff_t(sizeof(uint64_t));
+    MemoKey key{};
+    if (memoize) {
+      key = memoKey(sub, entry_state.bb_costs_.live_counts_, idx);
+      if (auto it = memo_->table_.find(key); it != memo_->table_.end()) {
+        MemoEntry e = it->second;
+        double c = e.cost_ * outer_iters;
+        if (c >= best_c_external) {
+          ++memo_->hits_;
+          return recall(entry_state, sub, e,
+                        std::numeric_limits<double>::infinity());
+        }
+        if (e.exact_) {
+          ++memo_->hits_;
+          return recall(entry_state, sub, e, c);
+        }
+      }
+    }
     auto [loopinfo, loop_summaries] = entry_state.loop_summaries_.popFront();
-    double best_c_external = entry_state.best_cost_;
-    int umax = loopinfo.reorderable() ? 16 : 1,
-        l2vmax =
-          (loopinfo.reorderable() && (!unroll_.vf_.index_mask_)) ? l2maxvf_ : 0;
+    int umax = loopinfo.reorderable() ? max_unroll : 1;
+    VFOptions vfs = vfOptions(loopinfo);
     // LoopTransform *trf_ = loopinfo.trf_; // maybe null
     double best_c_internal{std::numeric_limits<double>::infinity()};
     int best_u = -1, best_l2v = -1, best_cuf = -1;
@@ -110,120 +480,60 @@ struct SubCostFn {
     // TODO: 3. array-packing info?
     // TODO: We should return/have sub-tree sizes of each, to avoid need for
     // over-allocating or over-copying.
+    // The throughput costs of this loop's own BBs depend on no other choice
+    // made below it, so we evaluate them for `unroll_batch` unrolls at a time,
+    // for each vectorization.
+    ptrdiff_t nbb = loopinfo.numSubLoops() + 1;
+    int nvf = vfs.n_;
+    Cost::Cost *tput =
+      umax > 1 ? alloc_->template allocate<Cost::Cost>(nvf * unroll_batch * nbb)
+               : nullptr;
     for (int u = 0; u++ < umax;) {
       unroll_.pushUnroll(u, loopinfo.estimatedTripCount(),
                          loopinfo.knownTrip());
-      for (int l2v = l2vmax;; l2v = 0) {
-        // for (int l2v = l2vmax; l2v >= 0; --l2v) {
+      if (tput && (u - 1) % unroll_batch == 0) {
+        for (int v = 0; v < nvf; ++v) {
+          unroll_.setVF(vfs[v]);
+          batchThroughput(tput + v * unroll_batch * nbb, entry_state.bb_costs_,
+                          idx - 1, nbb, u);
+        }
+      }
+      for (int v = 0; v < nvf; ++v) {
+        int l2v = vfs[v];
         unroll_.setVF(l2v);
-        // We always pass `best_c_internal`, so the `optimize` calls on
-        // sub-loops can quit if they exceed the best cost across `u` and `l2v`
-        // values at this loop level.
+        // The first candidate is always completed, as `ret` needs the state
+        // following this subtree. After that, a candidate can only be chosen
+        // if it costs less than `bound`, so the `optimize` calls on sub-loops
+        // are passed what remains of `bound` after the cost so far and the
+        // lower bound on what follows them.
+        double bound = std::min(best_c_internal, best_c_external);
         OptResult state = {
           .loop_summaries_ = {.loop_summaries_ = loop_summaries.loop_summaries_,
                               .trfs_ = trfs},
           .bb_costs_ = entry_state.bb_costs_,
           .best_cost_ = best_c_internal,
           .phi_costs_ = phic + 1};
-        // TODO:
-        // Add a lower bound cost estimate and check vs best. Lazily use LB as
-        // 0? There may be cases where we can tell a priori that we have to
-        // spill at least `X>0` registers, but that should be uncommon enough
-        // (unless we get really fancy, maybe?) that we can implement that
-        // later.
-        //
-        // we set at the top of iteration, so that they're incremented by end.
-        // Similarly, `depth1_` field of `Unroll_` object gets incremented and
-        // decremented in `u` loop
-        // `optimize` has the original array-starts as local variables
-        // Lets evaluate by BB, even the costs, instead of aggregating, as
-        // otherwise the register spill costs can't be combined with the
-        // `reduce` as well.
-        double cur_c{0.0};
-        {
-          BBCost::ReductionExpansionBounds reduction_expansion{
-            .upper_bound_ = double(unroll_.getUnroll())};
-          for (ptrdiff_t i = 0, num_sub_loops = loopinfo.numSubLoops();; ++i) {
-            // bb cost
-            auto [cur_state, next_state] = state.bb_costs_.popFront();
-            state.bb_costs_ = next_state;
-            Cost::Cost c = cur_state.cost(unroll_, register_count_, i == 0,
-                                          &reduction_expansion,
-                                          double(corewidth_.comp_), phic);
-            // clang-format off
-            // to break here, use a command like:
-            // br MicroKernelOptimization.cxx:150 if (((int)unroll_.unrolls_.len_)==3) && (unroll_.unrolls_[0].unroll_.divisor_ == 9) && (unroll_.unrolls_[1].unroll_.divisor_ == 3) && (unroll_.unrolls_[2].unroll_.divisor_ == 1) && (unroll_.vf_.index_mask_ == 2)
-            // clang-format on
-            if (i == num_sub_loops) {
-              if (ptrdiff_t nreduct = loopinfo.numReductions()) {
-                // this modifies `bb_costs_`, popping off `nreduct`
-                auto reducts = state.bb_costs_.reductions(nreduct);
-                auto [rex, uf] =
-                  reduction_expansion.choose(double(unroll_.getUnroll()));
-                // `unroll_.getUnroll() / rex` and `rex` are integers
-                c.latency_ *= uf;
-                if (rex > 1.0) {
-                  auto L = unroll_.popUnrollVal();
-                  // we have to decide whether we want to replicate this
-                  // variable across unrolls, in which case we are forced to
-                  // reduce in the end.
-                  c.addCompute(compcosts(unroll_, reducts) * (rex - 1.0));
-                  unroll_.push_back(L);
-                }
-              }
-              cur_c += c.reduce(corewidth_);
-              if (!ret_set) ret = state;
-              ret_set = true;
-              break;
-            }
-            cur_c += c.reduce(corewidth_);
-            // eval subloop
-            state = optimize(state);
-            cur_c += std::exchange(state.best_cost_, best_c_internal);
-            // TODO: reorganize code so we don't need `ret_set &&`?
-            if (ret_set && cur_c > best_c_external) break;
-          }
-        }
+        const Cost::Cost *cand_tput =
+          tput ? tput + (ptrdiff_t(v) * unroll_batch +
+                         (u - 1) % unroll_batch) *
+                          nbb
+               : nullptr;
+        double cur_c = candidateCost(loopinfo, state, phic, exit_bbs, bound,
+                                     !ret_set, cand_tput);
         // we need `ret` to contain the tail of best_trfs
-        utils::invariant(ret_set);
-        if (cur_c >= best_c_external) {
-          if (l2v) continue;
-          else break;
-        }
+        if (!ret_set) ret = state;
+        ret_set = true;
+        if (cur_c >= best_c_external) continue;
         if (cur_c < best_c_internal) {
           if (unroll_.size() == 1) {
             // we're the outer-most loop
-            // TODO: redefine `last_iter_best` if cache opt makes no-longer best
-            // What we need:
-            // 1. phi-spill-costs - needs to be calculated up-front, conditional
-            //    on u-params
-            // 2. fill `DepSummary *leafdepsummary_`- calculated up front,
-            //    independently of model parameters. There is one dep-summary
-            //    per leaf.
-            //
-            CostModeling::Cache::CacheOptimizer co{.unrolls_ = {},
-                                                   .caches_ = caches_,
-                                                   .cachelinebits_ =
-                                                     cachelinebits_,
-                                                   .alloc_ = *alloc_};
-            // FIXME: incongruity between entry_state.loop_summaries_, as
-            // `cacheOptEntry` wants this outer-most loop, and the fact that we
-            // should be passing in `trfs`, in `state` construction.
-            LoopTransform trf{.l2vector_width_ = static_cast<uint32_t>(l2v),
-                              .register_unroll_factor_ =
-                                static_cast<uint32_t>(u - 1),
-                              .cache_unroll_factor_ = 0,
-                              .cache_permutation_ = 0};
-            auto [best, dsnext] =
-              co.cacheOpt(loopinfo, trf,
-                          {.loop_summaries_ = loop_summaries.loop_summaries_,
-                           .trfs_ = trfs},
-                          phic, leafdepsummary_);
+            auto best = cacheOpt(
+              loopinfo,
+              {.loop_summaries_ = loop_summaries.loop_summaries_,
+               .trfs_ = trfs},
+              u, l2v, phic);
             cur_c = static_cast<double>(best.cost_ + cur_c);
-            if (cur_c >= best_c_internal) {
-              if (l2v) continue;
-              else break;
-            }
+            if (cur_c >= best_c_internal) continue;
             best_cuf = best.cache_factor_;
           }
           best_c_internal = cur_c;
@@ -240,8 +550,8 @@ struct SubCostFn {
             }
             if (nliveregcnt)
               std::memcpy(best_liveregcnt, liveregcnt, nliveregcnt);
-          } else if (l2v || u < umax) {
-            // only skip if !l2v && u == umax
+          } else if (v + 1 < nvf || u < umax) {
+            // only skip for the last candidate
             allocated_trfs = true;
             if (sts) {
               trfs = math::vector<LoopTransform>(alloc_, sts);
@@ -251,9 +561,10 @@ struct SubCostFn {
           }
           // best_trfs << trfs;
         }
-        if (!l2v) break;
       }
       unroll_.popUnroll();
+      // no candidate can beat `best_c_external`
+      if (overBudget() || subtree_lb >= best_c_external) break;
     }
     if (loopinfo.reorderable())
       entry_state.loop_summaries_.trfs_[0] = {
@@ -264,7 +575,130 @@ struct SubCostFn {
     invariant(ret.bb_costs_.cost_counts_.size() <
               entry_state.bb_costs_.cost_counts_.size());
     ret.best_cost_ = best_c_internal;
+    if (memoize && !overBudget()) {
+      // `best_u` is only set if something beat `best_c_external`
+      bool exact = best_u > 0;
+      remember(key, entry_state, sub,
+               (exact ? best_c_internal : best_c_external) / outer_iters,
+               exact);
+    }
     return ret;
   }
+  /// Searches the candidate unrolls and vectorizations of the outer-most loop
+  /// as up to one task per thread of `pool`, each with its own copy of this
+  /// `SubCostFn` and its own arena. Tasks claim candidates in the order
+  /// `optimize` tries them, and prune them against the cheapest found by any
+  /// task so far, shared through an atomic. Ties with it are not pruned, so
+  /// all of the cheapest candidates are completed, and we pick the first of
+  /// them, as `optimize` does; the result does not depend on scheduling.
+  /// The evaluation budget and `memo_` make results depend on the order in
+  /// which candidates are searched, so they must be unset.
+  auto optimizeParallel(OptResult entry_state, llvm::ThreadPool &pool)
+    -> OptResult {
+    invariant(!unroll_.size() && !eval_budget_ && !memo_);
+    const Subtree &sub =
+      subtrees_[entry_state.loop_summaries_.loop_summaries_.size()];
+    ptrdiff_t exit_bbs = sub.exitBBs();
+    auto [loopinfo, loop_summaries] = entry_state.loop_summaries_.popFront();
+    VFOptions vfs = vfOptions(loopinfo);
+    int nvf = vfs.n_, ncand = loopinfo.reorderable() ? max_unroll * nvf : 1;
+    unsigned nthreads = std::min(pool.getThreadCount(), unsigned(ncand));
+    if (nthreads <= 1) return optimize(entry_state);
+    ptrdiff_t sts = loopinfo.reorderableSubTreeSize(),
+              nlive = sub.exit_.bb_costs_.live_counts_ -
+                      entry_state.bb_costs_.live_counts_;
+    // A thread's best candidate, with its transforms, including this loop's,
+    // phi costs, and live register counts. Each thread has two, the other
+    // holding the candidate being searched, and swaps them on improvement.
+    struct Best {
+      double cost_;
+      int cand_, cuf_;
+      LoopTransform *trfs_;
+      double *phic_;
+      u8 *live_;
+    };
+    Best *bests = alloc_->template allocate<Best>(2 * ptrdiff_t(nthreads));
+    for (unsigned t = 0; t < 2 * nthreads; ++t)
+      bests[t] = {.cost_ = std::numeric_limits<double>::infinity(),
+                  .cand_ = ncand,
+                  .cuf_ = -1,
+                  .trfs_ = alloc_->template allocate<LoopTransform>(sts + 1),
+                  .phic_ = alloc_->template allocate<double>(sts + 1),
+                  .live_ = alloc_->template allocate<u8>(nlive)};
+    std::atomic<double> incumbent{entry_state.best_cost_};
+    std::atomic<int> next{0};
+    std::atomic<ptrdiff_t> evals{0};
+    std::mutex cache_mutex;
+    auto worker = [&](unsigned t) {
+      alloc::OwningArena<> arena;
+      SubCostFn fn = *this;
+      fn.alloc_ = &arena;
+      fn.cache_mutex_ = &cache_mutex;
+      fn.evals_ = 0;
+      Best &best = bests[2 * t], &cur = bests[2 * t + 1];
+      for (int k; (k = next.fetch_add(1, std::memory_order_relaxed)) < ncand;) {
+        auto s = arena.scope();
+        int u = k / nvf + 1, l2v = vfs[k % nvf];
+        double bound =
+          std::nextafter(incumbent.load(std::memory_order_relaxed),
+                         std::numeric_limits<double>::infinity());
+        fn.unroll_.pushUnroll(u, loopinfo.estimatedTripCount(),
+                              loopinfo.knownTrip());
+        fn.unroll_.setVF(l2v);
+        MutPtrVector<LoopTransform> trfs{cur.trfs_ + 1, math::length(sts)};
+        OptResult state = {
+          .loop_summaries_ = {.loop_summaries_ = loop_summaries.loop_summaries_,
+                              .trfs_ = trfs},
+          .bb_costs_ = entry_state.bb_costs_,
+          .best_cost_ = bound,
+          .phi_costs_ = cur.phic_ + 1};
+        state.bb_costs_.live_counts_ = cur.live_;
+        double c =
+          fn.candidateCost(loopinfo, state, cur.phic_, exit_bbs, bound, false);
+        if (c < bound) {
+          auto cache = fn.cacheOpt(
+            loopinfo,
+            {.loop_summaries_ = loop_summaries.loop_summaries_, .trfs_ = trfs},
+            u, l2v, cur.phic_);
+          c = static_cast<double>(cache.cost_ + c);
+          if (c < best.cost_) {
+            cur.cost_ = c;
+            cur.cand_ = k;
+            cur.cuf_ = cache.cache_factor_;
+            std::swap(best, cur);
+            double b = incumbent.load(std::memory_order_relaxed);
+            while (c < b && !incumbent.compare_exchange_weak(
+                              b, c, std::memory_order_relaxed)) {}
+          }
+        }
+        fn.unroll_.popUnroll();
+      }
+      evals.fetch_add(fn.evals_, std::memory_order_relaxed);
+    };
+    // waiting on the group from a task of `pool` runs the group's tasks, so
+    // nesting in the search of independent nests cannot deadlock
+    llvm::ThreadPoolTaskGroup tasks{pool};
+    for (unsigned t = 0; t < nthreads; ++t) tasks.async(worker, t);
+    tasks.wait();
+    evals_ += evals.load(std::memory_order_relaxed);
+    // the cheapest candidate, breaking ties by order
+    Best win = bests[0];
+    for (unsigned t = 1; t < nthreads; ++t)
+      if (Best b = bests[2 * t];
+          b.cost_ < win.cost_ || (b.cost_ == win.cost_ && b.cand_ < win.cand_))
+        win = b;
+    invariant(win.cand_ < ncand);
+    win.trfs_[0] = {
+      .l2vector_width_ = static_cast<uint32_t>(vfs[win.cand_ % nvf]),
+      .register_unroll_factor_ = static_cast<uint32_t>(win.cand_ / nvf),
+      .cache_unroll_factor_ = static_cast<uint32_t>(win.cuf_ - 1)};
+    return recall(entry_state, sub,
+                  {.cost_ = win.cost_,
+                   .exact_ = true,
+                   .trfs_ = win.trfs_,
+                   .phi_costs_ = win.phic_,
+                   .live_counts_ = win.live_},
+                  win.cost_);
+  }
 };
 } // namespace CostModeling::Hard
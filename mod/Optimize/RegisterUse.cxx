@@ -147,6 +147,12 @@ public:
       acc += c * unrolls.dependentUnrollProduct(m);
     return acc;
   }
+  /// Loops whose unroll factors the register use depends on.
+  [[nodiscard]] constexpr auto unrollMask() const -> uint32_t {
+    uint32_t m = 0;
+    for (auto mc : mask_coefs_) m |= mc.mask_;
+    return m;
+  }
 
   IntraBlockRegisterUse(
     alloc::Arena<> *alloc,
@@ -0,0 +1,297 @@
+#ifdef USE_MODULE
+module;
+#else
+#pragma once
+#endif
+
+#include <boost/container_hash/hash.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Type.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <optional>
+#include <string>
+#include <utility>
+
+#ifndef USE_MODULE
+#include "Dicts/Dict.cxx"
+#include "IR/IR.cxx"
+#include "Math/Array.cxx"
+#include "Optimize/LoopTransform.cxx"
+#include "Target/Machine.cxx"
+#else
+export module TransformCache;
+import Array;
+import IR;
+import LoopTransform;
+import TargetMachine;
+#endif
+
+#ifdef USE_MODULE
+export namespace CostModeling {
+#else
+namespace CostModeling {
+#endif
+using math::PtrVector;
+
+/// Canonical form of a loop nest, together with the options that change the
+/// transforms found for it. `hash_` is only used to find candidates; entries
+/// match only if `canon_` is equal too, so hash collisions cannot hand one
+/// nest another's transforms.
+struct NestKey {
+  uint64_t hash_{};
+  llvm::SmallVector<int64_t, 0> canon_{};
+};
+
+/// Serializes a canonical form of an `IR::Loop` tree: loop constraints and
+/// legality, `Addr` index and offset matrices, element types, and the
+/// operations connecting them. Values are numbered in visitation order, so
+/// neither pointers nor names enter the key, and the same nest has the same
+/// key across compilations. Each loop and node starts with its kind, and
+/// variable-length lists with their length, so distinct trees cannot
+/// serialize to the same sequence.
+class NestHasher {
+  NestKey key_;
+  dict::map<const IR::Node *, int32_t> ids_{};
+  dict::map<const IR::Value *, int32_t> arrays_{};
+
+  void combine(int64_t x) { key_.canon_.push_back(x); }
+  void combine(PtrVector<int64_t> x) {
+    combine(ptrdiff_t(x.size()));
+    for (int64_t y : x) combine(y);
+  }
+  void combine(math::DensePtrMatrix<int64_t> A) {
+    combine(ptrdiff_t(A.numRow()));
+    combine(ptrdiff_t(A.numCol()));
+    for (ptrdiff_t r = 0; r < A.numRow(); ++r)
+      for (ptrdiff_t c = 0; c < A.numCol(); ++c) combine(A[r, c]);
+  }
+  void combine(llvm::Type *T) {
+    combine(T->getTypeID());
+    combine(T->getScalarSizeInBits());
+    if (auto *VT = llvm::dyn_cast<llvm::FixedVectorType>(T))
+      combine(VT->getNumElements());
+  }
+  void operand(const IR::Value *op) {
+    if (auto it = ids_.find(op); it != ids_.end()) return combine(it->second);
+    // defined outside the nest
+    combine(-1 - op->getKind());
+    combine(op->getType());
+  }
+  void node(const IR::Node *N) {
+    ids_[N] = int32_t(ids_.size());
+    combine(N->getKind());
+    combine(N->getCurrentDepth());
+    if (auto *A = llvm::dyn_cast<IR::Addr>(N)) {
+      const IR::Value *array = A->getArrayPointer();
+      combine(arrays_.try_emplace(array, int32_t(arrays_.size()))
+                .first->second);
+      combine(A->getType());
+      combine(A->getDenominator());
+      combine(A->getOffsetOmega());
+      combine(A->indexMatrix());
+      combine(A->offsetMatrix());
+      combine(A->getFusionOmega());
+      if (A->isStore()) operand(A->getStoredVal());
+    } else if (auto *C = llvm::dyn_cast<IR::Compute>(N)) {
+      combine(C->getType());
+      combine(C->getOpId());
+      combine(ptrdiff_t(C->getOperands().size()));
+      for (const IR::Value *op : C->getOperands()) operand(op);
+    } else if (auto *P = llvm::dyn_cast<IR::Phi>(N)) {
+      combine(P->getType());
+      combine(ptrdiff_t(P->getOperands().size()));
+      for (const IR::Value *op : P->getOperands()) operand(op);
+    }
+  }
+  // NOLINTNEXTLINE(misc-no-recursion)
+  void loop(const IR::Loop *L) {
+    // tagged like `node`s, so a subloop cannot be read as a node
+    combine(L->getKind());
+    combine(L->getCurrentDepth());
+    Legality legal = L->getLegality();
+    combine(legal.peel_flag_);
+    combine(legal.ordered_reduction_count_);
+    combine(legal.unordered_reduction_count_);
+    combine(legal.reorderable_);
+    combine(legal.parallel_);
+    combine(legal.tileable_);
+    combine(legal.parallel_reductions_);
+    if (poly::Loop *AL = L->getAffineLoop()) {
+      combine(AL->getA());
+      combine(ptrdiff_t(AL->getSyms().size()));
+    }
+    for (IR::Node *N = L->getChild(); N; N = N->getNext()) {
+      if (auto *SL = llvm::dyn_cast<IR::Loop>(N)) loop(SL);
+      else node(N);
+    }
+    // mark the end of the loop, so that nesting is part of the key
+    combine(-1);
+  }
+
+public:
+  NestHasher(target::MachineCore::Arch arch, uint64_t options) {
+    combine(int64_t(arch));
+    combine(int64_t(options));
+  }
+  /// `options` are the bits of any options changing the transforms found,
+  /// e.g. the scheduling objective or the search space.
+  static auto key(const IR::Loop *root, target::MachineCore::Arch arch,
+                  uint64_t options) -> NestKey {
+    NestHasher h{arch, options};
+    h.loop(root);
+    size_t seed = 0;
+    boost::hash_range(seed, h.key_.canon_.begin(), h.key_.canon_.end());
+    h.key_.hash_ = seed;
+    return std::move(h.key_);
+  }
+};
+
+/// The `LoopTransform`s chosen for a nest, and the cost the search estimated
+/// for them.
+struct CachedTransforms {
+  PtrVector<LoopTransform> trfs_;
+  double cost_;
+};
+
+/// Content-addressed cache of the `LoopTransform`s chosen for loop nests,
+/// keyed by `NestHasher::key`, so recompiling the same kernels skips the
+/// transform search.
+/// The file is read once through a memory-mapped buffer, and entries added
+/// since are appended by `save()` while holding a lock on the file, so that
+/// concurrent compilations may share it. It is native-endian, and starts with
+/// `magic`; unreadable or truncated files are treated as (partially) empty,
+/// and files of another format are rewritten by the next `save()`.
+class TransformCache {
+  static constexpr uint64_t magic = 0x34435446'4D504C4CULL; // "LLPMFTC4"
+  struct Entry {
+    double cost_;
+    llvm::SmallVector<int64_t, 0> canon_;
+    llvm::SmallVector<LoopTransform, 4> trfs_;
+  };
+  // entries whose keys share a hash
+  dict::map<uint64_t, llvm::SmallVector<Entry, 1>> entries_{};
+  // hash and index into its bucket
+  llvm::SmallVector<std::pair<uint64_t, size_t>> unsaved_{};
+  std::string path_;
+  bool rewrite_{false};
+
+  template <typename T>
+  static auto read(llvm::StringRef &buf) -> std::optional<T> {
+    if (buf.size() < sizeof(T)) return std::nullopt;
+    T x;
+    std::memcpy(&x, buf.data(), sizeof(T));
+    buf = buf.drop_front(sizeof(T));
+    return x;
+  }
+  template <typename T>
+  static auto readArray(llvm::StringRef &buf, llvm::SmallVectorImpl<T> &x)
+    -> bool {
+    auto len = read<uint32_t>(buf);
+    if (!len || buf.size() < *len * sizeof(T)) return false;
+    x.resize_for_overwrite(*len);
+    for (T &y : x) y = *read<T>(buf);
+    return true;
+  }
+  template <typename T> static void write(llvm::raw_ostream &os, T x) {
+    os.write(reinterpret_cast<const char *>(&x), sizeof(T));
+  }
+  template <typename T>
+  static void writeArray(llvm::raw_ostream &os, llvm::ArrayRef<T> x) {
+    write(os, uint32_t(x.size()));
+    for (T y : x) write(os, y);
+  }
+  [[nodiscard]] auto find(const NestKey &key) const -> const Entry * {
+    auto it = entries_.find(key.hash_);
+    if (it == entries_.end()) return nullptr;
+    for (const Entry &e : it->second)
+      if (e.canon_ == key.canon_) return &e;
+    return nullptr;
+  }
+  void load() {
+    auto buf = llvm::MemoryBuffer::getFile(path_, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+    if (!buf) return;
+    llvm::StringRef data = (*buf)->getBuffer();
+    if (read<uint64_t>(data) != magic) {
+      rewrite_ = !(*buf)->getBuffer().empty();
+      return;
+    }
+    while (auto hash = read<uint64_t>(data)) {
+      auto cost = read<double>(data);
+      if (!cost) return;
+      Entry e{.cost_ = *cost};
+      if (!readArray(data, e.canon_) || !readArray(data, e.trfs_)) return;
+      if (!find({.hash_ = *hash, .canon_ = e.canon_}))
+        entries_[*hash].push_back(std::move(e));
+    }
+  }
+
+public:
+  TransformCache(std::string path) : path_{std::move(path)} { load(); }
+  [[nodiscard]] auto lookup(const NestKey &key) const
+    -> std::optional<CachedTransforms> {
+    const Entry *e = find(key);
+    if (!e) return std::nullopt;
+    return CachedTransforms{
+      .trfs_ = {e->trfs_.data(), math::length(ptrdiff_t(e->trfs_.size()))},
+      .cost_ = e->cost_};
+  }
+  void insert(const NestKey &key, llvm::ArrayRef<LoopTransform> trfs,
+              double cost) {
+    if (find(key)) return;
+    llvm::SmallVector<Entry, 1> &bucket = entries_[key.hash_];
+    unsaved_.emplace_back(key.hash_, bucket.size());
+    bucket.push_back({.cost_ = cost,
+                      .canon_ = key.canon_,
+                      .trfs_ = {trfs.begin(), trfs.end()}});
+  }
+  /// Appends the entries added since the last `save()`; returns `false` if
+  /// the file could not be written, in which case they are retried next time.
+  /// A file in another format is replaced by all entries instead.
+  auto save() -> bool {
+    if (unsaved_.empty() && !rewrite_) return true;
+    std::error_code ec;
+    llvm::raw_fd_ostream os(path_, ec,
+                            rewrite_ ? llvm::sys::fs::OF_None
+                                     : llvm::sys::fs::OF_Append);
+    if (ec) return false;
+    auto lock = os.lock();
+    if (!lock) {
+      llvm::consumeError(lock.takeError());
+      return false;
+    }
+    // `OF_Append` leaves `tell()` at 0, so check the size under the lock.
+    uint64_t size{};
+    if (rewrite_ || (!llvm::sys::fs::file_size(path_, size) && size == 0))
+      write(os, magic);
+    auto writeEntry = [&](uint64_t hash, const Entry &e) {
+      write(os, hash);
+      write(os, e.cost_);
+      writeArray<int64_t>(os, e.canon_);
+      writeArray<LoopTransform>(os, e.trfs_);
+    };
+    if (rewrite_) {
+      for (const auto &[hash, bucket] : entries_)
+        for (const Entry &e : bucket) writeEntry(hash, e);
+    } else {
+      for (auto [hash, idx] : unsaved_) writeEntry(hash, entries_[hash][idx]);
+    }
+    os.flush();
+    if (os.has_error()) return false;
+    unsaved_.clear();
+    rewrite_ = false;
+    return true;
+  }
+};
+
+} // namespace CostModeling
@@ -4,6 +4,7 @@ module;
 #pragma once
 #endif
 
+#include <array>
 #include <bit>
 #include <cmath>
 #include <cstddef>
@@ -38,11 +39,16 @@ namespace CostModeling {
 using utils::invariant;
 
 /// Order is outermost -> innermost
+/// Up to two loops may share the vector lanes: `l2outer_` of the `l2factor_`
+/// lanes go to the outer of the two, and the rest to the inner, which varies
+/// fastest across lanes.
 struct VectorizationFactor {
   uint32_t l2factor_{0};
   // trailing bit is outermost loop, so if iterating by shifting,
   // we go outer->inner
   uint32_t index_mask_{0};
+  // only nonzero if two loops are vectorized
+  uint32_t l2outer_{0};
   constexpr operator IR::cost::VectorWidth() const {
     return IR::cost::VectorWidth{unsigned(1) << l2factor_, l2factor_};
   }
@@ -54,9 +60,26 @@ struct VectorizationFactor {
     return bit::exp2unchecked(l2factor_);
   }
   [[nodiscard]] constexpr auto mask() const -> uint32_t {
-    utils::invariant(std::popcount(index_mask_) <= 1);
+    utils::invariant(std::popcount(index_mask_) <= 2);
     return index_mask_;
   }
+  [[nodiscard]] constexpr auto twoDimensional() const -> bool {
+    return std::popcount(index_mask_) > 1;
+  }
+  [[nodiscard]] constexpr auto outerMask() const -> uint32_t {
+    return index_mask_ & -index_mask_;
+  }
+  [[nodiscard]] constexpr auto innerMask() const -> uint32_t {
+    return index_mask_ ^ outerMask();
+  }
+  /// The lanes of loop `d` alone; `{}` if it is not vectorized.
+  [[nodiscard]] constexpr auto loop(ptrdiff_t d) const -> VectorizationFactor {
+    uint32_t m = uint32_t(1) << d;
+    if (!(index_mask_ & m)) return {};
+    if (!twoDimensional()) return *this;
+    return {.l2factor_ = m == outerMask() ? l2outer_ : l2factor_ - l2outer_,
+            .index_mask_ = m};
+  }
   constexpr auto dyndiv(double x) const -> double {
     return std::bit_cast<double>(std::bit_cast<int64_t>(x) -
                                  (static_cast<int64_t>(l2factor_) << 52));
@@ -107,7 +130,7 @@ struct Unrolls {
   };
   // order is outer<->inner, i.e. `unrolls_[0]` is outermost
   containers::TinyVector<Loop, 15> unrolls_;
-  // only a single loop can be vectorized
+  // at most two loops are vectorized, see `VectorizationFactor`
   VectorizationFactor vf_;
   static_assert(std::is_trivially_default_constructible_v<Loop> &&
                 std::is_trivially_destructible_v<Loop>);
@@ -132,13 +155,25 @@ struct Unrolls {
   [[nodiscard]] constexpr auto tripCounts() const -> TripCounts {
     return {{unrolls_.data(), math::length(unrolls_.size())}};
   }
+  /// Vectorizes the current loop by `2^l2v` lanes, or not if `l2v == 0`.
+  /// If an outer loop is vectorized, the two share the lanes.
   constexpr void setVF(int l2v) {
     auto d0 = getDepth0();
     uint32_t mask = uint32_t(1) << d0;
-    utils::invariant((l2v == 0) || ((vf_.index_mask_ & ~mask) == 0));
-    if (l2v)
+    if (vf_.index_mask_ & mask)
+      vf_ = vf_.index_mask_ == mask
+              ? VectorizationFactor{}
+              : VectorizationFactor{.l2factor_ = vf_.l2outer_,
+                                    .index_mask_ = vf_.index_mask_ & ~mask};
+    if (!l2v) return;
+    if (!vf_.index_mask_) {
       vf_ = {.l2factor_ = static_cast<uint32_t>(l2v), .index_mask_ = mask};
-    else if (vf_.index_mask_ == mask) vf_ = {};
+      return;
+    }
+    utils::invariant(!vf_.twoDimensional() && vf_.index_mask_ < mask);
+    vf_ = {.l2factor_ = vf_.l2factor_ + static_cast<uint32_t>(l2v),
+           .index_mask_ = vf_.index_mask_ | mask,
+           .l2outer_ = vf_.l2factor_};
   }
   [[nodiscard]] constexpr auto getUnroll() const -> T {
     utils::invariant(unrolls_.size() > 0);
@@ -185,14 +220,15 @@ struct Unrolls {
     S c{1.0};
     uint16_t index_mask = vf_.index_mask_;
     // We use that cld(x, y*z) == cld(cld(x, y), z)
-    for (Loop l : unrolls_) {
+    for (ptrdiff_t d = 0; d < unrolls_.size(); ++d) {
+      Loop l = unrolls_[d];
       S tc = l.getTripCount();
       if (l.knownTripCount()) {
         if (indep_axes & 1) tc = cld(tc, l.unroll_);
-        if (index_mask & 1) tc = cld(tc, vf_);
+        if (index_mask & 1) tc = cld(tc, vf_.loop(d));
       } else {
         if (indep_axes & 1) tc = tc * l.unroll_.inv();
-        if (index_mask & 1) tc = vf_.dyndiv(tc);
+        if (index_mask & 1) tc = vf_.loop(d).dyndiv(tc);
       }
       c *= tc;
       indep_axes >>= 1;
@@ -205,11 +241,14 @@ struct Unrolls {
     S c{1.0};
     uint16_t index_mask = vf_.index_mask_;
     // We use that cld(x, y*z) == cld(cld(x, y), z)
-    for (Loop l : unrolls_) {
+    for (ptrdiff_t d = 0; d < unrolls_.size(); ++d) {
+      Loop l = unrolls_[d];
       S tc = l.getTripCount();
       tc = l.knownTripCount() ? cld(tc, l.unroll_) : tc * l.unroll_.inv();
-      if (index_mask & 1)
-        tc = l.knownTripCount() ? cld(tc, vf_) : vf_.dyndiv(tc);
+      if (index_mask & 1) {
+        VectorizationFactor vf = vf_.loop(d);
+        tc = l.knownTripCount() ? cld(tc, vf) : vf.dyndiv(tc);
+      }
       c *= tc;
       index_mask >>= 1;
     }
@@ -223,8 +262,10 @@ struct Unrolls {
       Loop l = unrolls_[i];
       double tc = l.getTripCount();
       tc = l.knownTripCount() ? cld(tc, l.unroll_) : tc * l.unroll_.inv();
-      if (index_mask & 1)
-        tc = l.knownTripCount() ? cld(tc, vf_) : vf_.dyndiv(tc);
+      if (index_mask & 1) {
+        VectorizationFactor vf = vf_.loop(i);
+        tc = l.knownTripCount() ? cld(tc, vf) : vf.dyndiv(tc);
+      }
       c *= tc;
       index_mask >>= 1;
     }
@@ -264,6 +305,79 @@ struct Unrolls {
   }
 };
 
+/// `W` candidate unroll factors of the current, i.e. inner-most, loop of an
+/// `Unrolls`, whose costs are evaluated together. Functions of the unrolls
+/// return one value per candidate, as an `std::array` of lanes the compiler
+/// can keep in vector registers. The outer loops, trip counts, and
+/// vectorization are shared by all candidates.
+/// Each lane equals the corresponding `Unrolls` method of `lane(w)`; the
+/// current loop comes last in their products, so this is exact.
+template <ptrdiff_t W> struct UnrollBatch {
+  using S = Unrolls::S;
+  using T = Unrolls::T;
+  using V = std::array<S, W>;
+  /// The unroll of the current loop, `unrolls_.unrolls_.back()`, is ignored.
+  Unrolls unrolls_;
+  std::array<T, W> current_;
+  /// Candidates `first, first + 1, ..., first + W - 1` of the current loop.
+  constexpr UnrollBatch(const Unrolls &unrolls, int first) : unrolls_{unrolls} {
+    invariant(unrolls_.size() > 0);
+    for (ptrdiff_t w = 0; w < W; ++w) current_[w] = T{S(first + w)};
+  }
+  static constexpr auto broadcast(S x) -> V {
+    V v;
+    v.fill(x);
+    return v;
+  }
+  [[nodiscard]] constexpr auto lane(ptrdiff_t w) const -> Unrolls {
+    Unrolls u = unrolls_;
+    u.unrolls_.back().unroll_ = current_[w];
+    return u;
+  }
+  [[nodiscard]] constexpr auto getDepth0() const -> ptrdiff_t {
+    return unrolls_.getDepth0();
+  }
+  [[nodiscard]] constexpr auto getDepth1() const -> ptrdiff_t {
+    return unrolls_.getDepth1();
+  }
+  [[nodiscard]] constexpr auto vf() const -> VectorizationFactor {
+    return unrolls_.vf_;
+  }
+  [[nodiscard]] constexpr auto currentMask() const -> uint32_t {
+    return uint32_t(1) << getDepth0();
+  }
+  /// Unroll factor of loop `d`.
+  [[nodiscard]] constexpr auto unroll(ptrdiff_t d) const -> V {
+    if (d != getDepth0()) return broadcast(S(unrolls_.unrolls()[d]));
+    V v;
+    for (ptrdiff_t w = 0; w < W; ++w) v[w] = S(current_[w]);
+    return v;
+  }
+  [[nodiscard]] constexpr auto
+  dependentUnrollProduct(uint32_t dep_axes) const -> V {
+    uint32_t cur = currentMask();
+    S p = unrolls_.dependentUnrollProduct(dep_axes & ~cur);
+    if (!(dep_axes & cur)) return broadcast(p);
+    V v;
+    for (ptrdiff_t w = 0; w < W; ++w) v[w] = p * S(current_[w]);
+    return v;
+  }
+  [[nodiscard]] constexpr auto
+  independentLoopIters(uint32_t dep_axes) const -> V {
+    uint32_t cur = currentMask();
+    S c = unrolls_.independentLoopIters(dep_axes | cur);
+    if (dep_axes & cur) return broadcast(c);
+    utils::invariant(!(unrolls_.vf_.index_mask_ & cur));
+    Unrolls::Loop l = unrolls_.unrolls_.back();
+    V v;
+    for (ptrdiff_t w = 0; w < W; ++w) {
+      l.unroll_ = current_[w];
+      v[w] = c * l.unrolledIterCount();
+    }
+    return v;
+  }
+};
+
 } // namespace CostModeling
 
 template class containers::TinyVector<CostModeling::Unrolls::Loop, 15>;
@@ -5,11 +5,18 @@ module;
 #endif
 #include <algorithm>
 #include <array>
+#include <boost/container_hash/hash.hpp>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <limits>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <memory>
+#include <numeric>
+#include <optional>
 #include <ostream>
 #include <ranges>
 #include <type_traits>
@@ -24,8 +31,10 @@ module;
 #ifndef USE_MODULE
 #include "Alloc/Arena.cxx"
 #include "Containers/Tuple.cxx"
+#include "Dicts/Dict.cxx"
 #include "IR/Address.cxx"
 #include "IR/Node.cxx"
+#include "LinearProgramming/LPFormat.cxx"
 #include "Math/Array.cxx"
 #include "Math/Comparisons.cxx"
 #include "Math/Constructors.cxx"
@@ -44,6 +53,7 @@ import ArrayConstructors;
 import Comparisons;
 import Invariant;
 import ListIterator;
+import LPFormat;
 import Optional;
 import Simplex;
 import SOA;
@@ -51,6 +61,7 @@ import Tuple;
 export import :DepPoly;
 import :Address;
 import :AffineSchedule;
+import :Dict;
 import :Node;
 #endif
 
@@ -609,6 +620,36 @@ struct Dependence {
     }
     return true;
   }
+  /// Sets the sat level of this dependence under the original schedule, i.e.
+  /// identity `phi` and no offsets, given the fusion omegas of its endpoints.
+  /// It is satisfied at the first level whose fusion omegas order them, or
+  /// else by the first loop carrying it, which then prevents reordering.
+  /// If neither happens within the common loops, it is loop independent.
+  void satisfyOriginalOrder(Arena<> alloc, PtrVector<int64_t> inFusOmega,
+                            PtrVector<int64_t> outFusOmega) {
+    ptrdiff_t num_loops_in = input()->getCurrentDepth(),
+              num_loops_out = output()->getCurrentDepth(),
+              num_loops_common = std::min(num_loops_in, num_loops_out),
+              num_var = num_loops_in + num_loops_out + 2;
+    auto [sat, bnd] = depSatBnd();
+    invariant(sat->getNumVars(), num_var);
+    auto schv = vector(&alloc, num_var, 0z);
+    const unsigned num_lambda = getNumLambda();
+    for (ptrdiff_t i = 0; i < num_loops_common; ++i) {
+      if (outFusOmega[i] != inFusOmega[i])
+        return setSatLevelParallel(uint8_t(i));
+      schv[2 + i] = 1;
+      schv[2 + num_loops_in + i] = 1;
+      // as in `isSatisfied`, the zero distance is infeasible, so loop `i`
+      // carries the dependence
+      if (sat->unSatisfiable(alloc, schv, num_lambda) ||
+          bnd->unSatisfiable(alloc, schv, num_lambda))
+        return setSatLevelLP(uint8_t(i));
+      schv[2 + i] = 0;
+      schv[2 + num_loops_in + i] = 0;
+    }
+    setSatLevelParallel(uint8_t(num_loops_common));
+  }
   [[nodiscard]] auto isSatisfied(Arena<> alloc, Valid<const AffineSchedule> sx,
                                  Valid<const AffineSchedule> sy, size_t d) const
     -> bool {
@@ -661,6 +702,225 @@ private:
 };
 static_assert(sizeof(Dependence) <= 64);
 
+/// Hash-consing cache of `DepPoly::dependence` and `farkasPair` results.
+/// Both depend only on the loop bounds, the index and offset matrices, and the
+/// difference of the constant offsets of the two accesses. So, e.g., the pairs
+/// `A[i,j]`/`A[i+1,j]` and `B[i+1,j]`/`B[i+2,j]` over the same loops share a
+/// single entry.
+/// Entries live in the cache's arena, and callers receive copies, as
+/// `Dependencies` modifies both the `DepPoly` and the `Simplex`es.
+class DepPolyCache {
+  struct Entry {
+    PtrVector<int64_t> key_;
+    DepPoly *dep_poly_; // `nullptr` if the accesses never overlap
+    std::array<math::Simplex *, 2> pair_;
+  };
+  alloc::OwningArena<> alloc_;
+  dict::map<size_t, llvm::SmallVector<Entry, 1>> entries_;
+  llvm::SmallVector<int64_t> key_;
+  ptrdiff_t hits_{0}, misses_{0};
+
+  void push(PtrMatrix<int64_t> A) {
+    key_.push_back(ptrdiff_t(A.numRow()));
+    key_.push_back(ptrdiff_t(A.numCol()));
+    for (ptrdiff_t r = 0; r < A.numRow(); ++r)
+      for (ptrdiff_t c = 0; c < A.numCol(); ++c) key_.push_back(A[r, c]);
+  }
+  void push(PtrVector<IR::Value *> syms) {
+    key_.push_back(ptrdiff_t(syms.size()));
+    for (IR::Value *s : syms) key_.push_back(reinterpret_cast<intptr_t>(s));
+  }
+  // Mirrors the inputs of `DepPoly::dependence`.
+  void buildKey(Valid<const IR::Addr> x, Valid<const IR::Addr> y) {
+    ptrdiff_t nx = x->getCurrentDepth(), ny = y->getCurrentDepth();
+    key_.clear();
+    key_.push_back(nx);
+    key_.push_back(ny);
+    key_.push_back(
+      DepPoly::findFirstNonEqual(x->getFusionOmega(), y->getFusionOmega()));
+    push(x->getAffLoop()->getOuterA(nx));
+    push(y->getAffLoop()->getOuterA(ny));
+    push(x->getAffLoop()->getSyms());
+    push(y->getAffLoop()->getSyms());
+    push(x->indexMatrix());
+    push(y->indexMatrix());
+    push(x->offsetMatrix());
+    push(y->offsetMatrix());
+    PtrVector<int64_t> ox = x->getOffsetOmega(), oy = y->getOffsetOmega();
+    for (ptrdiff_t i = 0; i < x->numDim(); ++i) key_.push_back(ox[i] - oy[i]);
+  }
+  static auto copy(Arena<> *alloc, const Entry &e)
+    -> containers::Pair<DepPoly *, std::array<math::Simplex *, 2>> {
+    if (!e.dep_poly_) return {nullptr, {}};
+    return {e.dep_poly_->copy(alloc),
+            {e.pair_[0]->copy(alloc), e.pair_[1]->copy(alloc)}};
+  }
+
+public:
+  /// Returns copies of `DepPoly::dependence(x, y)` and its `farkasPair`,
+  /// allocated with `alloc`; the `DepPoly` is `nullptr` if it is empty.
+  /// Each `farkasPair` built is written to `dump`, if given.
+  auto dependence(Arena<> *alloc, Valid<const IR::Addr> x,
+                  Valid<const IR::Addr> y, lp::LPDump *dump = nullptr)
+    -> containers::Pair<DepPoly *, std::array<math::Simplex *, 2>> {
+    buildKey(x, y);
+    llvm::SmallVector<Entry, 1> &bucket =
+      entries_[boost::hash_range(key_.begin(), key_.end())];
+    for (const Entry &e : bucket) {
+      if (!std::ranges::equal(e.key_, key_)) continue;
+      ++hits_;
+      return copy(alloc, e);
+    }
+    ++misses_;
+    Entry e{.key_ = {}, .dep_poly_ = DepPoly::dependence(&alloc_, x, y),
+            .pair_ = {}};
+    if (e.dep_poly_) {
+      e.pair_ = e.dep_poly_->farkasPair(&alloc_);
+      if (dump) dumpFarkasPair(dump, e.pair_);
+    }
+    MutPtrVector<int64_t> key{
+      math::vector<int64_t>(&alloc_, ptrdiff_t(key_.size()))};
+    std::ranges::copy(key_, key.begin());
+    e.key_ = key;
+    bucket.push_back(e);
+    return copy(alloc, e);
+  }
+  [[nodiscard]] constexpr auto hits() const -> ptrdiff_t { return hits_; }
+  [[nodiscard]] constexpr auto misses() const -> ptrdiff_t { return misses_; }
+  static void dumpFarkasPair(lp::LPDump *dump,
+                             std::array<math::Simplex *, 2> pair) {
+    dump->dump("farkas-sat", pair[0]->getConstraints(), std::nullopt);
+    dump->dump("farkas-bnd", pair[1]->getConstraints(), std::nullopt);
+  }
+};
+
+/// Cheap tests run by `Dependencies::check` before building a `DepPoly`.
+/// Each array dimension `d` without dynamic offsets yields an equation
+/// `Cx[d, _] * i - Cy[d, _] * j == oy[d] - ox[d]`, which has no solution if
+/// - the left hand side is constant (`Cx[d, _]` and `Cy[d, _]` are zero),
+///   and the offsets differ;
+/// - the GCD of the coefficients does not divide the right hand side;
+/// - (Banerjee) the right hand side lies outside the range of the left hand
+///   side over the constant loop bounds.
+/// The tests only prove independence; failing all of them proves nothing.
+/// The counters record how many pairs each stage eliminated, and how many
+/// were left for the polyhedral test.
+class IndependenceTests {
+  ptrdiff_t offset_{0}, gcd_{0}, banerjee_{0}, polyhedral_{0};
+
+  using Bound = std::optional<int64_t>;
+  // Largest bounds and coefficients we accumulate, so sums cannot overflow.
+  static constexpr int64_t max_bound = int64_t(1) << 40;
+  static constexpr int64_t max_coef = int64_t(1) << 16;
+
+  static constexpr auto floorDiv(int64_t a, int64_t b) -> int64_t {
+    return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+  }
+  static constexpr auto ceilDiv(int64_t a, int64_t b) -> int64_t {
+    return -floorDiv(-a, b);
+  }
+  /// Constant bounds of loop `l` of `L`, from constraints involving only `l`.
+  static auto loopBounds(Valid<const poly::Loop> L, ptrdiff_t l)
+    -> std::array<Bound, 2> {
+    DensePtrMatrix<int64_t> A = L->getA();
+    ptrdiff_t num_sym = 1 + ptrdiff_t(L->getSyms().size()),
+              col = num_sym + l;
+    Bound lb, ub;
+    for (ptrdiff_t r = 0; r < A.numRow(); ++r) {
+      int64_t a = A[r, col];
+      if (!a) continue;
+      bool only_l = true;
+      for (ptrdiff_t c = 1; only_l && c < A.numCol(); ++c)
+        only_l = (c == col) || !A[r, c];
+      if (!only_l) continue;
+      // A[r, 0] + a * i >= 0; keep the tightest bound, and only give up
+      // below if even that is out of range.
+      if (a > 0) {
+        int64_t b = ceilDiv(-A[r, 0], a);
+        lb = lb ? std::max(*lb, b) : b;
+      } else {
+        int64_t b = floorDiv(A[r, 0], -a);
+        ub = ub ? std::min(*ub, b) : b;
+      }
+    }
+    if (lb && *lb < -max_bound) lb = std::nullopt;
+    if (ub && *ub > max_bound) ub = std::nullopt;
+    return {lb, ub};
+  }
+  /// Adds the range of `s * C[d, _] * i` over the constant loop bounds to
+  /// `range`; returns `false` if a loop with a nonzero coefficient has no
+  /// constant bound.
+  static auto addRange(Valid<const IR::Addr> a, ptrdiff_t d, int64_t s,
+                       std::array<int64_t, 2> &range) -> bool {
+    DensePtrMatrix<int64_t> C = a->indexMatrix();
+    for (ptrdiff_t l = 0; l < C.numCol(); ++l) {
+      int64_t c = s * C[d, l];
+      if (!c) continue;
+      if (std::abs(c) > max_coef) return false;
+      auto [lb, ub] = loopBounds(a->getAffLoop(), l);
+      if (!lb || !ub) return false;
+      range[0] += c * (c > 0 ? *lb : *ub);
+      range[1] += c * (c > 0 ? *ub : *lb);
+    }
+    return true;
+  }
+  static auto hasDynOffset(DensePtrMatrix<int64_t> O, ptrdiff_t d) -> bool {
+    for (ptrdiff_t c = 0; c < O.numCol(); ++c)
+      if (O[d, c]) return true;
+    return false;
+  }
+
+public:
+  /// Returns `true` if `x` and `y` are proven to never access the same
+  /// address.
+  auto independent(Valid<const IR::Addr> x, Valid<const IR::Addr> y) -> bool {
+    if (x->getDenominator() != 1 || y->getDenominator() != 1 ||
+        x->numDim() != y->numDim()) {
+      ++polyhedral_;
+      return false;
+    }
+    DensePtrMatrix<int64_t> Cx = x->indexMatrix(), Cy = y->indexMatrix();
+    PtrVector<int64_t> ox = x->getOffsetOmega(), oy = y->getOffsetOmega();
+    for (ptrdiff_t d = 0; d < x->numDim(); ++d) {
+      if (hasDynOffset(x->offsetMatrix(), d) ||
+          hasDynOffset(y->offsetMatrix(), d))
+        continue;
+      int64_t delta = oy[d] - ox[d], g = 0;
+      for (ptrdiff_t l = 0; l < Cx.numCol(); ++l) g = std::gcd(g, Cx[d, l]);
+      for (ptrdiff_t l = 0; l < Cy.numCol(); ++l) g = std::gcd(g, Cy[d, l]);
+      if (!g) {
+        if (!delta) continue;
+        ++offset_;
+        return true;
+      }
+      if (delta % g) {
+        ++gcd_;
+        return true;
+      }
+      std::array<int64_t, 2> range{0, 0};
+      if (addRange(x, d, 1, range) && addRange(y, d, -1, range) &&
+          (delta < range[0] || delta > range[1])) {
+        ++banerjee_;
+        return true;
+      }
+    }
+    ++polyhedral_;
+    return false;
+  }
+  /// Pairs proven independent by constant offsets alone.
+  [[nodiscard]] constexpr auto offset() const -> ptrdiff_t { return offset_; }
+  /// Pairs proven independent by the GCD test.
+  [[nodiscard]] constexpr auto gcd() const -> ptrdiff_t { return gcd_; }
+  /// Pairs proven independent by the Banerjee test.
+  [[nodiscard]] constexpr auto banerjee() const -> ptrdiff_t {
+    return banerjee_;
+  }
+  /// Pairs that needed the polyhedral test.
+  [[nodiscard]] constexpr auto polyhedral() const -> ptrdiff_t {
+    return polyhedral_;
+  }
+};
+
 // depPoly gives the constraints
 // dependenceFwd gives forward constraints
 // dependenceBwd gives forward constraints
@@ -737,6 +997,10 @@ class Dependencies {
   using Tuple = Dependence::Tuple;
 
   math::ManagedSOA<Tuple> datadeps_{math::length(0)};
+  // kept across `clear()`, so nests within a function share it
+  std::unique_ptr<DepPolyCache> dep_poly_cache_{};
+  IndependenceTests independence_tests_{};
+  lp::LPDump *lp_dump_{nullptr};
 
 public:
   Dependencies() = default;
@@ -745,6 +1009,9 @@ public:
   constexpr Dependencies(Dependencies &&) noexcept = default;
   constexpr auto operator=(Dependencies &&other) noexcept -> Dependencies & {
     datadeps_ = std::move(other.datadeps_);
+    dep_poly_cache_ = std::move(other.dep_poly_cache_);
+    independence_tests_ = other.independence_tests_;
+    lp_dump_ = other.lp_dump_;
     return *this;
   };
 
@@ -752,6 +1019,19 @@ public:
     return datadeps_.size();
   }
   constexpr void clear() { datadeps_.clear(); }
+  [[nodiscard]] auto depPolyCache() -> DepPolyCache & {
+    if (!dep_poly_cache_) dep_poly_cache_ = std::make_unique<DepPolyCache>();
+    return *dep_poly_cache_;
+  }
+  [[nodiscard]] constexpr auto independenceTests() const
+    -> const IndependenceTests & {
+    return independence_tests_;
+  }
+  /// If set, the Farkas systems and scheduling LPs built are written here.
+  constexpr void setLPDump(lp::LPDump *dump) { lp_dump_ = dump; }
+  [[nodiscard]] constexpr auto getLPDump() const -> lp::LPDump * {
+    return lp_dump_;
+  }
 
 private:
   using ID = int32_t;
@@ -1125,10 +1405,10 @@ public:
     // return get(i, input(i), output(i));
   }
   void check(Valid<Arena<>> alloc, Valid<IR::Addr> x, Valid<IR::Addr> y) {
+    llvm::TimeTraceScope timer("Dependencies::check");
     if (x->getArrayPointer() != y->getArrayPointer()) return;
-    // TODO: implement gcd test
-    // if (x.gcdKnownIndependent(y)) return {};
-    DepPoly *dxy{DepPoly::dependence(alloc, x, y)};
+    if (independence_tests_.independent(x, y)) return;
+    auto [dxy, pair] = depPolyCache().dependence(alloc, x, y, lp_dump_);
     if (!dxy) return;
     invariant(x->getCurrentDepth() == ptrdiff_t(dxy->getDim0()));
     invariant(y->getCurrentDepth() == ptrdiff_t(dxy->getDim1()));
@@ -1137,7 +1417,6 @@ public:
     // note that we set boundAbove=true, so we reverse the
     // dependence direction for the dependency we week, we'll
     // discard the program variables x then y
-    std::array<math::Simplex *, 2> pair(dxy->farkasPair(alloc));
     if (dxy->getTimeDim()) timeCheck(alloc, dxy, x, y, pair);
     else timelessCheck(alloc, dxy, x, y, pair);
   }
@@ -1145,6 +1424,7 @@ public:
   auto reload(Arena<> *alloc, Valid<IR::Addr> store) -> Valid<IR::Addr> {
     Valid<DepPoly> dxy{DepPoly::self(alloc, store)};
     std::array<math::Simplex *, 2> pair(dxy->farkasPair(alloc));
+    if (lp_dump_) DepPolyCache::dumpFarkasPair(lp_dump_, pair);
     Valid<IR::Addr> load = store->reload(alloc);
     copyDependencies(store, load);
     if (dxy->getTimeDim()) timeCheck(alloc, dxy, store, load, pair, true);
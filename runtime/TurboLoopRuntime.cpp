@@ -0,0 +1,197 @@
+#include "TurboLoopRuntime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t cache_line = 64;
+/// Chunks per thread when the caller leaves the chunk size to us.
+constexpr int64_t default_chunks_per_thread = 4;
+/// Polls for a new job before an idle worker goes to sleep; kernels are often
+/// called back to back, and waking a sleeping thread costs microseconds.
+constexpr int spin_count = 1 << 14;
+
+/// The chunks a thread starts with. Its owner and thieves alike claim chunks
+/// through `next_`, so stealing takes no more than a `fetch_add`.
+struct alignas(cache_line) Share {
+  std::atomic<int64_t> next_;
+  int64_t end_;
+};
+
+struct Job {
+  turboloop_body_t body_;
+  void *ctx_;
+  int64_t begin_, end_, chunk_;
+  // bytes per private copy of the reductions, padded to a cache line
+  size_t stride_;
+  std::byte *privs_;
+};
+
+thread_local bool in_parallel = false;
+
+/// Persistent pool of `nthreads_ - 1` workers; the thread calling `run` is
+/// thread `0`. Jobs run one at a time: a job is published by bumping
+/// `generation_`, and finishes once `running_` drops to zero.
+class ThreadPool {
+  unsigned nthreads_;
+  std::unique_ptr<Share[]> shares_;
+  std::vector<std::byte> privs_;
+  Job job_{};
+  // serializes callers of `run`
+  std::mutex launch_;
+  std::mutex mutex_;
+  std::condition_variable wake_, done_;
+  std::atomic<uint64_t> generation_{0};
+  std::atomic<unsigned> running_{0};
+  bool stop_{false};
+  std::vector<std::thread> workers_;
+
+  static auto threadsFromEnv() -> unsigned {
+    if (const char *env = std::getenv("TURBOLOOP_NUM_THREADS"))
+      if (int n = std::atoi(env); n > 0) return unsigned(n);
+    return std::max(1U, std::thread::hardware_concurrency());
+  }
+  /// Runs the chunks of thread `tid`'s share, then steals from the others.
+  void work(unsigned tid) {
+    const Job &job = job_;
+    void *priv = job.stride_ ? job.privs_ + tid * job.stride_ : nullptr;
+    for (unsigned v = 0; v < nthreads_; ++v) {
+      Share &s = shares_[(tid + v) % nthreads_];
+      for (int64_t c;
+           (c = s.next_.fetch_add(1, std::memory_order_relaxed)) < s.end_;) {
+        int64_t lo = job.begin_ + c * job.chunk_;
+        job.body_(lo, std::min(lo + job.chunk_, job.end_), job.ctx_, priv);
+      }
+    }
+  }
+  void workerLoop(unsigned tid) {
+    in_parallel = true;
+    for (uint64_t seen = 0;;) {
+      uint64_t gen = generation_.load(std::memory_order_acquire);
+      for (int i = 0; gen == seen && i < spin_count; ++i)
+        gen = generation_.load(std::memory_order_acquire);
+      if (gen == seen) {
+        std::unique_lock lock{mutex_};
+        wake_.wait(lock, [&] {
+          return stop_ || generation_.load(std::memory_order_acquire) != seen;
+        });
+        if (stop_) return;
+        gen = generation_.load(std::memory_order_acquire);
+      }
+      seen = gen;
+      work(tid);
+      if (running_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard lock{mutex_};
+        done_.notify_one();
+      }
+    }
+  }
+  static void serial(const Job &job, void *reduction) {
+    job.body_(job.begin_, job.end_, job.ctx_, reduction);
+  }
+
+public:
+  ThreadPool()
+    : nthreads_{threadsFromEnv()}, shares_{new Share[nthreads_]} {
+    workers_.reserve(nthreads_ - 1);
+    for (unsigned t = 1; t < nthreads_; ++t)
+      workers_.emplace_back([this, t] { workerLoop(t); });
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ~ThreadPool() {
+    {
+      std::lock_guard lock{mutex_};
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &t : workers_) t.join();
+  }
+  [[nodiscard]] auto numThreads() const -> unsigned { return nthreads_; }
+
+  void run(Job job, void *reduction, size_t size,
+           turboloop_combine_t combine) {
+    int64_t n = job.end_ - job.begin_;
+    if (n <= 0) return;
+    // a single thread reduces into `reduction` directly
+    std::unique_lock launch{launch_, std::try_to_lock};
+    if (!launch || in_parallel || nthreads_ == 1) return serial(job, reduction);
+    int64_t nt = nthreads_;
+    if (job.chunk_ <= 0)
+      job.chunk_ = (n + nt * default_chunks_per_thread - 1) /
+                   (nt * default_chunks_per_thread);
+    job.chunk_ = std::clamp<int64_t>(job.chunk_, 1, (n + nt - 1) / nt);
+    int64_t nchunks = (n + job.chunk_ - 1) / job.chunk_;
+    if (nchunks == 1) return serial(job, reduction);
+    // static partition of the chunks, which threads then steal from
+    for (int64_t t = 0; t < nt; ++t) {
+      shares_[t].next_.store(t * nchunks / nt, std::memory_order_relaxed);
+      shares_[t].end_ = (t + 1) * nchunks / nt;
+    }
+    if (size) {
+      job.stride_ = (size + cache_line - 1) / cache_line * cache_line;
+      privs_.resize(job.stride_ * nthreads_);
+      job.privs_ = privs_.data();
+      for (unsigned t = 0; t < nthreads_; ++t)
+        std::memcpy(job.privs_ + t * job.stride_, reduction, size);
+    } else job.stride_ = 0;
+    job_ = job;
+    running_.store(nthreads_ - 1, std::memory_order_relaxed);
+    {
+      std::lock_guard lock{mutex_};
+      generation_.fetch_add(1, std::memory_order_release);
+    }
+    wake_.notify_all();
+    in_parallel = true;
+    work(0);
+    in_parallel = false;
+    for (int i = 0; i < spin_count; ++i)
+      if (!running_.load(std::memory_order_acquire)) break;
+    {
+      std::unique_lock lock{mutex_};
+      done_.wait(lock,
+                 [&] { return !running_.load(std::memory_order_acquire); });
+    }
+    for (unsigned t = 0; size && t < nthreads_; ++t)
+      combine(reduction, job.privs_ + t * job.stride_);
+  }
+};
+
+auto pool() -> ThreadPool & {
+  static ThreadPool p;
+  return p;
+}
+
+} // namespace
+
+extern "C" {
+
+__attribute__((visibility("default"))) void
+turboloop_parallel_for(int64_t begin, int64_t end, int64_t chunk,
+                       turboloop_body_t body, void *ctx, void *reduction,
+                       size_t size, turboloop_combine_t combine) {
+  pool().run({.body_ = body,
+              .ctx_ = ctx,
+              .begin_ = begin,
+              .end_ = end,
+              .chunk_ = chunk,
+              .stride_ = 0,
+              .privs_ = nullptr},
+             reduction, size, combine);
+}
+
+__attribute__((visibility("default"))) auto turboloop_num_threads()
+  -> unsigned {
+  return pool().numThreads();
+}
+
+} // extern "C"
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Work-sharing runtime for the loops that `turbo-loop<parallel>` outlines.
+// Code built with that option calls `turboloop_parallel_for`, so it must be
+// linked against this library.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Runs iterations `[begin, end)` of an outlined loop. `priv` is the calling
+/// thread's private copy of the reductions, or null if there are none.
+typedef void (*turboloop_body_t)(int64_t begin, int64_t end, void *ctx,
+                                 void *priv);
+/// Folds the reductions in `partial` into `acc`.
+typedef void (*turboloop_combine_t)(void *acc, const void *partial);
+
+/// Runs `body` over `[begin, end)` on the thread pool, including the calling
+/// thread. Each thread starts on a contiguous share of the chunks of `chunk`
+/// iterations, and steals chunks from other threads once its own are done.
+/// `chunk == 0` picks a size giving each thread a few chunks; larger sizes are
+/// capped so every thread gets at least one.
+///
+/// If `size != 0`, `reduction` points to `size` bytes holding the identities
+/// of the reductions; each thread gets a private copy of them, and once all
+/// iterations are done, the copies are folded into `reduction` in thread order
+/// by `combine`.
+///
+/// Calls from within `body`, or while another thread's call is running, run
+/// serially on the calling thread.
+void turboloop_parallel_for(int64_t begin, int64_t end, int64_t chunk,
+                            turboloop_body_t body, void *ctx, void *reduction,
+                            size_t size, turboloop_combine_t combine);
+
+/// Number of threads in the pool, including the calling thread; set by the
+/// `TURBOLOOP_NUM_THREADS` environment variable, defaulting to the number of
+/// hardware threads.
+unsigned turboloop_num_threads(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,14 +7,18 @@ module;
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/ScalarEvolution.h>
 #include <llvm/Analysis/ScalarEvolutionExpressions.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/AsmParser/Parser.h>
 #include <llvm/CodeGen/BasicTTIImpl.h>
 #include <llvm/CodeGen/ISDOpcodes.h>
 #include <llvm/CodeGen/TargetLowering.h>
@@ -27,11 +31,17 @@ module;
 #include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
 #include <llvm/IR/Type.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/Alignment.h>
 #include <llvm/Support/Casting.h>
 #include <llvm/Support/InstructionCost.h>
+#include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/TypeSize.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
 #include <optional>
 #include <string>
 
@@ -130,6 +140,15 @@ export {
     auto getNumLoopNests() -> size_t { return alns.size(); }
     // auto getTTI() -> llvm::TargetTransformInfo & { return TTI; }
     auto getTarget() const -> target::Machine<false> { return target; }
+    /// Forgets the dependencies found so far, so that the nest can be
+    /// scheduled again from scratch.
+    void clearDependencies(poly::Dependencies &dependencies) {
+      for (IR::Addr *A : tr.getAddr()) {
+        A->setEdgeIn(-1);
+        A->setEdgeOut(-1);
+      }
+      dependencies.clear();
+    }
     auto addLoop(PtrMatrix<int64_t> A, ptrdiff_t numLoops) -> poly::Loop * {
       ptrdiff_t num_sym = ptrdiff_t(A.numCol()) - numLoops - 1;
       math::Vector<IR::Value *> symbols;
@@ -318,6 +337,54 @@ export {
       return sqrtCall;
     }
   };
+
+  /// Parses the LLVM IR `ir`, and provides the analyses of its function `@f`
+  /// that the backends use, computed on first request.
+  class TestIRFunction {
+    llvm::LLVMContext ctx;
+    llvm::SMDiagnostic err;
+    std::unique_ptr<llvm::Module> mod;
+    // declared in this order, so that they are destroyed in reverse
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+    llvm::Function *fn;
+
+  public:
+    TestIRFunction(const char *ir)
+      : mod(llvm::parseAssemblyString(ir, err, ctx)) {
+      if (!mod) {
+        err.print("TestIRFunction", llvm::errs());
+        std::abort();
+      }
+      llvm::PassBuilder pb;
+      pb.registerModuleAnalyses(mam);
+      pb.registerCGSCCAnalyses(cgam);
+      pb.registerFunctionAnalyses(fam);
+      pb.registerLoopAnalyses(lam);
+      pb.crossRegisterProxies(lam, fam, cgam, mam);
+      fn = mod->getFunction("f");
+      utils::invariant(fn != nullptr);
+    }
+    TestIRFunction(const TestIRFunction &) = delete;
+    auto getFunction() -> llvm::Function & { return *fn; }
+    auto getModule() -> llvm::Module & { return *mod; }
+    template <typename Analysis> auto get() -> typename Analysis::Result & {
+      return fam.getResult<Analysis>(*fn);
+    }
+    /// Whether the module is valid IR, and the dominator tree and `LoopInfo`
+    /// of `@f`, if computed, were kept up to date.
+    auto verify() -> bool {
+      if (llvm::verifyModule(*mod, &llvm::errs())) return false;
+      auto *dt = fam.getCachedResult<llvm::DominatorTreeAnalysis>(*fn);
+      if (!dt) return true;
+      if (!dt->verify()) return false;
+      if (auto *li = fam.getCachedResult<llvm::LoopAnalysis>(*fn))
+        li->verify(*dt);
+      return true;
+    }
+  };
 #ifdef USE_MODULE
 }
 #endif
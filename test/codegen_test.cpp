@@ -0,0 +1,312 @@
+#include <cstdint>
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/DependenceAnalysis.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/OptimizationRemarkEmitter.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Transforms/Utils/LoopUtils.h>
+#include <optional>
+#ifndef USE_MODULE
+#include "Backends/CodeGeneration.cxx"
+#include "TestUtilities.cxx"
+#else
+
+import CodeGen;
+import TestUtilities;
+#endif
+
+using CostModeling::LoopTransform;
+
+namespace {
+
+// for (i = 0; i < 8; ++i)
+//   for (j = 0; j < n; ++j) a[i*n + j] = 2 * b[i*n + j];
+// the inner loop is already marked `mustprogress`
+constexpr const char *nest_ir = R"(
+define void @f(ptr noalias %a, ptr noalias %b, i64 %n) {
+entry:
+  br label %outer
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %row = mul nsw i64 %i, %n
+  br label %inner
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %k = add nsw i64 %row, %j
+  %pb = getelementptr inbounds double, ptr %b, i64 %k
+  %x = load double, ptr %pb
+  %y = fmul double %x, 2.0
+  %pa = getelementptr inbounds double, ptr %a, i64 %k
+  store double %y, ptr %pa
+  %j.next = add nuw nsw i64 %j, 1
+  %cj = icmp slt i64 %j.next, %n
+  br i1 %cj, label %inner, label %outer.latch, !llvm.loop !0
+outer.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %ci = icmp slt i64 %i.next, 8
+  br i1 %ci, label %outer, label %exit
+exit:
+  ret void
+}
+!0 = distinct !{!0, !1}
+!1 = !{!"llvm.loop.mustprogress"}
+)";
+
+auto transform(uint32_t l2vw, uint32_t uf) -> LoopTransform {
+  return {.l2vector_width_ = l2vw,
+          .register_unroll_factor_ = uf - 1,
+          .cache_unroll_factor_ = 0};
+}
+
+// for (i = 0; i < 8; ++i)
+//   for (j = 0; j < 63; ++j) a[i][j] = 2 * b[i][j];
+constexpr const char *copy_ir = R"(
+define void @f(ptr noalias %a, ptr noalias %b) {
+entry:
+  br label %outer
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  br label %inner
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %pb = getelementptr inbounds [64 x double], ptr %b, i64 %i, i64 %j
+  %x = load double, ptr %pb
+  %y = fmul double %x, 2.0
+  %pa = getelementptr inbounds [64 x double], ptr %a, i64 %i, i64 %j
+  store double %y, ptr %pa
+  %j.next = add nuw nsw i64 %j, 1
+  %cj = icmp ult i64 %j.next, 63
+  br i1 %cj, label %inner, label %outer.latch
+outer.latch:
+  %i.next = add nuw nsw i64 %i, 1
+  %ci = icmp ult i64 %i.next, 8
+  br i1 %ci, label %outer, label %exit
+exit:
+  ret void
+}
+)";
+
+auto lowering(TestIRFunction &tf) -> codegen::Lowering {
+  return {&tf.get<llvm::LoopAnalysis>(),
+          &tf.get<llvm::ScalarEvolutionAnalysis>(),
+          &tf.get<llvm::DominatorTreeAnalysis>(),
+          &tf.get<llvm::AssumptionAnalysis>(),
+          &tf.get<llvm::TargetIRAnalysis>(),
+          &tf.get<llvm::OptimizationRemarkEmitterAnalysis>(),
+          &tf.get<llvm::DependenceAnalysis>()};
+}
+auto numStores(llvm::Loop *L) -> ptrdiff_t {
+  ptrdiff_t n = 0;
+  for (llvm::BasicBlock *BB : L->blocks())
+    for (llvm::Instruction &I : *BB) n += llvm::isa<llvm::StoreInst>(I);
+  return n;
+}
+auto numCalls(llvm::Function &F, llvm::StringRef name) -> ptrdiff_t {
+  ptrdiff_t n = 0;
+  for (llvm::Instruction &I : llvm::instructions(F))
+    if (auto *call = llvm::dyn_cast<llvm::CallBase>(&I))
+      if (llvm::Function *callee = call->getCalledFunction())
+        n += callee->getName() == name;
+  return n;
+}
+
+} // namespace
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(AttachMetadata, BasicAssertions) {
+  TestIRFunction tf{nest_ir};
+  llvm::LoopInfo &li = tf.get<llvm::LoopAnalysis>();
+  llvm::Loop *outer = *li.begin(), *inner = outer->getSubLoops().front();
+  // the inner loop vectorized by 4 and interleaved by 2, the outer unrolled
+  // and jammed by 3
+  codegen::LoopPlan plans[]{
+    {.loop_ = outer, .trf_ = transform(0, 3), .innermost_ = false},
+    {.loop_ = inner, .trf_ = transform(2, 2), .innermost_ = true}};
+  EXPECT_TRUE(codegen::attachMetadata(plans));
+  EXPECT_TRUE(tf.verify());
+  EXPECT_EQ(llvm::getOptionalIntLoopAttribute(inner,
+                                              "llvm.loop.vectorize.width"),
+            std::optional<int>{4});
+  EXPECT_TRUE(llvm::getBooleanLoopAttribute(inner,
+                                            "llvm.loop.vectorize.enable"));
+  EXPECT_EQ(llvm::getOptionalIntLoopAttribute(inner,
+                                              "llvm.loop.interleave.count"),
+            std::optional<int>{2});
+  // the interleaving is all the unrolling the cost model accounted for
+  EXPECT_EQ(llvm::getOptionalIntLoopAttribute(inner, "llvm.loop.unroll.count"),
+            std::optional<int>{1});
+  EXPECT_TRUE(llvm::getBooleanLoopAttribute(inner, "llvm.loop.mustprogress"));
+  EXPECT_EQ(llvm::getOptionalIntLoopAttribute(
+              outer, "llvm.loop.unroll_and_jam.count"),
+            std::optional<int>{3});
+  EXPECT_FALSE(llvm::getOptionalIntLoopAttribute(outer,
+                                                 "llvm.loop.vectorize.width"));
+  // a scalar inner loop only sets the width, so interleaving stays enabled
+  codegen::LoopPlan scalar[]{
+    {.loop_ = inner, .trf_ = transform(0, 4), .innermost_ = true}};
+  EXPECT_TRUE(codegen::attachMetadata(scalar));
+  EXPECT_EQ(llvm::getOptionalIntLoopAttribute(inner,
+                                              "llvm.loop.vectorize.width"),
+            std::optional<int>{1});
+  EXPECT_FALSE(llvm::getBooleanLoopAttribute(inner,
+                                             "llvm.loop.vectorize.enable"));
+  EXPECT_EQ(llvm::getOptionalIntLoopAttribute(inner,
+                                              "llvm.loop.interleave.count"),
+            std::optional<int>{4});
+  EXPECT_FALSE(codegen::attachMetadata({}));
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(LowerUnroll, BasicAssertions) {
+  // for (i = 0; i < 16; ++i) a[i] = 2 * b[i];
+  const char *ir = R"(
+define void @f(ptr noalias %a, ptr noalias %b) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pb = getelementptr inbounds double, ptr %b, i64 %i
+  %x = load double, ptr %pb
+  %y = fmul double %x, 2.0
+  %pa = getelementptr inbounds double, ptr %a, i64 %i
+  store double %y, ptr %pa
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp ult i64 %i.next, 16
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+)";
+  {
+    // a scalar loop is unrolled by its register unroll
+    TestIRFunction tf{ir};
+    codegen::Lowering lower = lowering(tf);
+    llvm::Loop *L = *tf.get<llvm::LoopAnalysis>().begin();
+    codegen::LoopPlan plans[]{
+      {.loop_ = L, .trf_ = transform(0, 4), .innermost_ = true}};
+    EXPECT_TRUE(lower.lower(plans));
+    EXPECT_EQ(lower.unrollFactor(L), 4);
+    EXPECT_EQ(numStores(L), 4);
+    EXPECT_TRUE(tf.verify());
+  }
+  // a vectorized loop is left to `LoopVectorize`, with our width
+  TestIRFunction tf{ir};
+  codegen::Lowering lower = lowering(tf);
+  llvm::Loop *L = *tf.get<llvm::LoopAnalysis>().begin();
+  codegen::LoopPlan plans[]{
+    {.loop_ = L, .trf_ = transform(2, 2), .innermost_ = true}};
+  EXPECT_TRUE(lower.lower(plans));
+  EXPECT_EQ(lower.unrollFactor(L), 1);
+  EXPECT_EQ(numStores(L), 1);
+  EXPECT_EQ(llvm::getOptionalIntLoopAttribute(L, "llvm.loop.vectorize.width"),
+            std::optional<int>{4});
+  EXPECT_EQ(llvm::getOptionalIntLoopAttribute(L, "llvm.loop.interleave.count"),
+            std::optional<int>{2});
+  EXPECT_TRUE(tf.verify());
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(LowerUnrollAndJam, BasicAssertions) {
+  TestIRFunction tf{copy_ir};
+  codegen::Lowering lower = lowering(tf);
+  llvm::Loop *outer = *tf.get<llvm::LoopAnalysis>().begin(),
+             *inner = outer->getSubLoops().front();
+  codegen::LoopPlan plans[]{
+    {.loop_ = outer, .trf_ = transform(0, 2), .innermost_ = false},
+    {.loop_ = inner, .trf_ = transform(0, 1), .innermost_ = true}};
+  EXPECT_TRUE(lower.lower(plans));
+  EXPECT_EQ(lower.unrollFactor(outer), 2U);
+  EXPECT_EQ(lower.unrollFactor(inner), 1U);
+  // both copies of the outer body were jammed into the inner loop
+  ASSERT_EQ(outer->getSubLoops().size(), 1U);
+  EXPECT_EQ(numStores(outer->getSubLoops().front()), 2);
+  EXPECT_TRUE(tf.verify());
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(LowerUnsafeUnrollAndJam, BasicAssertions) {
+  // for (i = 0; i < 8; ++i)
+  //   for (j = 0; j < 63; ++j) a[i+1][j] = a[i][j+1];
+  // iteration `(i, j)` writes what `(i+1, j-1)` reads, so jamming two
+  // iterations of `i` would read `a[i+1][j]` before it was written
+  TestIRFunction tf{R"(
+define void @f(ptr %a) {
+entry:
+  br label %outer
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %i.next = add nuw nsw i64 %i, 1
+  br label %inner
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %j.next = add nuw nsw i64 %j, 1
+  %pl = getelementptr inbounds [64 x double], ptr %a, i64 %i, i64 %j.next
+  %x = load double, ptr %pl
+  %ps = getelementptr inbounds [64 x double], ptr %a, i64 %i.next, i64 %j
+  store double %x, ptr %ps
+  %cj = icmp ult i64 %j.next, 63
+  br i1 %cj, label %inner, label %outer.latch
+outer.latch:
+  %ci = icmp ult i64 %i.next, 8
+  br i1 %ci, label %outer, label %exit
+exit:
+  ret void
+}
+)"};
+  codegen::Lowering lower = lowering(tf);
+  llvm::Loop *outer = *tf.get<llvm::LoopAnalysis>().begin();
+  codegen::LoopPlan plans[]{
+    {.loop_ = outer, .trf_ = transform(0, 2), .innermost_ = false}};
+  EXPECT_FALSE(lower.lower(plans));
+  EXPECT_EQ(lower.unrollFactor(outer), 1U);
+  EXPECT_EQ(numStores(outer->getSubLoops().front()), 1);
+  EXPECT_TRUE(tf.verify());
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(EraseDeadAllocations, BasicAssertions) {
+  // `%tmp` is only written and freed, while `%live` is read back
+  TestIRFunction tf{R"(
+define double @f() {
+entry:
+  %tmp = call ptr @malloc(i64 64)
+  store double 1.0, ptr %tmp
+  %p = getelementptr inbounds double, ptr %tmp, i64 1
+  store double 2.0, ptr %p
+  call void @free(ptr %tmp)
+  %live = call ptr @malloc(i64 64)
+  store double 3.0, ptr %live
+  %x = load double, ptr %live
+  call void @free(ptr %live)
+  ret double %x
+}
+declare noalias ptr @malloc(i64)
+declare void @free(ptr)
+)"};
+  dict::set<llvm::CallBase *> candidates;
+  for (llvm::Instruction &I : llvm::instructions(tf.getFunction()))
+    if (auto *call = llvm::dyn_cast<llvm::CallBase>(&I))
+      if (call->getCalledFunction()->getName() == "malloc")
+        candidates.insert(call);
+  ASSERT_EQ(candidates.size(), 2U);
+  EXPECT_EQ(codegen::Lowering::eraseDeadAllocations(
+              candidates, &tf.get<llvm::TargetLibraryAnalysis>()),
+            1);
+  EXPECT_TRUE(candidates.empty());
+  EXPECT_EQ(numCalls(tf.getFunction(), "malloc"), 1);
+  EXPECT_EQ(numCalls(tf.getFunction(), "free"), 1);
+  ptrdiff_t stores = 0;
+  for (llvm::Instruction &I : llvm::instructions(tf.getFunction()))
+    stores += llvm::isa<llvm::StoreInst>(I);
+  EXPECT_EQ(stores, 1);
+  EXPECT_TRUE(tf.verify());
+}
@@ -9,6 +9,9 @@
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Type.h>
 #include <llvm/Support/Allocator.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <vector>
 #ifndef USE_MODULE
 #include "TestUtilities.cxx"
 #include "Math/Comparisons.cxx"
@@ -158,6 +161,38 @@ TEST(MeanStDevTest0jOuter, BasicAssertions) {
     if (s.getNumLoops() == 1) EXPECT_EQ((s.getPhi()[0, 0]), 1);
     else EXPECT_EQ(s.getPhi(), optS);
   }
+
+  // Solving the components `breakGraph` splits the nest into on a thread pool
+  // yields the sequential schedule.
+  std::vector<DenseMatrix<int64_t>> phis;
+  std::vector<std::vector<int64_t>> omegas;
+  for (auto *node : optRes.nodes->getAllVertices()) {
+    poly::AffineSchedule s = node->getSchedule();
+    phis.emplace_back(s.getPhi());
+    omegas.emplace_back(s.getFusionOmega().begin(), s.getFusionOmega().end());
+    omegas.back().insert(omegas.back().end(), s.getOffsetOmega().begin(),
+                         s.getOffsetOmega().end());
+  }
+  tlf.clearDependencies(deps);
+  llvm::ThreadPool pool{llvm::hardware_concurrency(4)};
+  alloc::OwningArena palloc;
+  lp::LoopBlock pblock{deps, palloc, {}, false, false, &pool};
+  lp::LoopBlock::OptimizationResult poolRes =
+    pblock.optimize(ir, tlf.getTreeResult());
+  ASSERT_NE(poolRes.nodes, nullptr);
+  size_t numNodes = 0;
+  for (auto *node : poolRes.nodes->getAllVertices()) {
+    ASSERT_LT(numNodes, phis.size());
+    poly::AffineSchedule s = node->getSchedule();
+    EXPECT_EQ(s.getPhi(), phis[numNodes]);
+    std::vector<int64_t> omega(s.getFusionOmega().begin(),
+                               s.getFusionOmega().end());
+    omega.insert(omega.end(), s.getOffsetOmega().begin(),
+                 s.getOffsetOmega().end());
+    EXPECT_EQ(omega, omegas[numNodes]);
+    ++numNodes;
+  }
+  EXPECT_EQ(numNodes, phis.size());
 }
 
 // NOLINTNEXTLINE(modernize-use-trailing-return-type)
@@ -270,4 +305,113 @@ TEST(MeanStDevTest0iOuter, BasicAssertions) {
     if (s.getNumLoops() == 1) EXPECT_EQ((s.getPhi()[0, 0]), 1);
     else EXPECT_EQ(s.getPhi(), opt_s);
   }
-}
\ No newline at end of file
+}
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(FusionProfitability, BasicAssertions) {
+  TestLoopFunction tlf;
+  IR::FunArg *ptrA = tlf.createArray();
+  IR::FunArg *ptrB = tlf.createArray();
+  IR::FunArg *ptrC = tlf.createArray();
+  IR::FunArg *ptrX = tlf.createArray();
+  lp::FusionModel model{.l1Bytes = 32768, .vectorRegisters = 16};
+
+  // Two wide elementwise nests sharing only a small array: fused, their
+  // 44 KiB no longer fit in L1, though each 24 KiB did. The 4 KiB reused do
+  // not make up for the 12 KiB spilled, so we keep them apart.
+  lp::Footprint wide0{.bytes = 24576, .streams = 2}, wide1 = wide0;
+  wide0.arrays[ptrA] = 20480;
+  wide0.arrays[ptrX] = 4096;
+  wide1.arrays[ptrC] = 20480;
+  wide1.arrays[ptrX] = 4096;
+  EXPECT_FALSE(model.profitable(wide0, wide1));
+  EXPECT_FALSE(model.profitable(wide1, wide0));
+
+  // Two small nests streaming the same array: fused, they still fit in L1 and
+  // the registers, and `A` is read once instead of twice.
+  lp::Footprint small0{.bytes = 12288, .streams = 2}, small1 = small0;
+  small0.arrays[ptrA] = 8192;
+  small0.arrays[ptrB] = 4096;
+  small1.arrays[ptrA] = 8192;
+  small1.arrays[ptrC] = 4096;
+  EXPECT_TRUE(model.profitable(small0, small1));
+  EXPECT_TRUE(model.profitable(small1, small0));
+
+  // Without a target model, we fuse whenever legal.
+  EXPECT_TRUE(lp::FusionModel{}.profitable(wide0, wide1));
+}
+
+namespace {
+// for (i = 0; i < I; ++i)
+//   for (j = 0; j < J; ++j)
+//     t[0] += A[i,j];
+// for (i = 0; i < I; ++i)
+//   for (j = 0; j < J; ++j)
+//     B[i,j] = A[i,j] * t[0];
+// for (i = 0; i < I; ++i)
+//   for (j = 0; j < J; ++j)
+//     C[i,j] = B[i,j] + D[i,j] + E[i,j];
+// Returns the outer fusion omegas of the stores to `B` and `C`.
+auto fuseNormalized(lp::FusionModel fusion) -> std::array<int64_t, 2> {
+  TestLoopFunction tlf;
+  poly::Loop *loop = tlf.addLoop("[-1 1 0 -1 0; "
+                                 "0 0 0 1 0; "
+                                 "-1 0 1 0 -1; "
+                                 "0 0 0 0 1]"_mat,
+                                 2);
+  IR::Cache &ir = tlf.getIRC();
+  IR::Value *one = tlf.getConstInt(1);
+  IR::Value *J = loop->getSyms()[1];
+  std::array<IR::Value *, 2> sizes{J, one};
+  std::array<IR::Value *, 1> scalar{one};
+  IR::FunArg *ptrT = tlf.createArray(), *ptrA = tlf.createArray(),
+             *ptrB = tlf.createArray(), *ptrC = tlf.createArray(),
+             *ptrD = tlf.createArray(), *ptrE = tlf.createArray();
+  llvm::Type *f64 = tlf.getDoubleTy();
+  IR::Addr *a0 = tlf.createLoad(ptrA, f64, "[1 0; 0 1]"_mat, sizes,
+                                "[0 0 0]"_mat, loop);
+  IR::Addr *t0 =
+    tlf.createLoad(ptrT, f64, "[0 0]"_mat, scalar, "[0 0 1]"_mat, loop);
+  tlf.createStow(ptrT, ir.createFAdd(t0, a0), "[0 0]"_mat, scalar,
+                 "[0 0 2]"_mat, loop);
+  IR::Addr *a1 = tlf.createLoad(ptrA, f64, "[1 0; 0 1]"_mat, sizes,
+                                "[1 0 0]"_mat, loop);
+  IR::Addr *t1 =
+    tlf.createLoad(ptrT, f64, "[0 0]"_mat, scalar, "[1 0 1]"_mat, loop);
+  IR::Addr *stowB =
+    tlf.createStow(ptrB, ir.createFMul(a1, t1), "[1 0; 0 1]"_mat, sizes,
+                   "[1 0 2]"_mat, loop);
+  IR::Addr *b2 = tlf.createLoad(ptrB, f64, "[1 0; 0 1]"_mat, sizes,
+                                "[2 0 0]"_mat, loop);
+  IR::Addr *d2 = tlf.createLoad(ptrD, f64, "[1 0; 0 1]"_mat, sizes,
+                                "[2 0 1]"_mat, loop);
+  IR::Addr *e2 = tlf.createLoad(ptrE, f64, "[1 0; 0 1]"_mat, sizes,
+                                "[2 0 2]"_mat, loop);
+  IR::Addr *stowC =
+    tlf.createStow(ptrC, ir.createFAdd(ir.createFAdd(b2, d2), e2),
+                   "[1 0; 0 1]"_mat, sizes, "[2 0 3]"_mat, loop);
+  poly::Dependencies deps{};
+  alloc::OwningArena salloc;
+  lp::LoopBlock block{deps, salloc, {}, false, false, nullptr, fusion};
+  lp::LoopBlock::OptimizationResult res =
+    block.optimize(ir, tlf.getTreeResult());
+  if (!res.nodes) return {-1, -1};
+  return {stowB->getNode()->getFusionOmega(0),
+          stowC->getNode()->getFusionOmega(0)};
+}
+} // namespace
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(FusionProfitabilityNest, BasicAssertions) {
+  // `t` must be complete before the second nest starts, so the nests are split
+  // at the outer loop, and `tryFuse` tries to fuse the last two again. Each
+  // inner loop streams 1024 `double`s per array, i.e. 24 KiB and 32 KiB; fused,
+  // they take 48 KiB, thrashing a 32 KiB L1 to save reading 8 KiB of `B`.
+  auto [b_cost, c_cost] =
+    fuseNormalized({.l1Bytes = 32768, .vectorRegisters = 16});
+  ASSERT_NE(b_cost, -1);
+  EXPECT_NE(b_cost, c_cost);
+  // Without the cost model, fusing them is legal, so we do.
+  auto [b_legal, c_legal] = fuseNormalized({});
+  ASSERT_NE(b_legal, -1);
+  EXPECT_EQ(b_legal, c_legal);
+}
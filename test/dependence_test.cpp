@@ -9,11 +9,17 @@
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Type.h>
 #include <llvm/Support/Allocator.h>
+#include <optional>
+#include <sstream>
+#include <utility>
+#include <vector>
 #ifndef USE_MODULE
 #include "TestUtilities.cxx"
 #include "Optimize/Legality.cxx"
+#include "Optimize/CostModeling.cxx"
 #include "IR/IR.cxx"
 #include "Math/Comparisons.cxx"
+#include "LinearProgramming/LPFormat.cxx"
 #include "Utilities/MatrixStringParse.cxx"
 #include "Math/Array.cxx"
 #else
@@ -21,8 +27,10 @@
 import Array;
 import ArrayParse;
 import Comparisons;
+import CostModeling;
 import IR;
 import Legality;
+import LPFormat;
 import TestUtilities;
 #endif
 
@@ -129,10 +137,25 @@ TEST(TimeHidingInRankDeficiency, BasicAssertions) {
             << deps[e1] << "\n";
 }
 
-// NOLINTNEXTLINE(modernize-use-trailing-return-type)
-TEST(DoubleDependenceTest, BasicAssertions) {
+namespace {
 
-  TestLoopFunction tlf;
+/// The accesses of the stencil `buildStencil` creates.
+struct Stencil {
+  IR::Addr *tgt01, *tgt10, *src;
+};
+
+// for (i = 0:I-2)   // satisfies A[j+1,i+1] -> A[j+1,i]
+//   for (j = 0:J-2) // satisfies A[j+1,i+1] -> A[j,i+1]
+//     A[j+1,i+1] = A[j,i+1] + A[j+1,i];
+// A*x >= 0;
+// [ -2  1  0 -1  0    [ 1
+//    0  0  0  1  0  *   I   >= 0
+//   -2  0  1  0 -1      J
+//    0  0  0  0  1 ]    i
+//                       j ]
+// we have three array refs
+// A[i+1, j+1] // (i+1)*stride(A,1) + (j+1)*stride(A,2);
+auto buildStencil(TestLoopFunction &tlf) -> Stencil {
   poly::Loop *loop = tlf.addLoop("[-2 1 0 -1 0; "
                                  "0 0 0 1 0; "
                                  "-2 0 1 0 -1; "
@@ -156,19 +179,23 @@ TEST(DoubleDependenceTest, BasicAssertions) {
   IR::Addr *msrc{tlf.createStow(
     ptrA, ir.createFAdd(mtgt01, mtgt10), "[0 1; 1 0]"_mat, "[1 1]"_mat,
     std::array<IR::Value *, 2>{II, one}, "[0 0 2]"_mat, loop)};
+  return {.tgt01 = mtgt01, .tgt10 = mtgt10, .src = msrc};
+}
+
+auto identity2() -> DenseMatrix<int64_t> {
+  DenseMatrix<int64_t> identity(math::DenseDims<>{math::row(2), math::col(2)},
+                                0);
+  identity.diag() << 1;
+  return identity;
+}
+
+} // namespace
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DoubleDependenceTest, BasicAssertions) {
+  TestLoopFunction tlf;
+  auto [mtgt01, mtgt10, msrc] = buildStencil(tlf);
 
-  // for (i = 0:I-2)   // satisfies A[j+1,i+1] -> A[j+1,i]
-  //   for (j = 0:J-2) // satisfies A[j+1,i+1] -> A[j,i+1]
-  //     A[j+1,i+1] = A[j,i+1] + A[j+1,i];
-  // A*x >= 0;
-  // [ -2  1  0 -1  0    [ 1
-  //    0  0  0  1  0  *   I   >= 0
-  //   -2  0  1  0 -1      J
-  //    0  0  0  0  1 ]    i
-  //                       j ]
-  // we have three array refs
-  // A[i+1, j+1] // (i+1)*stride(A,1) + (j+1)*stride(A,2);
-  //
   // Current bug:
   // Rotation swapping `i` and `j` applied, so `j` is outer loop
   // msrc->mtgt10 [1, 0], i.e. A[j+1,i] satisfied according to simplex
@@ -193,28 +220,28 @@ TEST(DoubleDependenceTest, BasicAssertions) {
   if (dep1->getNumInequalityConstraints() != 4) __builtin_trap();
   if (dep1->getNumEqualityConstraints() != 2) __builtin_trap();
   poly::Dependencies deps{};
-  {
-    deps.check(tlf.getAlloc(), msrc, mtgt01);
-    EXPECT_EQ(deps.size(), 1);
-    poly::Dependence d0{deps[0]};
-    EXPECT_TRUE(d0.isForward());
-    std::cout << d0 << "\n";
-    if (!d0.isForward()) __builtin_trap();
-    if (allZero(d0.getSatConstraints()[last, _])) __builtin_trap();
-    deps.check(tlf.getAlloc(), msrc, mtgt10);
-    EXPECT_EQ(deps.size(), 2);
-    poly::Dependence d1{deps[1]};
-    EXPECT_TRUE(d1.isForward());
-    std::cout << d1 << "\n";
-    if (!d1.isForward()) __builtin_trap();
-    if (allZero(d1.getSatConstraints()[last, _])) __builtin_trap();
-  }
-  for (IR::Addr *A : tlf.getTreeResult().getAddr()) {
-    A->setEdgeIn(-1);
-    A->setEdgeOut(-1);
-  }
-  deps.clear();
+  deps.check(tlf.getAlloc(), msrc, mtgt01);
+  EXPECT_EQ(deps.size(), 1);
+  poly::Dependence d0{deps[0]};
+  EXPECT_TRUE(d0.isForward());
+  std::cout << d0 << "\n";
+  if (!d0.isForward()) __builtin_trap();
+  if (allZero(d0.getSatConstraints()[last, _])) __builtin_trap();
+  deps.check(tlf.getAlloc(), msrc, mtgt10);
+  EXPECT_EQ(deps.size(), 2);
+  poly::Dependence d1{deps[1]};
+  EXPECT_TRUE(d1.isForward());
+  std::cout << d1 << "\n";
+  if (!d1.isForward()) __builtin_trap();
+  if (allZero(d1.getSatConstraints()[last, _])) __builtin_trap();
+}
 
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DoubleDependenceSchedule, BasicAssertions) {
+  TestLoopFunction tlf;
+  buildStencil(tlf);
+  IR::Cache &ir = tlf.getIRC();
+  poly::Dependencies deps{};
   alloc::OwningArena salloc;
   lp::LoopBlock loopBlock{deps, salloc};
   lp::LoopBlock::OptimizationResult optRes =
@@ -241,8 +268,322 @@ TEST(DoubleDependenceTest, BasicAssertions) {
     EXPECT_TRUE(allZero(s.getFusionOmega()));
   }
   EXPECT_EQ(numEdges, 2);
+  EXPECT_FALSE(loopBlock.getPresolveReports().empty());
+  for (lp::PresolveReport r : loopBlock.getPresolveReports()) {
+    EXPECT_LE(r.presolvedRows, r.rows);
+    EXPECT_LE(r.presolvedCols, r.cols);
+  }
 
-  // Graphs::print(iOuterLoopNest.fullGraph());
+  // Presolving the tableau leaves the schedule unchanged.
+  std::vector<DenseMatrix<int64_t>> phis;
+  for (auto *node : optRes.nodes->getAllVertices())
+    phis.emplace_back(node->getSchedule().getPhi());
+  tlf.clearDependencies(deps);
+  alloc::OwningArena palloc;
+  lp::LoopBlock unpresolved{deps, palloc, {}, false, false, nullptr, {},
+                            {.tableau = false}};
+  lp::LoopBlock::OptimizationResult unpresolvedRes =
+    unpresolved.optimize(ir, tlf.getTreeResult());
+  ASSERT_NE(unpresolvedRes.nodes, nullptr);
+  for (lp::PresolveReport r : unpresolved.getPresolveReports()) {
+    EXPECT_EQ(r.presolvedRows, r.rows);
+    EXPECT_EQ(r.presolvedCols, r.cols);
+  }
+  size_t numNodes = 0;
+  for (auto *node : unpresolvedRes.nodes->getAllVertices()) {
+    ASSERT_LT(numNodes, phis.size());
+    EXPECT_EQ(node->getSchedule().getPhi(), phis[numNodes]);
+    EXPECT_TRUE(allZero(node->getSchedule().getOffsetOmega()));
+    EXPECT_TRUE(allZero(node->getSchedule().getFusionOmega()));
+    ++numNodes;
+  }
+  EXPECT_EQ(numNodes, phis.size());
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DoubleDependenceBands, BasicAssertions) {
+  // Scheduling Pluto-style, both levels form a tileable band: each edge has
+  // non-negative distance at each level.
+  TestLoopFunction tlf;
+  buildStencil(tlf);
+  poly::Dependencies deps{};
+  alloc::OwningArena balloc;
+  lp::LoopBlock bandBlock{deps, balloc, {}, false, true};
+  lp::LoopBlock::OptimizationResult bandRes =
+    bandBlock.optimize(tlf.getIRC(), tlf.getTreeResult());
+  ASSERT_NE(bandRes.nodes, nullptr);
+  size_t numEdges = 0;
+  for (auto *node : bandRes.nodes->getAllVertices()) {
+    for (auto e : node->outputEdges(deps)) {
+      ++numEdges;
+      IR::Addr *in = e.input(), *out = e.output();
+      if (!e.isForward()) std::swap(in, out);
+      poly::AffineSchedule sx = in->getNode()->getSchedule(),
+                           sy = out->getNode()->getSchedule();
+      for (size_t d = 0; d < 2; ++d)
+        EXPECT_TRUE(e.isSatisfied(*bandBlock.getAllocator(), &sx, &sy, d));
+    }
+  }
+  EXPECT_EQ(numEdges, 2);
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DoubleDependenceLPBudget, BasicAssertions) {
+  // Over the LP budget, the nest keeps its original schedule, with the
+  // dependencies satisfied as in the original program.
+  TestLoopFunction tlf;
+  buildStencil(tlf);
+  poly::Dependencies deps{};
+  alloc::OwningArena cutalloc;
+  lp::LoopBlock cutBlock{deps, cutalloc, {.lpWork = 1}};
+  lp::LoopBlock::OptimizationResult cutRes =
+    cutBlock.optimize(tlf.getIRC(), tlf.getTreeResult());
+  EXPECT_EQ(cutBlock.budgetCut(), lp::ScheduleBudget::LPWork);
+  ASSERT_NE(cutRes.nodes, nullptr);
+  EXPECT_TRUE(cutRes.original);
+  EXPECT_TRUE(cutRes.depsChecked);
+  size_t numEdges = 0;
+  for (auto *node : cutRes.nodes->getAllVertices()) {
+    EXPECT_EQ(node->getSchedule().getPhi(), identity2());
+    EXPECT_EQ(node->getOffset(), nullptr);
+    for (auto e : node->outputEdges(deps)) {
+      ++numEdges;
+      EXPECT_LE(e.satLevel(), 4);
+    }
+  }
+  EXPECT_EQ(numEdges, 2);
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DoubleDependencePairBudget, BasicAssertions) {
+  // Over the dependence pair budget, nothing is checked, and the result says
+  // so, so that no loop is reordered.
+  TestLoopFunction tlf;
+  buildStencil(tlf);
+  poly::Dependencies deps{};
+  alloc::OwningArena pairalloc;
+  lp::LoopBlock pairBlock{deps, pairalloc, {.depPairs = -1}};
+  lp::LoopBlock::OptimizationResult pairRes =
+    pairBlock.optimize(tlf.getIRC(), tlf.getTreeResult());
+  EXPECT_EQ(pairBlock.budgetCut(), lp::ScheduleBudget::DepPairs);
+  ASSERT_NE(pairRes.nodes, nullptr);
+  EXPECT_TRUE(pairRes.original);
+  EXPECT_FALSE(pairRes.depsChecked);
+  for (auto *node : pairRes.nodes->getAllVertices())
+    EXPECT_EQ(node->getSchedule().getPhi(), identity2());
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DoubleDependenceBandLegality, BasicAssertions) {
+  // The stencil's band is two deep, and its outer loop carries dependencies,
+  // which is what the `Band` remark reports.
+  TestLoopFunction tlf;
+  buildStencil(tlf);
+  IR::Cache &ir = tlf.getIRC();
+  poly::Dependencies deps{};
+  alloc::OwningArena bandalloc;
+  lp::LoopBlock bandBlock{deps, bandalloc, {}, false, true};
+  lp::LoopBlock::OptimizationResult bandRes =
+    bandBlock.optimize(ir, tlf.getTreeResult());
+  ASSERT_NE(bandRes.nodes, nullptr);
+  dict::set<llvm::BasicBlock *> loop_bbs{};
+  dict::set<llvm::CallBase *> erase_candidates{};
+  auto [root, loop_count] = CostModeling::buildLoopTree(
+    bandalloc, deps, ir, loop_bbs, erase_candidates, bandRes);
+  EXPECT_EQ(loop_count, 2);
+  IR::Loop *outer = root->getSubLoop();
+  ASSERT_NE(outer, nullptr);
+  IR::Loop *inner = outer->getSubLoop();
+  ASSERT_NE(inner, nullptr);
+  EXPECT_FALSE(outer->getLegality().parallel_);
+  EXPECT_TRUE(inner->getLegality().tileable_);
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(IndependencePrefilters, BasicAssertions) {
+  // for (i = 0:9){
+  //   A[0] = 0;  x = A[1];      // constant offsets
+  //   B[2i] = 0; x = B[2i+1];   // GCD
+  //   C[i] = 0;  x = C[i+20];   // Banerjee
+  //   D[i] = 0;  x = D[i+1];    // overlaps, left to the polyhedral test
+  // }
+  TestLoopFunction tlf;
+  poly::Loop *loop = tlf.addLoop("[9 -1; "  // i <= 9
+                                 "0 1]"_mat, // i >= 0
+                                 1);
+  IR::Cache &ir = tlf.getIRC();
+  IR::Value *zero = ir.createConstant(tlf.getDoubleTy(), 0.0);
+  std::array<IR::Value *, 1> sizes{tlf.getConstInt(1)};
+  // `ptr[c * i + ostow] = 0` at `wstow`, and a load of `ptr[c * i + oload]`
+  // at `wload`
+  auto pair = [&](IntMatrix<> c, IntMatrix<> ostow, IntMatrix<> oload,
+                  IntMatrix<> wstow,
+                  IntMatrix<> wload) -> std::array<IR::Addr *, 2> {
+    IR::FunArg *ptr = tlf.createArray();
+    IR::Addr *stow = tlf.createStow(ptr, zero, c, ostow, sizes, wstow, loop);
+    IR::Addr *load =
+      tlf.createLoad(ptr, tlf.getDoubleTy(), c, oload, sizes, wload, loop);
+    return {stow, load};
+  };
+  auto [sA, lA] =
+    pair("[0]"_mat, "[0]"_mat, "[1]"_mat, "[0 0]"_mat, "[0 1]"_mat);
+  auto [sB, lB] =
+    pair("[2]"_mat, "[0]"_mat, "[1]"_mat, "[0 2]"_mat, "[0 3]"_mat);
+  auto [sC, lC] =
+    pair("[1]"_mat, "[0]"_mat, "[20]"_mat, "[0 4]"_mat, "[0 5]"_mat);
+  auto [sD, lD] =
+    pair("[1]"_mat, "[0]"_mat, "[1]"_mat, "[0 6]"_mat, "[0 7]"_mat);
+
+  poly::Dependencies deps{};
+  const poly::IndependenceTests &tests = deps.independenceTests();
+  deps.check(tlf.getAlloc(), sA, lA);
+  EXPECT_EQ(tests.offset(), 1);
+  EXPECT_EQ(tests.gcd(), 0);
+  EXPECT_EQ(tests.banerjee(), 0);
+  EXPECT_EQ(tests.polyhedral(), 0);
+  deps.check(tlf.getAlloc(), sB, lB);
+  EXPECT_EQ(tests.offset(), 1);
+  EXPECT_EQ(tests.gcd(), 1);
+  EXPECT_EQ(tests.banerjee(), 0);
+  EXPECT_EQ(tests.polyhedral(), 0);
+  deps.check(tlf.getAlloc(), sC, lC);
+  EXPECT_EQ(tests.offset(), 1);
+  EXPECT_EQ(tests.gcd(), 1);
+  EXPECT_EQ(tests.banerjee(), 1);
+  EXPECT_EQ(tests.polyhedral(), 0);
+  // the pairs proven independent have no edges
+  EXPECT_EQ(deps.size(), 0);
+  for (IR::Addr *a : {sA, lA, sB, lB, sC, lC}) {
+    EXPECT_EQ(a->getEdgeIn(), -1);
+    EXPECT_EQ(a->getEdgeOut(), -1);
+  }
+  deps.check(tlf.getAlloc(), sD, lD);
+  EXPECT_EQ(tests.offset(), 1);
+  EXPECT_EQ(tests.gcd(), 1);
+  EXPECT_EQ(tests.banerjee(), 1);
+  EXPECT_EQ(tests.polyhedral(), 1);
+  // `D[i+1]` is loaded an iteration before it is stored: sD <- lD
+  EXPECT_EQ(deps.size(), 1);
+  EXPECT_NE(sD->getEdgeIn(), -1);
+  EXPECT_EQ(sD->getEdgeIn(), lD->getEdgeOut());
+}
+
+// `A[i,j] = 0; x = A[i+1,j]; B[i+1,j] = 0; y = B[i+2,j];`, returning the
+// stores and loads of `A` and `B`.
+inline auto buildShifted(TestLoopFunction &tlf) -> std::array<IR::Addr *, 4> {
+  poly::Loop *loop = tlf.addLoop("[-2 1 0 -1 0; " // i <= II-2
+                                 "0 0 0 1 0; "    // i >= 0
+                                 "-2 0 1 0 -1; "  // j <= JJ-2
+                                 "0 0 0 0 1]"_mat, // j >= 0
+                                 2);
+  IR::Value *zero = tlf.getIRC().createConstant(tlf.getDoubleTy(), 0.0);
+  std::array<IR::Value *, 2> sizes{loop->getSyms()[1], tlf.getConstInt(1)};
+  IR::FunArg *ptrA = tlf.createArray(), *ptrB = tlf.createArray();
+  IR::Addr *stowA = tlf.createStow(ptrA, zero, "[1 0; 0 1]"_mat, "[0 0]"_mat,
+                                   sizes, "[0 0 0]"_mat, loop);
+  IR::Addr *loadA =
+    tlf.createLoad(ptrA, tlf.getDoubleTy(), "[1 0; 0 1]"_mat, "[1 0]"_mat,
+                   sizes, "[0 0 1]"_mat, loop);
+  IR::Addr *stowB = tlf.createStow(ptrB, zero, "[1 0; 0 1]"_mat, "[1 0]"_mat,
+                                   sizes, "[0 0 2]"_mat, loop);
+  IR::Addr *loadB =
+    tlf.createLoad(ptrB, tlf.getDoubleTy(), "[1 0; 0 1]"_mat, "[2 0]"_mat,
+                   sizes, "[0 0 3]"_mat, loop);
+  return {stowA, loadA, stowB, loadB};
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DepPolyCacheShifted, BasicAssertions) {
+  // `B`'s pair is `A`'s shifted by one, so it reuses `A`'s `DepPoly`
+  TestLoopFunction tlf;
+  auto [stowA, loadA, stowB, loadB] = buildShifted(tlf);
+  poly::Dependencies deps{};
+  deps.check(tlf.getAlloc(), stowA, loadA);
+  EXPECT_EQ(deps.depPolyCache().hits(), 0);
+  EXPECT_EQ(deps.depPolyCache().misses(), 1);
+  deps.check(tlf.getAlloc(), stowB, loadB);
+  EXPECT_EQ(deps.depPolyCache().hits(), 1);
+  EXPECT_EQ(deps.depPolyCache().misses(), 1);
+  ASSERT_EQ(deps.size(), 2);
+  // stowB <- loadB
+  ASSERT_NE(stowB->getEdgeIn(), -1);
+  EXPECT_EQ(stowB->getEdgeIn(), loadB->getEdgeOut());
+  poly::Dependence cached{deps[stowB->getEdgeIn()]};
+
+  // the same pair of `B`, built from scratch
+  TestLoopFunction tlf2;
+  auto [stowA2, loadA2, stowB2, loadB2] = buildShifted(tlf2);
+  poly::Dependencies fresh{};
+  fresh.check(tlf2.getAlloc(), stowB2, loadB2);
+  EXPECT_EQ(fresh.depPolyCache().hits(), 0);
+  EXPECT_EQ(fresh.depPolyCache().misses(), 1);
+  ASSERT_EQ(fresh.size(), 1);
+  ASSERT_NE(stowB2->getEdgeIn(), -1);
+  EXPECT_EQ(stowB2->getEdgeIn(), loadB2->getEdgeOut());
+  poly::Dependence uncached{fresh[stowB2->getEdgeIn()]};
+  EXPECT_EQ(cached.isForward(), uncached.isForward());
+  EXPECT_EQ(cached.satLevel(), uncached.satLevel());
+  EXPECT_EQ(cached.getSatConstraints(), uncached.getSatConstraints());
+  EXPECT_EQ(cached.getBndConstraints(), uncached.getBndConstraints());
+}
+
+// for (i = 0:I, j = 0:J){ B[j,i] = A[j,i]; C[j,i] = B[j,i]; }
+// Each array is contiguous along `i`, the outer loop.
+inline void buildTransposed(TestLoopFunction &tlf) {
+  poly::Loop *loop = tlf.addLoop("[-1 1 0 -1 0; " // i <= I-1
+                                 "0 0 0 1 0; "    // i >= 0
+                                 "-1 0 1 0 -1; "  // j <= J-1
+                                 "0 0 0 0 1]"_mat, // j >= 0
+                                 2);
+  std::array<IR::Value *, 2> sizes{loop->getSyms()[0], tlf.getConstInt(1)};
+  IR::FunArg *ptrA = tlf.createArray(), *ptrB = tlf.createArray(),
+             *ptrC = tlf.createArray();
+  IR::Addr *loadA = tlf.createLoad(ptrA, tlf.getDoubleTy(), "[0 1; 1 0]"_mat,
+                                   sizes, "[0 0 0]"_mat, loop);
+  tlf.createStow(ptrB, loadA, "[0 1; 1 0]"_mat, sizes, "[0 0 1]"_mat, loop);
+  IR::Addr *loadB = tlf.createLoad(ptrB, tlf.getDoubleTy(), "[0 1; 1 0]"_mat,
+                                   sizes, "[0 0 2]"_mat, loop);
+  tlf.createStow(ptrC, loadB, "[0 1; 1 0]"_mat, sizes, "[0 0 3]"_mat, loop);
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(LocalityObjective, BasicAssertions) {
+  // With the locality objective, `j` becomes the outer loop, so that the
+  // inner loop `i` accesses each array with stride one.
+  DenseMatrix<int64_t> swapped(math::DenseDims<>{math::row(2), math::col(2)},
+                               0);
+  swapped[0, 1] = 1;
+  swapped[1, 0] = 1;
+  TestLoopFunction tlf;
+  buildTransposed(tlf);
+  poly::Dependencies deps{};
+  alloc::OwningArena localloc;
+  lp::LoopBlock localBlock{deps, localloc, {}, true};
+  lp::LoopBlock::OptimizationResult localRes =
+    localBlock.optimize(tlf.getIRC(), tlf.getTreeResult());
+  ASSERT_NE(localRes.nodes, nullptr);
+  EXPECT_FALSE(localRes.original);
+  size_t numNodes = 0;
+  for (auto *node : localRes.nodes->getAllVertices()) {
+    ++numNodes;
+    EXPECT_EQ(node->getSchedule().getPhi(), swapped);
+  }
+  EXPECT_EQ(numNodes, 2);
+  // Without it, the original order is kept.
+  TestLoopFunction tlf2;
+  buildTransposed(tlf2);
+  poly::Dependencies deps2{};
+  alloc::OwningArena origalloc;
+  lp::LoopBlock origBlock{deps2, origalloc};
+  lp::LoopBlock::OptimizationResult origRes =
+    origBlock.optimize(tlf2.getIRC(), tlf2.getTreeResult());
+  ASSERT_NE(origRes.nodes, nullptr);
+  numNodes = 0;
+  for (auto *node : origRes.nodes->getAllVertices()) {
+    ++numNodes;
+    EXPECT_EQ(node->getSchedule().getPhi(), identity2());
+  }
+  EXPECT_EQ(numNodes, 2);
 }
 
 inline auto addrChainLen(const TestLoopFunction &tlf) -> int {
@@ -355,4 +696,17 @@ TEST(ConvReversePass, BasicAssertions) {
     std::cout << "A = " << A << '\n';
     std::cout << "==================================" << '\n';
   }
-}
\ No newline at end of file
+}
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(LPFileRoundTrip, BasicAssertions) {
+  DenseMatrix<int64_t> C{"[3 1 -2 0 0; 0 0 1 -1 7; 5 0 0 0 0]"_mat};
+  for (std::optional<ptrdiff_t> stop : {std::optional<ptrdiff_t>{},
+                                        std::optional<ptrdiff_t>{2}}) {
+    std::stringstream ss;
+    lp::LPFile::write(ss, C, stop);
+    std::optional<lp::LPFile> lp = lp::LPFile::read(ss);
+    ASSERT_TRUE(lp.has_value());
+    EXPECT_EQ(lp->C, C);
+    EXPECT_EQ(lp->stop, stop);
+  }
+}
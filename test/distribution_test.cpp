@@ -0,0 +1,213 @@
+#include <gtest/gtest.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/DependenceAnalysis.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/Casting.h>
+#ifndef USE_MODULE
+#include "Backends/Distribution.cxx"
+#include "TestUtilities.cxx"
+#else
+
+import Distribution;
+import TestUtilities;
+#endif
+
+namespace {
+
+// Distributes the first outermost loop of `@f`.
+auto distribute(TestIRFunction &tf) -> llvm::Loop * {
+  llvm::LoopInfo &li = tf.get<llvm::LoopAnalysis>();
+  codegen::Distribution dist{&li, &tf.get<llvm::DominatorTreeAnalysis>(),
+                             &tf.get<llvm::ScalarEvolutionAnalysis>(),
+                             &tf.get<llvm::AAManager>(),
+                             &tf.get<llvm::DependenceAnalysis>()};
+  return dist.distribute(*li.begin());
+}
+auto countIn(llvm::Loop *L, bool (*pred)(const llvm::Instruction &)) -> int {
+  int n = 0;
+  for (llvm::BasicBlock *BB : L->blocks()) n += int(llvm::count_if(*BB, pred));
+  return n;
+}
+auto isStore(const llvm::Instruction &I) -> bool {
+  return llvm::isa<llvm::StoreInst>(I);
+}
+auto isCall(const llvm::Instruction &I) -> bool {
+  return llvm::isa<llvm::CallInst>(I);
+}
+// Checks that distributing `@f` of `ir` was rejected, leaving it unchanged.
+void expectRejected(const char *ir) {
+  TestIRFunction tf{ir};
+  EXPECT_EQ(distribute(tf), nullptr);
+  EXPECT_TRUE(tf.verify());
+  EXPECT_EQ(tf.get<llvm::LoopAnalysis>().getTopLevelLoops().size(), 1);
+}
+
+} // namespace
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DistributionSplit, BasicAssertions) {
+  // for (i = 0; i < n; ++i){
+  //   a[i] = 2 * b[i];
+  //   g(); // touches no memory we can see
+  // }
+  TestIRFunction tf{R"(
+declare void @g() nounwind willreturn memory(inaccessiblemem: readwrite)
+
+define void @f(ptr noalias %a, ptr noalias %b, i64 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pb = getelementptr inbounds double, ptr %b, i64 %i
+  %x = load double, ptr %pb
+  %y = fmul double %x, 2.0
+  %pa = getelementptr inbounds double, ptr %a, i64 %i
+  store double %y, ptr %pa
+  call void @g()
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+)"};
+  llvm::Loop *L = *tf.get<llvm::LoopAnalysis>().begin();
+  llvm::Loop *copy = distribute(tf);
+  ASSERT_NE(copy, nullptr);
+  EXPECT_TRUE(tf.verify());
+  EXPECT_EQ(tf.get<llvm::LoopAnalysis>().getTopLevelLoops().size(), 2);
+  // the affine copy runs first, and holds the store but not the call
+  EXPECT_EQ(countIn(copy, isStore), 1);
+  EXPECT_EQ(countIn(copy, isCall), 0);
+  EXPECT_EQ(countIn(L, isStore), 0);
+  EXPECT_EQ(countIn(L, isCall), 1);
+  EXPECT_TRUE(tf.get<llvm::DominatorTreeAnalysis>().dominates(
+    copy->getHeader(), L->getHeader()));
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DistributionBackwardDependence, BasicAssertions) {
+  // for (i = 0; i < n; ++i){
+  //   b[i] = a[i]; // reads what the previous iteration's call result stored
+  //   a[i + 1] = h(i);
+  // }
+  expectRejected(R"(
+declare double @h(i64) nounwind willreturn memory(inaccessiblemem: readwrite)
+
+define void @f(ptr %a, ptr noalias %b, i64 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pa = getelementptr inbounds double, ptr %a, i64 %i
+  %x = load double, ptr %pa
+  %pb = getelementptr inbounds double, ptr %b, i64 %i
+  store double %x, ptr %pb
+  %r = call double @h(i64 %i)
+  %i.next = add nuw nsw i64 %i, 1
+  %pa.next = getelementptr inbounds double, ptr %a, i64 %i.next
+  store double %r, ptr %pa.next
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+)");
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DistributionConfusedDependence, BasicAssertions) {
+  // `a` and `c` may alias, so `llvm::DependenceInfo` cannot tell the order
+  // for (i = 0; i < n; ++i){
+  //   c[i] = b[i];
+  //   a[i] = h(i);
+  // }
+  expectRejected(R"(
+declare double @h(i64) nounwind willreturn memory(inaccessiblemem: readwrite)
+
+define void @f(ptr %a, ptr noalias %b, ptr %c, i64 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pb = getelementptr inbounds double, ptr %b, i64 %i
+  %x = load double, ptr %pb
+  %pc = getelementptr inbounds double, ptr %c, i64 %i
+  store double %x, ptr %pc
+  %r = call double @h(i64 %i)
+  %pa = getelementptr inbounds double, ptr %a, i64 %i
+  store double %r, ptr %pa
+  %i.next = add nuw nsw i64 %i, 1
+  %cmp = icmp slt i64 %i.next, %n
+  br i1 %cmp, label %loop, label %exit
+exit:
+  ret void
+}
+)");
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DistributionCallWritesAffineMemory, BasicAssertions) {
+  // for (i = 0; i < n; ++i){
+  //   a[i] = b[i];
+  //   w(a); // may write any element of `a`
+  // }
+  expectRejected(R"(
+declare void @w(ptr) nounwind willreturn memory(argmem: write)
+
+define void @f(ptr noalias %a, ptr noalias %b, i64 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pb = getelementptr inbounds double, ptr %b, i64 %i
+  %x = load double, ptr %pb
+  %pa = getelementptr inbounds double, ptr %a, i64 %i
+  store double %x, ptr %pa
+  call void @w(ptr %a)
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+)");
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(DistributionMultipleExits, BasicAssertions) {
+  // for (i = 0; i < n; ++i){
+  //   if (b[i] < 0) break;
+  //   a[i] = b[i];
+  //   g();
+  // }
+  expectRejected(R"(
+declare void @g() nounwind willreturn memory(inaccessiblemem: readwrite)
+
+define void @f(ptr noalias %a, ptr noalias %b, i64 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %latch ]
+  %pb = getelementptr inbounds double, ptr %b, i64 %i
+  %x = load double, ptr %pb
+  %neg = fcmp olt double %x, 0.0
+  br i1 %neg, label %exit, label %latch
+latch:
+  %pa = getelementptr inbounds double, ptr %a, i64 %i
+  store double %x, ptr %pa
+  call void @g()
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+)");
+}
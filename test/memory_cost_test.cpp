@@ -0,0 +1,98 @@
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#ifndef USE_MODULE
+#include "Math/Array.cxx"
+#include "Optimize/MemoryCost.cxx"
+#include "Optimize/Unrolls.cxx"
+#include "Utilities/MatrixStringParse.cxx"
+#else
+
+import Array;
+import ArrayParse;
+import CostModeling;
+#endif
+
+using CostModeling::Unrolls, CostModeling::UnrollBatch,
+  CostModeling::Cost::CostBatch, CostModeling::Cost::MemCostSummary,
+  math::IntMatrix, utils::operator""_mat;
+
+namespace {
+
+constexpr ptrdiff_t unroll_batch = 8;
+
+auto summary(uint32_t contig, uint32_t dep, double noncon) -> MemCostSummary {
+  return {.loadstowcost_ = {IR::Addr::Costs{.scalar_ = 1.0,
+                                            .contig_ = 2.0,
+                                            .noncon_ = noncon},
+                            IR::Addr::Costs{.scalar_ = 1.5,
+                                            .contig_ = 2.5,
+                                            .noncon_ = 1.5 * noncon}},
+          .orth_ = {.contig_ = contig, .conv_axes_ = 0, .dep_ = dep}};
+}
+// Checks that each lane of the batched costs equals the scalar cost of that
+// lane, for every contiguous and dependent axes of a depth-3 nest.
+void expectLanesMatch(const UnrollBatch<unroll_batch> &batch) {
+  // gathers cheaper and costlier than shuffles, respectively
+  for (double noncon : {3.0, 40.0}) {
+    for (uint32_t contig = 0; contig < 8; ++contig) {
+      for (uint32_t dep = 0; dep < 8; ++dep) {
+        MemCostSummary mcs = summary(contig, dep, noncon);
+        CostBatch<unroll_batch> costs = CostModeling::Cost::cost(batch, mcs);
+        for (ptrdiff_t w = 0; w < unroll_batch; ++w) {
+          CostModeling::Cost::Cost c =
+            CostModeling::Cost::cost(batch.lane(w), mcs);
+          EXPECT_EQ(costs.load_[w], c.load_);
+          EXPECT_EQ(costs.stow_[w], c.stow_);
+          EXPECT_EQ(costs.comp_[w], c.comp_);
+        }
+      }
+    }
+  }
+}
+
+} // namespace
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(MemoryCostBatchLanes, BasicAssertions) {
+  // for (i = 0:64, j = 0:100, k = 0:37), with `j`'s trip count an estimate
+  Unrolls unrolls{};
+  unrolls.pushUnroll(2, 64, true);
+  unrolls.pushUnroll(3, 100, false);
+  unrolls.pushUnroll(1, 37, true);
+  // not vectorized
+  expectLanesMatch(UnrollBatch<unroll_batch>{unrolls, 1});
+  // the current loop vectorized
+  unrolls.setVF(2);
+  expectLanesMatch(UnrollBatch<unroll_batch>{unrolls, 1});
+  expectLanesMatch(UnrollBatch<unroll_batch>{unrolls, 9});
+  // an outer loop vectorized, so the current one may be contiguous
+  Unrolls outer{};
+  outer.pushUnroll(2, 64, true);
+  outer.pushUnroll(3, 100, false);
+  outer.setVF(3);
+  outer.pushUnroll(1, 37, true);
+  expectLanesMatch(UnrollBatch<unroll_batch>{outer, 1});
+  // the outer and current loops share the lanes
+  Unrolls twod{};
+  twod.pushUnroll(1, 64, true);
+  twod.setVF(1);
+  twod.pushUnroll(3, 100, false);
+  twod.pushUnroll(1, 37, true);
+  twod.setVF(2);
+  expectLanesMatch(UnrollBatch<unroll_batch>{twod, 1});
+  // `A[i + k, j]`, which does not fit orthogonal axes
+  IntMatrix<> inds = "[1 0 1; 0 1 0]"_mat;
+  MemCostSummary mcs = summary(0x2, 0x7, 40.0);
+  for (const Unrolls &u : {unrolls, outer}) {
+    UnrollBatch<unroll_batch> batch{u, 1};
+    CostBatch<unroll_batch> costs = CostModeling::Cost::cost(batch, mcs, inds);
+    for (ptrdiff_t w = 0; w < unroll_batch; ++w) {
+      CostModeling::Cost::Cost c =
+        CostModeling::Cost::cost(batch.lane(w), mcs, inds);
+      EXPECT_EQ(costs.load_[w], c.load_);
+      EXPECT_EQ(costs.stow_[w], c.stow_);
+      EXPECT_EQ(costs.comp_[w], c.comp_);
+    }
+  }
+}
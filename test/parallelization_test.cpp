@@ -0,0 +1,249 @@
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Support/raw_ostream.h>
+#include <optional>
+#ifndef USE_MODULE
+#include "Backends/Parallelization.cxx"
+#include "TestUtilities.cxx"
+#else
+
+import Parallelization;
+import TestUtilities;
+#endif
+
+namespace {
+
+// Outlines the first outermost loop of `@f`, returning the call to the
+// runtime, or `nullptr` if the loop was rejected.
+auto outline(TestIRFunction &tf, codegen::ParallelPlan p)
+  -> llvm::CallInst * {
+  llvm::LoopInfo &li = tf.get<llvm::LoopAnalysis>();
+  codegen::Parallelization par{&li, &tf.get<llvm::DominatorTreeAnalysis>(),
+                               &tf.get<llvm::ScalarEvolutionAnalysis>(),
+                               &tf.get<llvm::AssumptionAnalysis>()};
+  p.loop_ = *li.begin();
+  std::optional<codegen::Parallelization::Candidate> c = par.analyze(p);
+  if (!c) return nullptr;
+  par.outline(*c);
+  // `LoopInfo` is left stale, so we only check the IR itself
+  EXPECT_FALSE(llvm::verifyModule(tf.getModule(), &llvm::errs()));
+  for (llvm::Instruction &I : llvm::instructions(tf.getFunction()))
+    if (auto *call = llvm::dyn_cast<llvm::CallInst>(&I))
+      if (llvm::Function *callee = call->getCalledFunction();
+          callee && callee->getName() == "turboloop_parallel_for")
+        return call;
+  ADD_FAILURE() << "no call to turboloop_parallel_for";
+  return nullptr;
+}
+auto chunkArg(llvm::CallInst *call) -> int64_t {
+  return llvm::cast<llvm::ConstantInt>(call->getArgOperand(2))->getSExtValue();
+}
+auto functionArg(llvm::CallInst *call, unsigned i) -> llvm::Function * {
+  return llvm::dyn_cast<llvm::Function>(call->getArgOperand(i));
+}
+// The predicate of the comparison left in `@f`, i.e. the trip count guard,
+// once the loop has been outlined.
+auto guardPredicate(llvm::Function &F) -> llvm::CmpInst::Predicate {
+  for (llvm::Instruction &I : llvm::instructions(F))
+    if (auto *cmp = llvm::dyn_cast<llvm::ICmpInst>(&I))
+      return cmp->getPredicate();
+  ADD_FAILURE() << "no trip count guard";
+  return llvm::CmpInst::BAD_ICMP_PREDICATE;
+}
+// Whether no loop is left in `@f`.
+auto loopFree(llvm::Function &F) -> bool {
+  llvm::DominatorTree dt{F};
+  llvm::LoopInfo li{dt};
+  return li.empty();
+}
+
+} // namespace
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(ParallelizeInduction, BasicAssertions) {
+  // for (i = 0; i < n; ++i) a[i] = 2 * b[i];
+  // return i;
+  TestIRFunction tf{R"(
+define i64 @f(ptr noalias %a, ptr noalias %b, i64 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pb = getelementptr inbounds double, ptr %b, i64 %i
+  %x = load double, ptr %pb
+  %y = fmul double %x, 2.0
+  %pa = getelementptr inbounds double, ptr %a, i64 %i
+  store double %y, ptr %pa
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  %i.lcssa = phi i64 [ %i.next, %loop ]
+  ret i64 %i.lcssa
+}
+)"};
+  llvm::CallInst *call =
+    outline(tf, {.loop_ = nullptr, .chunk_ = 8, .reductions_ = false});
+  ASSERT_NE(call, nullptr);
+  EXPECT_EQ(chunkArg(call), 8);
+  llvm::Function *body = functionArg(call, 3);
+  ASSERT_NE(body, nullptr);
+  EXPECT_TRUE(body->getName().ends_with(".body"));
+  // no reductions, so no combine function
+  EXPECT_TRUE(llvm::isa<llvm::ConstantPointerNull>(call->getArgOperand(7)));
+  EXPECT_TRUE(loopFree(tf.getFunction()));
+  EXPECT_EQ(guardPredicate(tf.getFunction()), llvm::CmpInst::ICMP_SLE);
+  // the live-out is recomputed from the trip count, not read from the loop
+  for (llvm::Instruction &I : llvm::instructions(tf.getFunction()))
+    if (auto *ret = llvm::dyn_cast<llvm::ReturnInst>(&I))
+      EXPECT_FALSE(llvm::isa<llvm::PHINode>(ret->getReturnValue()));
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(ParallelizeUnsigned, BasicAssertions) {
+  // for (i = lo; i < n; ++i) a[i] = 2 * b[i];
+  // with unsigned `i`, so `n - lo` may be negative as a signed `i64` while
+  // the loop runs many iterations
+  TestIRFunction tf{R"(
+define void @f(ptr noalias %a, ptr noalias %b, i64 %lo, i64 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ %lo, %entry ], [ %i.next, %loop ]
+  %pb = getelementptr inbounds double, ptr %b, i64 %i
+  %x = load double, ptr %pb
+  %y = fmul double %x, 2.0
+  %pa = getelementptr inbounds double, ptr %a, i64 %i
+  store double %y, ptr %pa
+  %i.next = add nuw i64 %i, 1
+  %c = icmp ult i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+)"};
+  llvm::CallInst *call =
+    outline(tf, {.loop_ = nullptr, .chunk_ = 0, .reductions_ = false});
+  ASSERT_NE(call, nullptr);
+  EXPECT_TRUE(loopFree(tf.getFunction()));
+  EXPECT_EQ(guardPredicate(tf.getFunction()), llvm::CmpInst::ICMP_ULE);
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(ParallelizeUnrolled, BasicAssertions) {
+  // for (i = 0, j = 0; i < n; i += 2, ++j) b[j] = a[i];
+  // unrolled by two, returning `j` as of the last iteration
+  TestIRFunction tf{R"(
+define i64 @f(ptr noalias %a, ptr noalias %b, i64 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %j = phi i64 [ 0, %entry ], [ %j.next, %loop ]
+  %pa0 = getelementptr inbounds double, ptr %a, i64 %i
+  %x0 = load double, ptr %pa0
+  %pb0 = getelementptr inbounds double, ptr %b, i64 %j
+  store double %x0, ptr %pb0
+  %i1 = add nuw nsw i64 %i, 2
+  %j1 = add nuw nsw i64 %j, 1
+  %pa1 = getelementptr inbounds double, ptr %a, i64 %i1
+  %x1 = load double, ptr %pa1
+  %pb1 = getelementptr inbounds double, ptr %b, i64 %j1
+  store double %x1, ptr %pb1
+  %i.next = add nuw nsw i64 %i, 4
+  %j.next = add nuw nsw i64 %j, 2
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  %j.lcssa = phi i64 [ %j, %loop ]
+  ret i64 %j.lcssa
+}
+)"};
+  // 9 original iterations are 5 unrolled ones, although the controlling
+  // induction steps by 4
+  llvm::CallInst *call = outline(
+    tf, {.loop_ = nullptr, .chunk_ = 9, .reductions_ = false, .unroll_ = 2});
+  ASSERT_NE(call, nullptr);
+  EXPECT_EQ(chunkArg(call), 5);
+  EXPECT_TRUE(loopFree(tf.getFunction()));
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(ParallelizeReduction, BasicAssertions) {
+  // double s = 0; for (i = 0; i < n; ++i) s += b[i]; return s;
+  const char *ir = R"(
+define double @f(ptr noalias %b, i64 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi double [ 0.0, %entry ], [ %s.next, %loop ]
+  %pb = getelementptr inbounds double, ptr %b, i64 %i
+  %x = load double, ptr %pb
+  %s.next = fadd fast double %s, %x
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  %s.lcssa = phi double [ %s.next, %loop ]
+  ret double %s.lcssa
+}
+)";
+  {
+    // without `parallel_reductions_`, the reduction stays serial
+    TestIRFunction tf{ir};
+    EXPECT_EQ(
+      outline(tf, {.loop_ = nullptr, .chunk_ = 0, .reductions_ = false}),
+      nullptr);
+  }
+  TestIRFunction tf{ir};
+  llvm::CallInst *call =
+    outline(tf, {.loop_ = nullptr, .chunk_ = 0, .reductions_ = true});
+  ASSERT_NE(call, nullptr);
+  EXPECT_EQ(chunkArg(call), 0);
+  EXPECT_FALSE(llvm::isa<llvm::ConstantPointerNull>(call->getArgOperand(5)));
+  EXPECT_EQ(
+    llvm::cast<llvm::ConstantInt>(call->getArgOperand(6))->getZExtValue(),
+    sizeof(double));
+  llvm::Function *combine = functionArg(call, 7);
+  ASSERT_NE(combine, nullptr);
+  EXPECT_TRUE(combine->getName().ends_with(".combine"));
+  EXPECT_TRUE(loopFree(tf.getFunction()));
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(ParallelizeRecurrence, BasicAssertions) {
+  // a first-order recurrence carries a value across iterations
+  // for (i = 0, p = 0; i < n; ++i){ a[i] = p; p = b[i]; }
+  TestIRFunction tf{R"(
+define void @f(ptr noalias %a, ptr noalias %b, i64 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %p = phi double [ 0.0, %entry ], [ %x, %loop ]
+  %pa = getelementptr inbounds double, ptr %a, i64 %i
+  store double %p, ptr %pa
+  %pb = getelementptr inbounds double, ptr %b, i64 %i
+  %x = load double, ptr %pb
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+)"};
+  EXPECT_EQ(outline(tf, {.loop_ = nullptr, .chunk_ = 0, .reductions_ = true}),
+            nullptr);
+  EXPECT_TRUE(tf.verify());
+}
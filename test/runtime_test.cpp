@@ -0,0 +1,58 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "TurboLoopRuntime.h"
+
+namespace {
+
+void increment(int64_t begin, int64_t end, void *ctx, void *) {
+  auto &counts = *static_cast<std::vector<std::atomic<int>> *>(ctx);
+  for (int64_t i = begin; i < end; ++i)
+    counts[i].fetch_add(1, std::memory_order_relaxed);
+}
+void sum(int64_t begin, int64_t end, void *, void *priv) {
+  for (int64_t i = begin; i < end; ++i) *static_cast<int64_t *>(priv) += i;
+}
+void add(void *acc, const void *partial) {
+  *static_cast<int64_t *>(acc) += *static_cast<const int64_t *>(partial);
+}
+// NOLINTNEXTLINE(misc-no-recursion)
+void nested(int64_t begin, int64_t end, void *ctx, void *) {
+  for (int64_t i = begin; i < end; ++i)
+    turboloop_parallel_for(i * 10, i * 10 + 10, 0, increment, ctx, nullptr, 0,
+                           nullptr);
+}
+
+} // namespace
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(RuntimeTest, EachIterationOnce) {
+  EXPECT_GE(turboloop_num_threads(), 1U);
+  for (int64_t chunk : {0, 1, 3, 64, 100000}) {
+    std::vector<std::atomic<int>> counts(10007);
+    turboloop_parallel_for(0, 10007, chunk, increment, &counts, nullptr, 0,
+                           nullptr);
+    for (std::atomic<int> &c : counts) EXPECT_EQ(c.load(), 1);
+  }
+  // calls from within a body run serially
+  std::vector<std::atomic<int>> counts(1000);
+  turboloop_parallel_for(0, 100, 1, nested, &counts, nullptr, 0, nullptr);
+  for (std::atomic<int> &c : counts) EXPECT_EQ(c.load(), 1);
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(RuntimeTest, PrivateReductions) {
+  for (int64_t chunk : {0, 1, 7, 4096}) {
+    int64_t total = 0;
+    turboloop_parallel_for(3, 100003, chunk, sum, nullptr, &total,
+                           sizeof(total), add);
+    EXPECT_EQ(total, (3 + 100002) * int64_t(100000) / 2);
+  }
+  // empty ranges leave the identity
+  int64_t total = 0;
+  turboloop_parallel_for(5, 5, 0, sum, nullptr, &total, sizeof(total), add);
+  EXPECT_EQ(total, 0);
+}
@@ -0,0 +1,193 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <string>
+#ifndef USE_MODULE
+#include "TestUtilities.cxx"
+#include "Optimize/CostModeling.cxx"
+#include "Optimize/LoopTransform.cxx"
+#include "Optimize/TransformCache.cxx"
+#include "Utilities/MatrixStringParse.cxx"
+#else
+
+import ArrayParse;
+import CostModeling;
+import LoopTransform;
+import TestUtilities;
+import TransformCache;
+#endif
+
+using CostModeling::LoopTransform, CostModeling::NestKey,
+  CostModeling::NestHasher, CostModeling::TransformCache,
+  utils::operator""_mat;
+
+namespace {
+
+// The key of `for (i = 0:I-1) B[i] = A[i]` if `!twoDeep`, and otherwise of
+// `for (i = 0:I-1, j = 0:J-1) B[i,j] = A[i,j]`, or `A[j,i]` if `transposed`.
+auto copyKey(bool twoDeep, bool transposed) -> NestKey {
+  TestLoopFunction tlf;
+  IR::FunArg *ptrA = tlf.createArray(), *ptrB = tlf.createArray();
+  IR::Cint *one = tlf.getConstInt(1);
+  IR::Addr *load;
+  if (twoDeep) {
+    poly::Loop *loop = tlf.addLoop("[-1 1 0 -1 0; "
+                                   "0 0 0 1 0; "
+                                   "-1 0 1 0 -1; "
+                                   "0 0 0 0 1]"_mat,
+                                   2);
+    std::array<IR::Value *, 2> sizes{loop->getSyms()[1], one};
+    load = tlf.createLoad(ptrA, tlf.getDoubleTy(),
+                          transposed ? "[0 1; 1 0]"_mat : "[1 0; 0 1]"_mat,
+                          sizes, "[0 0 0]"_mat, loop);
+    tlf.createStow(ptrB, load, "[1 0; 0 1]"_mat, sizes, "[0 0 1]"_mat, loop);
+  } else {
+    poly::Loop *loop = tlf.addLoop("[-1 1 -1; "
+                                   "0 0 1]"_mat,
+                                   1);
+    std::array<IR::Value *, 1> sizes{one};
+    load = tlf.createLoad(ptrA, tlf.getDoubleTy(), "[1]"_mat, sizes,
+                          "[0 0]"_mat, loop);
+    tlf.createStow(ptrB, load, "[1]"_mat, sizes, "[0 1]"_mat, loop);
+  }
+  poly::Dependencies deps{};
+  alloc::OwningArena arena;
+  lp::LoopBlock block{deps, arena};
+  lp::LoopBlock::OptimizationResult res =
+    block.optimize(tlf.getIRC(), tlf.getTreeResult());
+  EXPECT_NE(res.nodes, nullptr);
+  dict::set<llvm::BasicBlock *> loop_bbs{};
+  dict::set<llvm::CallBase *> erase_candidates{};
+  auto [root, loop_count] = CostModeling::buildLoopTree(
+    arena, deps, tlf.getIRC(), loop_bbs, erase_candidates, res);
+  EXPECT_EQ(loop_count, twoDeep ? 2 : 1);
+  return NestHasher::key(root, target::MachineCore::Arch::SkylakeServer, 0);
+}
+
+} // namespace
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(TransformCacheTest, BasicAssertions) {
+  llvm::SmallString<128> path;
+  ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("transform-cache", "bin",
+                                                  path));
+  std::array<LoopTransform, 2> trfs{
+    LoopTransform{.l2vector_width_ = 3,
+                  .register_unroll_factor_ = 1,
+                  .cache_unroll_factor_ = 0,
+                  .cache_permutation_ = 0},
+    LoopTransform{.l2vector_width_ = 0,
+                  .register_unroll_factor_ = 3,
+                  .cache_unroll_factor_ = 7,
+                  .cache_permutation_ = 1}};
+  NestKey k42{.hash_ = 42, .canon_ = {1, 2, 3}},
+    k43{.hash_ = 43, .canon_ = {4}}, k44{.hash_ = 44, .canon_ = {5}};
+  {
+    TransformCache cache{std::string(path)};
+    EXPECT_FALSE(cache.lookup(k42));
+    cache.insert(k42, trfs, 1.5e6);
+    EXPECT_TRUE(cache.lookup(k42));
+    EXPECT_TRUE(cache.save());
+  }
+  {
+    TransformCache cache{std::string(path)};
+    auto found = cache.lookup(k42);
+    ASSERT_TRUE(found);
+    EXPECT_EQ(found->cost_, 1.5e6);
+    ASSERT_EQ(ptrdiff_t(found->trfs_.size()), 2);
+    EXPECT_EQ(found->trfs_[0].vector_width(), 8);
+    EXPECT_EQ(found->trfs_[0].reg_unroll(), 2);
+    EXPECT_EQ(found->trfs_[1].reg_unroll(), 4);
+    EXPECT_EQ(found->trfs_[1].cache_unroll(), 8);
+    EXPECT_EQ(found->trfs_[1].cache_perm(), 1);
+    EXPECT_FALSE(cache.lookup(k43));
+    // a second session appends
+    cache.insert(k43, {trfs.data(), 1}, 250.0);
+    EXPECT_TRUE(cache.save());
+  }
+  {
+    // a truncated trailing record is ignored
+    std::error_code ec;
+    llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Append);
+    ASSERT_FALSE(ec);
+    uint64_t hash = k44.hash_;
+    os.write(reinterpret_cast<const char *>(&hash), sizeof(hash));
+  }
+  {
+    TransformCache cache{std::string(path)};
+    EXPECT_TRUE(cache.lookup(k42));
+    ASSERT_TRUE(cache.lookup(k43));
+    EXPECT_EQ(ptrdiff_t(cache.lookup(k43)->trfs_.size()), 1);
+    EXPECT_EQ(cache.lookup(k43)->cost_, 250.0);
+    EXPECT_FALSE(cache.lookup(k44));
+  }
+  llvm::sys::fs::remove(path);
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(TransformCacheTest, HashCollision) {
+  llvm::SmallString<128> path;
+  ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("transform-cache", "bin",
+                                                  path));
+  LoopTransform a{.l2vector_width_ = 2,
+                  .register_unroll_factor_ = 0,
+                  .cache_unroll_factor_ = 0,
+                  .cache_permutation_ = 0},
+    b{.l2vector_width_ = 0,
+      .register_unroll_factor_ = 5,
+      .cache_unroll_factor_ = 0,
+      .cache_permutation_ = 0};
+  // same hash, different nests (or options): neither may see the other's
+  NestKey ka{.hash_ = 7, .canon_ = {1, 0}}, kb{.hash_ = 7, .canon_ = {1, 1}};
+  {
+    TransformCache cache{std::string(path)};
+    cache.insert(ka, {&a, 1}, 1.0);
+    EXPECT_FALSE(cache.lookup(kb));
+    cache.insert(kb, {&b, 1}, 2.0);
+    EXPECT_TRUE(cache.save());
+  }
+  {
+    TransformCache cache{std::string(path)};
+    ASSERT_TRUE(cache.lookup(ka));
+    ASSERT_TRUE(cache.lookup(kb));
+    EXPECT_EQ(cache.lookup(ka)->trfs_[0].vector_width(), 4);
+    EXPECT_EQ(cache.lookup(kb)->trfs_[0].reg_unroll(), 6);
+    EXPECT_EQ(cache.lookup(kb)->cost_, 2.0);
+    EXPECT_FALSE(cache.lookup({.hash_ = 7, .canon_ = {1}}));
+  }
+  {
+    // files of an older format are ignored, then replaced on `save()`
+    std::error_code ec;
+    llvm::raw_fd_ostream os(path, ec);
+    ASSERT_FALSE(ec);
+    uint64_t old_magic = 0x33435446'4D504C4CULL;
+    os.write(reinterpret_cast<const char *>(&old_magic), sizeof(old_magic));
+  }
+  {
+    TransformCache cache{std::string(path)};
+    EXPECT_FALSE(cache.lookup(ka));
+    cache.insert(ka, {&a, 1}, 1.0);
+    EXPECT_TRUE(cache.save());
+  }
+  {
+    TransformCache cache{std::string(path)};
+    EXPECT_TRUE(cache.lookup(ka));
+  }
+  llvm::sys::fs::remove(path);
+}
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(TransformCacheTest, DistinctNests) {
+  NestKey copy = copyKey(true, false), again = copyKey(true, false),
+          transposed = copyKey(true, true), shallow = copyKey(false, false);
+  // the key does not depend on pointers or names, only on the nest
+  EXPECT_EQ(copy.hash_, again.hash_);
+  EXPECT_EQ(copy.canon_, again.canon_);
+  EXPECT_NE(copy.canon_, transposed.canon_);
+  EXPECT_NE(copy.canon_, shallow.canon_);
+  EXPECT_NE(transposed.canon_, shallow.canon_);
+}
@@ -7,6 +7,8 @@
 #include <llvm/IR/Type.h>
 #include <llvm/Support/Allocator.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
 #ifndef USE_MODULE
 #include "Alloc/Arena.cxx"
 #include "Dicts/Dict.cxx"
@@ -330,11 +332,7 @@ TEST(TriangularExampleTest, BasicAssertions) {
     }
   }
 
-  for (IR::Addr *A : tlf.getTreeResult().getAddr()) {
-    A->setEdgeIn(-1);
-    A->setEdgeOut(-1);
-  }
-  deps.clear();
+  tlf.clearDependencies(deps);
 
   alloc::OwningArena salloc;
   lp::LoopBlock lblock{deps, salloc};
@@ -390,6 +388,80 @@ TEST(TriangularExampleTest, BasicAssertions) {
   EXPECT_EQ(trfs[0].cache_perm(), 15);
   EXPECT_EQ(trfs[1].cache_perm(), 1);
   EXPECT_EQ(trfs[2].cache_perm(), 2);
+  {
+    // Over the cost evaluation budget, the search turns greedy, settling for
+    // the first register unroll of each loop.
+    auto s = salloc.scope();
+    auto [opt_greedy, trfs_greedy, greedy] = CostModeling::optimizeTransforms(
+      &salloc, TL, int(trfs.size()), tlf.getTarget(), 1);
+    EXPECT_TRUE(greedy);
+    for (CostModeling::LoopTransform trf : trfs_greedy)
+      EXPECT_EQ(trf.reg_unroll(), 1);
+  }
+  {
+    // Searching the outer-most loop's candidates concurrently finds the same.
+    auto s = salloc.scope();
+    llvm::ThreadPool pool{llvm::hardware_concurrency(4)};
+    auto [opt_par, trfs_par, greedy] = CostModeling::optimizeTransforms(
+      &salloc, TL, int(trfs.size()), tlf.getTarget(), 0, false, &pool);
+    EXPECT_FALSE(greedy);
+    EXPECT_EQ(opt_par, opt);
+    ASSERT_EQ(trfs_par.size(), trfs.size());
+    for (ptrdiff_t i = 0; i < trfs.size(); ++i) {
+      EXPECT_EQ(trfs_par[i].vector_width(), trfs[i].vector_width());
+      EXPECT_EQ(trfs_par[i].reg_unroll(), trfs[i].reg_unroll());
+      EXPECT_EQ(trfs_par[i].cache_unroll(), trfs[i].cache_unroll());
+      EXPECT_EQ(trfs_par[i].cache_perm(), trfs[i].cache_perm());
+    }
+  }
+  {
+    // Letting two loops share the lanes only adds candidates.
+    auto s = salloc.scope();
+    auto [opt_2d, trfs_2d, greedy] = CostModeling::optimizeTransforms(
+      &salloc, TL, int(trfs.size()), tlf.getTarget(), 0, false, nullptr,
+      true);
+    EXPECT_FALSE(greedy);
+    EXPECT_LE(opt_2d, opt);
+    ASSERT_EQ(trfs_2d.size(), trfs.size());
+    for (CostModeling::LoopTransform trf : trfs_2d)
+      EXPECT_LE(trf.vector_width(), 8);
+  }
+  {
+    // Without lower bounds, candidates are only pruned once their cost so far
+    // reaches the best found; as the bounds are admissible, the result is the
+    // same.
+    auto s = salloc.scope();
+    auto [opt_nolb, trfs_nolb, greedy] = CostModeling::optimizeTransforms(
+      &salloc, TL, int(trfs.size()), tlf.getTarget(), 0, false, nullptr,
+      false, false);
+    EXPECT_FALSE(greedy);
+    EXPECT_EQ(opt_nolb, opt);
+    ASSERT_EQ(trfs_nolb.size(), trfs.size());
+    for (ptrdiff_t i = 0; i < trfs.size(); ++i) {
+      EXPECT_EQ(trfs_nolb[i].vector_width(), trfs[i].vector_width());
+      EXPECT_EQ(trfs_nolb[i].reg_unroll(), trfs[i].reg_unroll());
+      EXPECT_EQ(trfs_nolb[i].cache_unroll(), trfs[i].cache_unroll());
+      EXPECT_EQ(trfs_nolb[i].cache_perm(), trfs[i].cache_perm());
+    }
+  }
+  {
+    // Memoizing reuses the search of inner subtrees across the unrolls of the
+    // loops containing them, finding the same transforms at the same cost.
+    auto s = salloc.scope();
+    CostModeling::Hard::LoopTreeCostFn fn(&salloc, TL, tlf.getTarget(),
+                                          int(trfs.size()));
+    CostModeling::Hard::LoopTreeCostFn::OptResult memo = fn.optimize(0, true);
+    EXPECT_FALSE(memo.greedy_);
+    EXPECT_GT(memo.memo_hits_, 0);
+    EXPECT_EQ(memo.opt_value_, opt);
+    ASSERT_EQ(memo.trfs_.size(), trfs.size());
+    for (ptrdiff_t i = 0; i < trfs.size(); ++i) {
+      EXPECT_EQ(memo.trfs_[i].vector_width(), trfs[i].vector_width());
+      EXPECT_EQ(memo.trfs_[i].reg_unroll(), trfs[i].reg_unroll());
+      EXPECT_EQ(memo.trfs_[i].cache_unroll(), trfs[i].cache_unroll());
+      EXPECT_EQ(memo.trfs_[i].cache_perm(), trfs[i].cache_perm());
+    }
+  }
   // EXPECT_EQ(trfs[0].vector_width(), 1);
   // EXPECT_EQ(trfs[1].vector_width(), 8);
   // EXPECT_EQ(trfs[2].vector_width(), 1);
@@ -487,3 +559,54 @@ TEST(TriangularExampleTest, BasicAssertions) {
 
   // L->printDotFile(salloc, std::cout);
 }
+
+// NOLINTNEXTLINE(modernize-use-trailing-return-type)
+TEST(Vectorize2DTest, BasicAssertions) {
+  // for (i = 0; i < M; ++i)
+  //   for (j = 0; j <= 4; ++j){
+  //     x = A[i,j] * A[i,j]; // x^2
+  //     x = x * x;           // x^4, and so on, up to x^256
+  //     B[i,j] = x;
+  //   }
+  // With only about four iterations of `j`, vectorizing it alone leaves half
+  // the lanes of each of the many multiplies idle, so the search lets `i`
+  // and `j` share the lanes.
+  TestLoopFunction tlf;
+  poly::Loop *loop = tlf.addLoop("[-1 1 -1 0; " // i <= M-1
+                                 "0 0 1 0; "    // i >= 0
+                                 "4 0 0 -1; "   // j <= 4
+                                 "0 0 0 1]"_mat, // j >= 0
+                                 2);
+  IR::Cache &ir = tlf.getIRC();
+  std::array<IR::Value *, 2> sizes{tlf.getConstInt(5), tlf.getConstInt(1)};
+  IR::FunArg *ptrA = tlf.createArray(), *ptrB = tlf.createArray();
+  IR::Value *x = tlf.createLoad(ptrA, tlf.getDoubleTy(), "[1 0; 0 1]"_mat,
+                                sizes, "[0 0 0]"_mat, loop);
+  for (int p = 0; p < 8; ++p) x = ir.createFMul(x, x);
+  tlf.createStow(ptrB, x, "[1 0; 0 1]"_mat, sizes, "[0 0 1]"_mat, loop);
+
+  poly::Dependencies deps{};
+  alloc::OwningArena salloc;
+  lp::LoopBlock lblock{deps, salloc};
+  lp::LoopBlock::OptimizationResult optRes =
+    lblock.optimize(ir, tlf.getTreeResult());
+  ASSERT_NE(optRes.nodes, nullptr);
+  dict::set<llvm::BasicBlock *> loop_bbs{};
+  dict::set<llvm::CallBase *> erase_candidates{};
+  auto [TL, loop_count] = CostModeling::buildLoopTree(
+    salloc, deps, ir, loop_bbs, erase_candidates, optRes);
+  ASSERT_EQ(loop_count, 2);
+  auto [opt, trfs, greedy] =
+    CostModeling::optimizeTransforms(&salloc, TL, loop_count, tlf.getTarget());
+  EXPECT_FALSE(greedy);
+  ASSERT_EQ(trfs.size(), 2);
+  EXPECT_TRUE(trfs[0].vector_width() == 1 || trfs[1].vector_width() == 1);
+  auto [opt_2d, trfs_2d, greedy_2d] = CostModeling::optimizeTransforms(
+    &salloc, TL, loop_count, tlf.getTarget(), 0, false, nullptr, true);
+  EXPECT_FALSE(greedy_2d);
+  EXPECT_LT(opt_2d, opt);
+  ASSERT_EQ(trfs_2d.size(), 2);
+  EXPECT_GT(trfs_2d[0].vector_width(), 1);
+  EXPECT_GT(trfs_2d[1].vector_width(), 1);
+  EXPECT_LE(trfs_2d[0].vector_width() * trfs_2d[1].vector_width(), 8);
+}